@@ -1,8 +1,15 @@
 #include "Mosaic.hpp"
+#include "angle_breaks.hpp"
+#include "contour_split.hpp"
+#include "graphics.hpp"
+#include "segment_file.hpp"
+#include "tile_index.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
 #include <opencv2/opencv.hpp>
 #include <iostream>
-#include <random>
 #include <cmath>
+#include <cstring>
 #include <filesystem>
 
 using namespace std;
@@ -10,28 +17,205 @@ namespace fs = std::__fs::filesystem;
 
 namespace mosaic_gen {
 
+namespace {
+
+// FNV-1a over the bit patterns of upstream and params. An upstream of 0 means the
+// input was not produced by its stage (e.g. set by hand), so nothing is cached on it.
+uint64_t stageFingerprint(uint64_t upstream, std::initializer_list<double> params) {
+    if (upstream == 0) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint64_t value) {
+        for (int byte = 0; byte < 8; ++byte) {
+            hash ^= (value >> (byte * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(upstream);
+    for (double param : params) {
+        uint64_t bits;
+        std::memcpy(&bits, &param, sizeof(bits));
+        mix(bits);
+    }
+    return hash | 1;   // 0 is reserved for "not computed"
+}
+
+[[maybe_unused]] size_t matBytes(const cv::Mat& image) {
+    return image.total() * image.elemSize();
+}
+
+}
+
+
 // param constructor
-Mosaic::Mosaic(const std::string& image_path) { 
-    original = cv::imread(image_path);
+Mosaic::Mosaic(const std::string& image_path, int threads) : Mosaic(image_path, LoadOptions(), threads) {}
 
-    if (original.empty()) { 
+
+Mosaic::Mosaic(const std::string& image_path, const LoadOptions& options, int threads)
+    : Mosaic(loadImage(image_path, options.keep_original ? 1.0 : options.resize_factor, options.memory_map), image_path, threads) {}
+
+
+Mosaic::Mosaic(const LoadedImage& loaded, const std::string& image_path, int threads) : threads(threads) { 
+    resetImage(loaded, image_path);
+}
+
+
+Mosaic::Mosaic(const cv::Mat& image, const std::string& image_path, int threads) : threads(threads) { 
+    resetImage(image, image_path);
+}
+
+
+Mosaic::Mosaic(int threads) : threads(threads) {}
+
+
+void Mosaic::resetImage(const LoadedImage& loaded, const std::string& image_path) { 
+    clearImageState();
+
+    if (loaded.empty()) { 
         cerr << "Error: Could not load image from path: " << image_path << endl;
         return;
     }
 
     file_path = image_path;
     image_name = fs::path(image_path).stem().string();
+    source_size = loaded.source_size;
+
+    if (loaded.resize_factor == 1.0) { 
+        original = loaded.image;
+        MOSAIC_TRACE_MEMORY("original", matBytes(original));
+        return;
+    }
+
+    // Already at working scale, record it as the resize stage's output
+    resized = loaded.image;
+    resized_factor = loaded.resize_factor;
+    stage_keys[RESIZE] = stageFingerprint(sourceKey(), {loaded.resize_factor});
+    MOSAIC_TRACE_MEMORY("resized", matBytes(resized));
+}
+
+
+void Mosaic::resetImage(const cv::Mat& image, const std::string& image_path) { 
+    clearImageState();
+    original = image;
+
+    if (original.empty()) { 
+        cerr << "Error: Empty image given for: " << image_path << endl;
+        return;
+    }
+
+    file_path = image_path;
+    image_name = fs::path(image_path).stem().string();
+    source_size = original.size();
+    MOSAIC_TRACE_MEMORY("original", matBytes(original));
 
 }
 
 
+void Mosaic::adoptStages(const std::string& image_path, cv::Size source_size, double resize_factor,
+                         const cv::Mat& resized, const cv::Mat& edges, SegmentStore&& segments) { 
+    clearImageState();
+
+    file_path = image_path;
+    image_name = fs::path(image_path).stem().string();
+    this->source_size = source_size;
+    this->resized = resized;
+    this->edges = edges;
+    this->segments = std::move(segments);
+    resized_factor = resize_factor;
+    stage_keys[RESIZE] = stageFingerprint(sourceKey(), {resize_factor});
+    MOSAIC_TRACE_MEMORY("resized", matBytes(this->resized));
+    MOSAIC_TRACE_MEMORY("edges", matBytes(this->edges));
+    MOSAIC_TRACE_MEMORY("segments", this->segments.memoryBytes());
+}
+
+
+// Stage outputs go back to the workspace, everything derived from the image is dropped
+void Mosaic::clearImageState() { 
+    workspace.park("resized", resized);
+    workspace.park("grayscale", grayscale);
+    workspace.park("blurred", blurred);
+    workspace.park("edges", edges);
+    workspace.park("segmented", segmented);
+    workspace.park("labels", labels);
+    workspace.park("selected_segment", selected_segment);
+    workspace.park("mask", mask);
+    workspace.park("canvas", canvas);
+
+    original.release();
+    resized_factor = 0.0;
+    source_size = cv::Size();
+    file_path.clear();
+    image_name.clear();
+
+    segments.clear();
+    segment_stats.clear();
+    segment_lengths.clear();
+    tiles.clear();
+
+    keyed_original.release();
+    invalidateStages();
+    disk_stages_key = 0;
+    random_draws = 0;
+    color_sampler.clear();
+    color_sampler_key = 0;
+    orientation.clear();
+}
+
+
 void Mosaic::resizeOriginal(double resize_factor) { 
+    const uint64_t key = stageFingerprint(sourceKey(), {resize_factor});
+    if (stageCurrent(RESIZE, key)) {
+        return;
+    }
+
     if (original.empty()) { 
-        cerr << "Resized called but no original image found" << endl;
+        // decoded at this scale without keeping the original, current whatever
+        // the stage cache says
+        if (!resized.empty() && resized_factor == resize_factor) {
+            stage_keys[RESIZE] = key;
+            return;
+        }
+        redecodeResized(resize_factor);
         return;
     }
 
+    MOSAIC_TRACE_SCOPE("resizeOriginal");
+    workspace.prepare("resized", resized, cv::Size(cvRound(original.cols * resize_factor), cvRound(original.rows * resize_factor)),
+                      original.type());
     cv::resize(original, resized, cv::Size(), resize_factor, resize_factor, cv::INTER_LINEAR);
+    resized_factor = resize_factor;
+    MOSAIC_TRACE_MEMORY("resized", matBytes(resized));
+    markStage(RESIZE, key);
+}
+
+
+// No original to resize from: decode file_path again at the new factor. On any
+// failure resized is dropped, so the stages after it stop instead of running
+// at the wrong scale.
+void Mosaic::redecodeResized(double resize_factor) { 
+    MOSAIC_TRACE_SCOPE("redecodeResized");
+    const std::string name = file_path.empty() ? image_name : file_path;
+    resized.release();
+    resized_factor = 0.0;
+    markStage(RESIZE, 0);
+
+    if (file_path.empty()) {
+        cerr << "Error: resizeOriginal(" << resize_factor << ") needs the original of " << name
+             << ", which was not kept and has no file to decode again" << endl;
+        return;
+    }
+    LoadedImage loaded = loadImage(file_path, resize_factor);
+    if (loaded.empty() || loaded.source_size != source_size) {
+        cerr << "Error: could not decode " << file_path << " again at resize factor " << resize_factor
+             << (loaded.empty() ? "" : ", the file changed size") << endl;
+        return;
+    }
+
+    resized = loaded.image;
+    resized_factor = resize_factor;
+    markStage(RESIZE, stageFingerprint(sourceKey(), {resize_factor}));
+    MOSAIC_TRACE_MEMORY("resized", matBytes(resized));
 }
 
 
@@ -42,7 +226,17 @@ void Mosaic::grayImage() {
         cerr << "Gray called but no resized image" << endl;
         return;
     }
+
+    const uint64_t key = stageFingerprint(stage_keys[RESIZE], {});
+    if (stageCurrent(GRAY, key)) {
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("grayImage");
+    workspace.prepare("grayscale", grayscale, resized.size(), CV_8UC1);
     cv::cvtColor(resized, grayscale, cv::COLOR_BGR2GRAY);
+    MOSAIC_TRACE_MEMORY("grayscale", matBytes(grayscale));
+    markStage(GRAY, key);
 }
 
 
@@ -57,7 +251,16 @@ void Mosaic::blurImage(int kernel_size, double sigma) {
         kernel_size += 1;
     }
 
+    const uint64_t key = stageFingerprint(stage_keys[GRAY], {double(kernel_size), sigma});
+    if (stageCurrent(BLUR, key)) {
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("blurImage");
+    workspace.prepare("blurred", blurred, grayscale.size(), grayscale.type());
     cv::GaussianBlur(grayscale, blurred, cv::Size(kernel_size, kernel_size), sigma);
+    MOSAIC_TRACE_MEMORY("blurred", matBytes(blurred));
+    markStage(BLUR, key);
 }
 
 
@@ -67,137 +270,225 @@ void Mosaic::cannyFilter(int threshold_1, int threshold_2) {
         cerr << "Canny called but no blurred" << endl;
         return;
     }
+
+    const uint64_t key = stageFingerprint(stage_keys[BLUR], {double(threshold_1), double(threshold_2)});
+    if (stageCurrent(CANNY, key)) {
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("cannyFilter");
+    workspace.prepare("edges", edges, blurred.size(), CV_8UC1);
     cv::Canny(blurred, edges, threshold_1, threshold_2);
+    MOSAIC_TRACE_MEMORY("edges", matBytes(edges));
+    MOSAIC_TRACE_COUNTER("edge_pixels", cv::countNonZero(edges));
+    markStage(CANNY, key);
 }
 
-int Mosaic::detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window) { 
+int Mosaic::detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window, bool build_labels) { 
     if (edges.empty()) {
         cerr << "DetectContours called but no edges" << endl;
         return -1;
     }
 
-    // Find contours
-    std::vector<std::vector<cv::Point>> contours;
-    cv::findContours(edges.clone(), contours, cv::RETR_LIST, cv::CHAIN_APPROX_NONE);
-
-    // Create an output color image
-    segmented = cv::Mat::zeros(edges.size(), CV_8UC3);
-    int contour_id = 0;
-    std::vector<cv::Vec3b> colors_used;
-
-    std::mt19937 rng(std::random_device{}());
-    std::uniform_int_distribution<int> color_dist(64, 255);
+    const uint64_t key = stageFingerprint(stage_keys[CANNY], {max_segment_angle_rad, double(min_segment_length),
+                                                             double(segment_angle_window), double(build_labels)});
+    if (stageCurrent(CONTOURS, key)) {
+        return segments.size();
+    }
 
-    for (const auto& contour : contours) {
-        if (contour.size() < 3)
-            continue;
+    traceSegments(max_segment_angle_rad, min_segment_length, segment_angle_window, build_labels, cv::Mat(), nullptr);
+    markStage(CONTOURS, key);
+    return segments.size();
+}
 
-        std::vector<int> breaks;
-        int len = contour.size();
-        int w = segment_angle_window;
 
-        for (int i = w; i < len - w; ++i) {
-            cv::Point2f v1 = contour[i] - contour[i - w];
-            cv::Point2f v2 = contour[i + w] - contour[i];
+int Mosaic::detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window,
+                           const cv::Mat& region, const SegmentStore& kept) { 
+    if (edges.empty()) {
+        cerr << "DetectContours called but no edges" << endl;
+        return -1;
+    }
+    if (region.size() != edges.size() || (!kept.empty() && kept.frameSize() != edges.size())) {
+        cerr << "DetectContours called with a region or kept segments of another size" << endl;
+        return -1;
+    }
 
-            double norm1 = std::sqrt(v1.x * v1.x + v1.y * v1.y) + 1e-8;
-            double norm2 = std::sqrt(v2.x * v2.x + v2.y * v2.y) + 1e-8;
+    traceSegments(max_segment_angle_rad, min_segment_length, segment_angle_window, false, region, &kept);
+    // no fingerprint describes a partial trace, so a full detectContours always reruns
+    markStage(CONTOURS, 0);
+    return segments.size();
+}
 
-            cv::Point2f n1 = v1 / norm1;
-            cv::Point2f n2 = v2 / norm2;
 
-            double cosine = std::clamp(n1.dot(n2), -1.0f, 1.0f);
-            double angle = std::acos(std::abs(cosine));
+// Contours of edges, or of edges & region inside region's bounding box, split
+// into segments after the ones of kept
+void Mosaic::traceSegments(double max_segment_angle_rad, int min_segment_length, int segment_angle_window, bool build_labels,
+                           const cv::Mat& region, const SegmentStore* kept) { 
+    MOSAIC_TRACE_SCOPE("detectContours");
 
-            if (angle > max_segment_angle_rad) {
-                breaks.push_back(i);
+    // Find contours
+    std::vector<std::vector<cv::Point>> contours;
+    const cv::Rect area = region.empty() ? cv::Rect(0, 0, edges.cols, edges.rows) : cv::boundingRect(region);
+    {
+        MOSAIC_TRACE_SCOPE("detectContours/findContours");
+        // findContours may write to its input, so it gets a recycled copy of edges
+        if (!area.empty()) {
+            cv::Mat& contour_input = workspace.scratch("contour_input", area.size(), edges.type());
+            if (region.empty()) {
+                edges.copyTo(contour_input);
             }
+            else {
+                cv::bitwise_and(edges(area), region(area), contour_input);
+            }
+            cv::findContours(contour_input, contours, cv::RETR_LIST, cv::CHAIN_APPROX_NONE, area.tl());
         }
+    }
+
+    size_t contour_points = 0;
+    for (const auto& contour : contours) {
+        contour_points += contour.size();
+    }
+    MOSAIC_TRACE_COUNTER("contours", contours.size());
+    MOSAIC_TRACE_MEMORY("contours", contour_points * sizeof(cv::Point));
+
+    // Segments go straight into the store, colors are only painted on demand
+    segments.reset(edges.size());
+    if (kept) {
+        segments.reserve(kept->size() + contours.size(), kept->totalPoints() + contour_points);
+        segments.append(*kept);
+    }
+    else {
+        segments.reserve(contours.size(), contour_points);
+    }
+    workspace.park("segmented", segmented);
+    segment_lengths.clear();
+    segment_stats.clear();
 
-        // Build split indices
-        std::vector<int> split_idxs = {0};
-        split_idxs.insert(split_idxs.end(), breaks.begin(), breaks.end());
-        split_idxs.push_back(len);
+    const float break_cos2 = angleBreakCos2(max_segment_angle_rad);
+    const int worker_count = resolveThreadCount(threads);
+    size_t break_count = 0;
 
-        for (size_t i = 0; i < split_idxs.size() - 1; ++i) {
-            int a = split_idxs[i];
-            int b = split_idxs[i + 1];
-            if (b - a < min_segment_length)
-                continue;
+    MOSAIC_TRACE_SCOPE("detectContours/segment");
+    if (worker_count == 1 || contours.size() < 2) {
+        ContourScratch scratch;
+        for (const auto& contour : contours) {
+            segmentContour(contour, break_cos2, min_segment_length, segment_angle_window, scratch, segments);
+        }
+        break_count = scratch.break_count;
+    }
+    else {
+        // Contiguous contour ranges with roughly equal point counts. Chunks are
+        // appended in contour order, so ids match the serial path for any thread count.
+        const size_t chunk_target = std::min(contours.size(), static_cast<size_t>(worker_count) * 8);
+        const size_t points_per_chunk = contour_points / chunk_target + 1;
+
+        std::vector<size_t> chunk_starts = {0};
+        size_t chunk_points = 0;
+        for (size_t c = 0; c < contours.size(); ++c) {
+            chunk_points += contours[c].size();
+            if (chunk_points >= points_per_chunk && c + 1 < contours.size()) {
+                chunk_starts.push_back(c + 1);
+                chunk_points = 0;
+            }
+        }
+        chunk_starts.push_back(contours.size());
 
-            // Generate a new color not used yet
-            cv::Vec3b color;
-            do {
-                color = cv::Vec3b(color_dist(rng), color_dist(rng), color_dist(rng));
-            } while (std::find(colors_used.begin(), colors_used.end(), color) != colors_used.end());
+        const size_t chunk_count = chunk_starts.size() - 1;
+        std::vector<SegmentStore> chunk_segments(chunk_count);
+        std::vector<size_t> chunk_breaks(chunk_count, 0);
 
-            colors_used.push_back(color);
+        parallelFor(chunk_count, worker_count, [&](size_t chunk) {
+            MOSAIC_TRACE_SCOPE("detectContours/chunk");
+            SegmentStore& out = chunk_segments[chunk];
+            out.reset(edges.size());
 
-            for (int j = a; j < b; ++j) {
-                const auto& pt = contour[j];
-                if (pt.y >= 0 && pt.y < segmented.rows && pt.x >= 0 && pt.x < segmented.cols) {
-                    segmented.at<cv::Vec3b>(pt.y, pt.x) = color;
-                }
+            ContourScratch scratch;
+            for (size_t c = chunk_starts[chunk]; c < chunk_starts[chunk + 1]; ++c) {
+                segmentContour(contours[c], break_cos2, min_segment_length, segment_angle_window, scratch, out);
             }
+            chunk_breaks[chunk] = scratch.break_count;
+        });
 
-            ++contour_id;
+        for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+            segments.append(chunk_segments[chunk]);
+            break_count += chunk_breaks[chunk];
         }
     }
 
-    return contour_id;
-}
+    {
+        // One point per pixel, owned by the last segment through it, as when
+        // segments were painted into the color image and ranked from there
+        MOSAIC_TRACE_SCOPE("detectContours/overlaps");
+        const int first = kept ? kept->size() : 0;
+        segments.resolveOverlaps(first, area, workspace.scratch("segment_owner", area.size(), CV_32S));
+    }
 
-void Mosaic::rankSegments() { 
-    if (segmented.empty()) {
-        std::cerr << "rankSegments called but segmented image is empty" << std::endl;
-        return;
+    MOSAIC_TRACE_COUNTER("breaks", break_count);
+    MOSAIC_TRACE_COUNTER("segments", segments.size());
+    MOSAIC_TRACE_COUNTER("points", segments.totalPoints());
+    MOSAIC_TRACE_MEMORY("segments", segments.memoryBytes());
+
+    if (build_labels) {
+        workspace.prepare("labels", labels, edges.size(), CV_32S);
+        segments.paintLabels(labels);
     }
+    else {
+        workspace.park("labels", labels);
+    }
+    MOSAIC_TRACE_MEMORY("labels", matBytes(labels));
+}
 
-    segment_pixels.clear();
-    segment_lengths.clear();
 
-    // Collect pixels for each color (excluding black)
-    for (int y = 0; y < segmented.rows; ++y) {
-        for (int x = 0; x < segmented.cols; ++x) {
-            cv::Vec3b color = segmented.at<cv::Vec3b>(y, x);
-            if (color != cv::Vec3b(0, 0, 0)) {
-                segment_pixels[color].emplace_back(x, y);
-            }
-        }
+void Mosaic::paintSegments() { 
+    if (segments.empty()) {
+        std::cerr << "paintSegments called but no segments detected" << std::endl;
+        return;
     }
 
-    // Helper lambda for PCA length
-    auto pca_length = [](const std::vector<cv::Point>& points) -> double {
-        if (points.size() < 2)
-            return 0.0;
+    MOSAIC_TRACE_SCOPE("paintSegments");
+    workspace.prepare("segmented", segmented, segments.frameSize(), CV_8UC3);
+    segments.paintColors(segmented);
+    MOSAIC_TRACE_MEMORY("segmented", matBytes(segmented));
+}
 
-        cv::Mat data(points.size(), 2, CV_64F);
-        for (size_t i = 0; i < points.size(); ++i) {
-            data.at<double>(i, 0) = points[i].x;
-            data.at<double>(i, 1) = points[i].y;
-        }
 
-        cv::PCA pca(data, cv::Mat(), cv::PCA::DATA_AS_ROW, 1);
-        cv::Mat projected;
-        pca.project(data, projected);
+void Mosaic::rankSegments() { 
+    if (segments.empty()) {
+        std::cerr << "rankSegments called but no segments detected" << std::endl;
+        return;
+    }
 
-        double minVal, maxVal;
-        cv::minMaxLoc(projected.col(0), &minVal, &maxVal);
+    const uint64_t key = stageFingerprint(stage_keys[CONTOURS], {});
+    if (stageCurrent(RANK, key)) {
+        return;
+    }
 
-        return maxVal - minVal;
-    };
+    MOSAIC_TRACE_SCOPE("rankSegments");
+    segment_lengths.clear();
+    segment_lengths.reserve(segments.size());
+
+    // Moments were accumulated by detectContours, only the extent pass is left
+    segment_stats.resize(segments.size());
+    const size_t block_size = 1024;
+    const size_t block_count = (segments.size() + block_size - 1) / block_size;
+    parallelFor(block_count, threads, [&](size_t block) {
+        const int end = std::min<int>(segments.size(), (block + 1) * block_size);
+        for (int id = block * block_size; id < end; ++id) {
+            segment_stats[id] = segments.stats(id);
+        }
+    });
 
-    // Compute PCA length per color segment
-    for (const auto& [color, pixels] : segment_pixels) {
-        double length = pca_length(pixels);
-        segment_lengths.emplace_back(color, length);
+    for (int id = 0; id < segments.size(); ++id) {
+        segment_lengths.emplace_back(id, segment_stats[id].length);
     }
 
-    // Sort descending by length
-    std::sort(segment_lengths.begin(), segment_lengths.end(),
+    // Sort descending by length, ties keep detection order
+    std::stable_sort(segment_lengths.begin(), segment_lengths.end(),
               [](const auto& a, const auto& b) {
                   return a.second > b.second;
               });
+    MOSAIC_TRACE_MEMORY("segment_stats", segment_stats.size() * sizeof(SegmentStats));
+    markStage(RANK, key);
 }
 
 
@@ -213,23 +504,18 @@ void Mosaic::selectSegment(int k) {
         return;
     }
 
-    const cv::Vec3b& selected_color = segment_lengths[k].first;
-
-    auto it = segment_pixels.find(selected_color);
-    if (it == segment_pixels.end()) {
-        std::cerr << "selectSegment: Selected color not found in segment_pixels.\n";
-        return;
-    }
+    MOSAIC_TRACE_SCOPE("selectSegment");
+    const int id = segment_lengths[k].first;
 
     // Create a blank image
-    selected_segment = cv::Mat::zeros(segmented.size(), CV_8UC3);
+    workspace.prepare("selected_segment", selected_segment, segments.frameSize(), CV_8UC3);
+    selected_segment.setTo(cv::Scalar::all(0));
 
     // Draw only the selected segment
-    for (const auto& pt : it->second) {
-        if (pt.y >= 0 && pt.y < selected_segment.rows && pt.x >= 0 && pt.x < selected_segment.cols) {
-            selected_segment.at<cv::Vec3b>(pt.y, pt.x) = cv::Vec3b(255, 255, 255);
-        }
-    }
+    segments.forEachPoint(id, [&](int x, int y) {
+        selected_segment.at<cv::Vec3b>(y, x) = cv::Vec3b(255, 255, 255);
+    });
+    MOSAIC_TRACE_MEMORY("selected_segment", matBytes(selected_segment));
 }
 
 
@@ -239,27 +525,321 @@ cv::Point Mosaic::getRandomPointOnSegment(int k) {
         throw std::out_of_range("Segment index k is out of range");
     }
 
-    // Get the color for segment k (assuming segment_lengths[k].first is the color)
-    const cv::Vec3b& color = segment_lengths[k].first;
+    const int id = segment_lengths[k].first;
+    const size_t point_count = segments.segmentSize(id);
 
-    // Find the vector of points corresponding to this color
-    auto it = segment_pixels.find(color);
-    if (it == segment_pixels.end()) {
-        throw std::runtime_error("Color not found in segment_pixels");
+    if (point_count == 0) {
+        throw std::runtime_error("No points in the selected segment");
     }
 
-    const std::vector<cv::Point>& points = it->second;
+    // Draw n of this seed's stream; the modulo bias is below point_count / 2^64
+    const uint64_t draw = random_draws.fetch_add(1, std::memory_order_relaxed);
+    return segments.point(id, mixSeed(random_seed, draw) % point_count);
+}
 
-    if (points.empty()) {
-        throw std::runtime_error("No points in the selected segment");
+
+void Mosaic::setSeed(uint64_t seed) { 
+    random_seed = seed;
+    random_draws = 0;
+}
+
+
+
+
+
+void Mosaic::buildOrientationField(const OrientationOptions& options) { 
+    if (blurred.empty() || edges.empty()) {
+        std::cerr << "buildOrientationField called but no blurred / edges" << std::endl;
+        return;
+    }
+
+    const uint64_t key = stageFingerprint(stage_keys[CANNY], {double(options.sobel_size), options.tensor_sigma});
+    if (stageCurrent(ORIENT, key) && !orientation.empty()) {
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("buildOrientationField");
+    orientation.build(blurred, edges, options, threads);
+    markStage(ORIENT, key);
+}
+
+
+void Mosaic::setAngleLookup(bool enabled, int refine_deg) { 
+    angle_lookup = enabled;
+    angle_refine_deg = std::max(0, refine_deg);
+}
+
+
+// Walk the longest segments and place a tile every tile_size points along each,
+// oriented by TilePlacer against the edges and kept apart by a TileIndex.
+int Mosaic::placeTiles(int tile_size, int max_segments, double min_gap, int theta_step, double decay_rate) { 
+    return placeTiles(tile_size, max_segments, min_gap, theta_step, decay_rate, {}, cv::Mat());
+}
+
+
+int Mosaic::placeTiles(int tile_size, int max_segments, double min_gap, int theta_step, double decay_rate,
+                       const std::vector<TilePlacement>& keep, const cv::Mat& seed_region) { 
+    return placeTiles(tile_size, cv::Mat(), max_segments, min_gap, theta_step, decay_rate, keep, seed_region);
+}
+
+
+int Mosaic::placeTiles(const cv::Mat& tile_sizes, int max_segments, double min_gap, int theta_step, double decay_rate) { 
+    if (tile_sizes.size() != edges.size() || tile_sizes.type() != CV_8UC1) {
+        std::cerr << "placeTiles needs a CV_8UC1 tile size map the size of edges" << std::endl;
+        return -1;
+    }
+    double largest = 0.0;
+    cv::minMaxLoc(tile_sizes, nullptr, &largest);
+    return placeTiles(std::max(1, static_cast<int>(largest)), tile_sizes, max_segments, min_gap, theta_step, decay_rate, {}, cv::Mat());
+}
+
+
+// tile_size is the largest size in tile_sizes when that map is given
+int Mosaic::placeTiles(int tile_size, const cv::Mat& tile_sizes, int max_segments, double min_gap, int theta_step, double decay_rate,
+                       const std::vector<TilePlacement>& keep, const cv::Mat& seed_region) { 
+    if (segment_lengths.empty()) {
+        std::cerr << "placeTiles called but segment_lengths is empty." << std::endl;
+        return -1;
+    }
+
+    MOSAIC_TRACE_SCOPE("placeTiles");
+    TilePlacer placer(decay_rate);
+    placer.setGuide(edges);
+    TileIndex placed(edges.size(), tile_size + min_gap, min_gap);
+    tiles.clear();
+
+    for (const auto& tile : keep) {
+        placed.insert(OrientedSquare(tile.center, tile.size, tile.squareAngleDeg()));
+        tiles.push_back(tile);
+    }
+
+    const bool whole_frame = seed_region.empty();
+    const bool adaptive = !tile_sizes.empty();
+    const bool lookup = angle_lookup && orientation.angle.size() == edges.size();
+    const int segment_limit = max_segments > 0 ? max_segments : static_cast<int>(segment_lengths.size());
+    int segments_used = 0;
+
+    auto is_free = [&](const cv::Point& center, int size, int theta) {
+        return !placed.overlaps(OrientedSquare(center, size, -theta));
+    };
+
+    for (int k = 0; k < static_cast<int>(segment_lengths.size()) && segments_used < segment_limit; ++k) {
+        const int id = segment_lengths[k].first;
+        const size_t point_count = segments.segmentSize(id);
+        bool used = whole_frame;
+
+        for (size_t i = 0, step = 1; i < point_count; i += step) {
+            const cv::Point seed = segments.point(id, i);
+            const int size = adaptive ? tile_sizes.at<uchar>(seed) : tile_size;
+            step = std::max(1, size);
+            if (!whole_frame && !seed_region.at<uchar>(seed)) {
+                continue;
+            }
+            used = true;
+
+            TilePlacement tile = lookup
+                ? placer.findBestTheta(seed, size, orientation.tileThetaDeg(seed) - angle_refine_deg,
+                                       orientation.tileThetaDeg(seed) + angle_refine_deg, std::min(theta_step, angle_refine_deg), is_free)
+                : placer.findBestTheta(seed, size, -45, 45, theta_step, is_free);
+            if (tile.valid) {
+                placed.insert(OrientedSquare(tile.center, tile.size, tile.squareAngleDeg()));
+                tiles.push_back(tile);
+            }
+        }
+        segments_used += used ? 1 : 0;
+    }
+
+    workspace.prepare("mask", mask, edges.size(), CV_8UC1);
+    placed.renderMask(mask);
+    MOSAIC_TRACE_COUNTER("tiles_placed", tiles.size());
+    MOSAIC_TRACE_MEMORY("mask", matBytes(mask));
+    return static_cast<int>(tiles.size());
+}
+
+
+int Mosaic::fillBackground(const PoissonOptions& options, double min_gap) { 
+    if (resized.empty() || edges.empty()) {
+        std::cerr << "fillBackground called but no edges" << std::endl;
+        return -1;
+    }
+
+    MOSAIC_TRACE_SCOPE("fillBackground");
+    PoissonOptions seed_options = options;
+    if (seed_options.threads <= 0) {
+        seed_options.threads = threads;
+    }
+    const std::vector<PoissonSeed> seeds = poissonDiskSeeds(resized.size(), edges, seed_options);
+
+    TileIndex placed(edges.size(), options.max_spacing + min_gap, min_gap);
+    for (const auto& tile : tiles) {
+        placed.insert(OrientedSquare(tile.center, tile.size, tile.squareAngleDeg()));
+    }
+
+    int added = 0;
+    for (const auto& seed : seeds) {
+        TilePlacement tile;
+        tile.center = seed.center;
+        tile.size = seed.tileSize(min_gap);
+        tile.valid = true;
+        if (placed.tryInsert(OrientedSquare(tile.center, tile.size, tile.squareAngleDeg()))) {
+            tiles.push_back(tile);
+            ++added;
+        }
+    }
+
+    workspace.prepare("mask", mask, edges.size(), CV_8UC1);
+    placed.renderMask(mask);
+    MOSAIC_TRACE_COUNTER("background_tiles", added);
+    return added;
+}
+
+
+// Draw every placed tile in the color of the resized photo at its center
+void Mosaic::renderCanvas(int border_width) { 
+    if (resized.empty()) {
+        std::cerr << "renderCanvas called but no resized image" << std::endl;
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("renderCanvas");
+    renderTiles(border_width, nullptr);
+}
+
+
+void Mosaic::renderCanvas(int border_width, ColorAccuracy accuracy) { 
+    if (resized.empty()) {
+        std::cerr << "renderCanvas called but no resized image" << std::endl;
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("renderCanvas");
+    const std::vector<TileColor> colors = sampleTileColors(accuracy);
+    renderTiles(border_width, &colors);
+}
+
+
+std::vector<TileColor> Mosaic::sampleTileColors(ColorAccuracy accuracy) { 
+    if (resized.empty()) {
+        std::cerr << "sampleTileColors called but no resized image" << std::endl;
+        return {};
+    }
+
+    const bool tilted = accuracy == ColorAccuracy::NEAREST_ROTATION;
+    const uint64_t key = stage_keys[RESIZE];
+    if (key == 0 || key != color_sampler_key || color_sampler.empty() || (tilted && !color_sampler.hasTilted())) {
+        color_sampler.build(resized, tilted);
+        color_sampler_key = key;
+    }
+    return color_sampler.sample(tiles, accuracy, threads);
+}
+
+
+void Mosaic::renderTiles(int border_width, const std::vector<TileColor>* colors) { 
+    workspace.prepare("canvas", canvas, resized.size(), CV_8UC3);
+    canvas.setTo(cv::Scalar::all(0));
+
+    std::vector<Graphics::TileRecord> records(tiles.size());
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        records[i] = tileRecord(i, border_width, colors);
+    }
+    Graphics::drawTiles(canvas, records, threads);
+    MOSAIC_TRACE_MEMORY("canvas", matBytes(canvas));
+}
+
+
+// Tile i as renderCanvas draws it: outline in the mean color when colors is
+// given, otherwise in the color of the pixel at its center
+Graphics::TileRecord Mosaic::tileRecord(size_t i, int border_width, const std::vector<TileColor>* colors) const { 
+    const TilePlacement& tile = tiles[i];
+    Graphics::TileRecord record;
+    record.center = cv::Point2f(tile.center.x, tile.center.y);
+    record.size = static_cast<float>(tile.size);
+    record.angle_deg = static_cast<float>(tile.squareAngleDeg());
+    if (colors) {
+        const cv::Vec3f& mean = (*colors)[i].mean;
+        record.border_color = cv::Vec3b(cv::saturate_cast<uchar>(mean[0]), cv::saturate_cast<uchar>(mean[1]), cv::saturate_cast<uchar>(mean[2]));
+    }
+    else {
+        record.border_color = resized.at<cv::Vec3b>(tile.center.y, tile.center.x);
+    }
+    record.border_width = border_width;
+    return record;
+}
+
+
+bool Mosaic::exportTiles(const std::string& path, const VectorExportOptions& options, int border_width) { 
+    return exportTiles(path, options, border_width, nullptr);
+}
+
+
+bool Mosaic::exportTiles(const std::string& path, const VectorExportOptions& options, int border_width, ColorAccuracy accuracy) { 
+    if (resized.empty()) {
+        std::cerr << "exportTiles called but no resized image" << std::endl;
+        return false;
+    }
+    const std::vector<TileColor> colors = sampleTileColors(accuracy);
+    return exportTiles(path, options, border_width, &colors);
+}
+
+
+bool Mosaic::exportTiles(const std::string& path, const VectorExportOptions& options, int border_width,
+                         const std::vector<TileColor>* colors) { 
+    if (resized.empty()) {
+        std::cerr << "exportTiles called but no resized image" << std::endl;
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("exportTiles");
+    VectorExporter exporter;
+    if (!exporter.open(path, resized.size(), options)) {
+        return false;
+    }
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        exporter.add(tileRecord(i, border_width, colors));
+    }
+    return exporter.close();
+}
+
+
+
+
+
+std::vector<cv::Point> Mosaic::samplePoints(const SampleOptions& options, int top_k) const { 
+    if (segment_lengths.empty()) {
+        std::cerr << "samplePoints called but segment_lengths is empty." << std::endl;
+        return {};
+    }
+
+    const int count = top_k > 0 ? std::min<int>(top_k, segment_lengths.size()) : segment_lengths.size();
+    std::vector<int> ids(count);
+    for (int k = 0; k < count; ++k) {
+        ids[k] = segment_lengths[k].first;
+    }
+    return SegmentSampler(segments, ids).sample(options);
+}
+
+
+std::vector<cv::Point> Mosaic::samplePointsOnSegment(int k, const SampleOptions& options) const { 
+    if (k < 0 || k >= static_cast<int>(segment_lengths.size())) {
+        throw std::out_of_range("Segment index k is out of range");
     }
+    const int id = segment_lengths[k].first;
+    return SegmentSampler(segments, {id}).sampleSegment(id, options);
+}
 
-    // Random engine and distribution
-    static std::mt19937 rng(std::random_device{}());
-    std::uniform_int_distribution<> dist(0, static_cast<int>(points.size()) - 1);
 
-    // Pick a random index and return the point
-    return points[dist(rng)];
+bool Mosaic::saveSegments(const std::string& path) const { 
+    if (segment_lengths.empty() || segment_stats.size() != static_cast<size_t>(segments.size())) {
+        std::cerr << "saveSegments called but segments are not ranked." << std::endl;
+        return false;
+    }
+
+    std::vector<int> ranking;
+    ranking.reserve(segment_lengths.size());
+    for (const auto& entry : segment_lengths) {
+        ranking.push_back(entry.first);
+    }
+    return writeSegmentFile(path, segments, segment_stats, ranking);
 }
 
 
@@ -270,71 +850,48 @@ cv::Point Mosaic::getRandomPointOnSegment(int k) {
 PRINT FUNCTIONS >>
 */
 
-// Helper to print Vec3b as (B,G,R)
-std::string Mosaic::vec3bToString(const cv::Vec3b& color) {
-    return "(" + std::to_string(color[0]) + ", " + 
-                 std::to_string(color[1]) + ", " + 
-                 std::to_string(color[2]) + ")";
-}
-
 // Helper to print Point as (x,y)
 std::string Mosaic::pointToString(const cv::Point& pt) {
     return "(" + std::to_string(pt.x) + ", " + std::to_string(pt.y) + ")";
 }
 
-// Print color_to_pixels unordered_map
-void Mosaic::printColorToPixels() {
-    std::cout << "Color to Pixels Map:\n";
-    for (const auto& [color, points] : segment_pixels) {
-        std::cout << "  Color " << vec3bToString(color) << " -> [";
-        for (size_t i = 0; i < std::min(points.size(), size_t(5)); ++i) {
-            std::cout << pointToString(points[i]);
-            if (i != std::min(points.size(), size_t(5)) - 1) std::cout << ", ";
+// Print the first few points of segment ids [0, k)
+void Mosaic::printSegmentPixelsK(int k) {
+    std::cout << "Segment Pixels:\n";
+    for (int id = 0; id < std::min(k, segments.size()); ++id) {
+        size_t count = segments.segmentSize(id);
+        std::cout << "  Segment " << id << " -> [";
+        for (size_t i = 0; i < std::min(count, size_t(5)); ++i) {
+            std::cout << pointToString(segments.point(id, i));
+            if (i != std::min(count, size_t(5)) - 1) std::cout << ", ";
         }
-        if (points.size() > 5) std::cout << "...";
-        std::cout << "] (" << points.size() << " points)\n";
+        if (count > 5) std::cout << "...";
+        std::cout << "] (" << count << " points)\n";
     }
 }
 
 
-// Print color_lengths vector
-void Mosaic::printColorLengths() {
-    std::cout << "Color Lengths:\n";
-    for (const auto& [color, length] : segment_lengths) {
-        std::cout << "  Color " << vec3bToString(color) << " -> Length: " << length << "\n";
-    }
+void Mosaic::printSegmentPixels() {
+    printSegmentPixelsK(segments.size());
 }
 
 
-void Mosaic::printColorToPixelsK(int k) {
+// Print the k longest segments
+void Mosaic::printSegmentLengthsK(int k) {
     int count = 0;
-    std::cout << "Color to Pixels Map:\n";
-    for (const auto& [color, points] : segment_pixels) {
+    std::cout << "Segment Lengths:\n";
+    for (const auto& [id, length] : segment_lengths) {
         if (count >= k) { 
             break;
         }
-        std::cout << "  Color " << vec3bToString(color) << " -> [";
-        for (size_t i = 0; i < std::min(points.size(), size_t(5)); ++i) {
-            std::cout << pointToString(points[i]);
-            if (i != std::min(points.size(), size_t(5)) - 1) std::cout << ", ";
-        }
-        if (points.size() > 5) std::cout << "...";
-        std::cout << "] (" << points.size() << " points)\n";
+        std::cout << "  Segment " << id << " -> Length: " << length << "\n";
         count++;
     }
 }
 
 
-void Mosaic::printColorLengthsK(int k) {
-    int count = 0;
-    std::cout << "Color Lengths:\n";
-    for (const auto& [color, length] : segment_lengths) {
-        if (count >= k) { 
-            break;
-        }
-        std::cout << "  Color " << vec3bToString(color) << " -> Length: " << length << "\n";
-        count++;
-    }
+void Mosaic::printSegmentLengths() {
+    printSegmentLengthsK(static_cast<int>(segment_lengths.size()));
 }
 
 
@@ -349,7 +906,15 @@ void Mosaic::printColorLengthsK(int k) {
 
 void Mosaic::saveImage(const cv::Mat& image, const std::string& output_dir, const std::string& suffix) { 
 
-    if (image.empty()) { 
+    if (image.empty() || !debugStageEnabled(suffix)) { 
+        return;
+    }
+
+    std::string output_path = output_dir + "/" + image_name + "_" + suffix + ".jpg";
+
+    // Encoding happens on the writer's threads, off the critical path
+    if (image_writer) { 
+        image_writer->write(image, output_path);
         return;
     }
 
@@ -357,7 +922,6 @@ void Mosaic::saveImage(const cv::Mat& image, const std::string& output_dir, cons
         fs::create_directory(output_dir);
     }
 
-    std::string output_path = output_dir + "/" + image_name + "_" + suffix + ".jpg";
     if (cv::imwrite(output_path, image)) { 
         // cout << "Saved: " << output_path << endl;
     }
@@ -369,5 +933,143 @@ void Mosaic::saveImage(const cv::Mat& image, const std::string& output_dir, cons
 }
 
 
+void Mosaic::setDebugOutput(bool enabled) { 
+    debug_output = enabled;
+}
+
+
+void Mosaic::setDebugStage(const std::string& suffix, bool enabled) { 
+    debug_stages[suffix] = enabled;
+}
+
+
+bool Mosaic::debugStageEnabled(const std::string& suffix) const { 
+    auto it = debug_stages.find(suffix);
+    return it != debug_stages.end() ? it->second : debug_output;
+}
+
+
+void Mosaic::setStageCaching(bool enabled) { 
+    stage_caching = enabled;
+    if (!enabled) {
+        invalidateStages();
+    }
+}
+
+
+void Mosaic::invalidateStages() { 
+    stage_keys.fill(0);
+    image_generation++;
+}
+
+
+// The source is identified by a generation that resetImage and invalidateStages
+// bump. A buffer assigned to original behind our back bumps it too: keyed_original
+// holds the one the generation was taken for, so its address can't come back
+// for a different image while we still compare against it.
+uint64_t Mosaic::sourceKey() { 
+    if (original.data != keyed_original.data || original.size() != keyed_original.size()
+        || original.type() != keyed_original.type()) {
+        image_generation++;
+        keyed_original = original;
+    }
+    return stageFingerprint(image_generation, {double(original.cols), double(original.rows), double(original.type())});
+}
+
+
+bool Mosaic::stageCurrent(Stage stage, uint64_t key) { 
+    if (!stage_caching || key == 0 || stage_keys[stage] != key) {
+        return false;
+    }
+    stage_cache_hits++;
+    MOSAIC_TRACE_COUNTER("stage_cache_hits", stage_cache_hits);
+    return true;
+}
+
+
+// A recomputed stage makes everything below it stale, even if a later call
+// would arrive at the same fingerprint again. ORIENT only reads up to CANNY,
+// so contours and rank leave it alone.
+void Mosaic::markStage(Stage stage, uint64_t key) { 
+    for (int s = stage + 1; s <= RANK; ++s) {
+        stage_keys[s] = 0;
+    }
+    if (stage <= CANNY) {
+        stage_keys[ORIENT] = 0;
+    }
+    stage_keys[stage] = stage_caching ? key : 0;
+    if (stage >= CANNY && stage <= RANK) {
+        disk_stages_key = 0;
+    }
+}
+
+
+uint64_t Mosaic::diskKey(uint64_t params_key) { 
+    if (!disk_cache || file_path.empty() || resized.empty()) {
+        return 0;
+    }
+    const uint64_t file_hash = disk_cache->fileHash(file_path);
+    if (file_hash == 0) {
+        return 0;
+    }
+    // a reduced decode resizes differently from resizeOriginal, so it gets its own entries
+    const uint64_t key = hashValues(hashBytes(&params_key, sizeof(params_key), file_hash),
+                                    {double(MOSAIC_CACHE_VERSION), double(original.empty()), double(resized.cols), double(resized.rows)});
+    return key | 1;
+}
+
+
+bool Mosaic::loadStages(uint64_t params_key) { 
+    const uint64_t key = diskKey(params_key);
+    if (key == 0) {
+        return false;
+    }
+    if (key == disk_stages_key) {
+        return true;
+    }
+
+    // Loaded aside, so an entry of another size leaves the current stages as they were
+    cv::Mat loaded_edges;
+    SegmentStore loaded_segments;
+    std::vector<SegmentStats> loaded_stats;
+    std::vector<std::pair<int, double>> loaded_lengths;
+    if (!disk_cache->load(key, loaded_edges, loaded_segments, loaded_stats, loaded_lengths, threads)
+        || loaded_edges.size() != resized.size()) {
+        return false;
+    }
+    segments = std::move(loaded_segments);
+    segment_stats.swap(loaded_stats);
+    segment_lengths.swap(loaded_lengths);
+
+    // The in-memory chain never produced these, so nothing above placement may hit on them
+    workspace.park("grayscale", grayscale);
+    workspace.park("blurred", blurred);
+    workspace.park("edges", edges);
+    edges = loaded_edges;
+    labels.release();
+    orientation.clear();
+    markStage(GRAY, 0);
+    disk_stages_key = key;
+    MOSAIC_TRACE_MEMORY("edges", matBytes(edges));
+    return true;
+}
+
+
+bool Mosaic::saveStages(uint64_t params_key) { 
+    const uint64_t key = diskKey(params_key);
+    if (key == 0 || segment_lengths.empty()) {
+        return false;
+    }
+    if (key == disk_stages_key) {
+        return true;
+    }
+    if (!disk_cache->store(key, edges, segments, segment_stats, segment_lengths)) {
+        return false;
+    }
+    disk_stages_key = key;
+    return true;
+}
+
+
 
 }
\ No newline at end of file
@@ -1,9 +1,25 @@
 #ifndef MOSAIC_BUILDER_HPP
 #define MOSAIC_BUILDER_HPP
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <opencv2/core.hpp>
+#include "segment_store.hpp"
+#include "tile_placer.hpp"
+#include "image_writer.hpp"
+#include "image_loader.hpp"
+#include "workspace.hpp"
+#include "point_sampler.hpp"
+#include "poisson_seeds.hpp"
+#include "tile_color.hpp"
+#include "vector_export.hpp"
+#include "orientation_field.hpp"
+#include "stage_cache.hpp"
 
 using namespace std;
 
@@ -13,8 +29,32 @@ class Mosaic {
 
     public: 
 
-        // param constructor
-        Mosaic(const string& image_path);
+        // param constructor, threads <= 0 uses every core
+        Mosaic(const string& image_path, int threads = 1);
+
+        // With keep_original = false the file is decoded straight at options.resize_factor
+        // into resized, original stays empty and resizeOriginal(resize_factor) is a no-op;
+        // another factor decodes the file again
+        Mosaic(const string& image_path, const LoadOptions& options, int threads = 1);
+        Mosaic(const LoadedImage& loaded, const string& image_path, int threads = 1);
+
+        // no image yet, call resetImage before running stages
+        explicit Mosaic(int threads = 1);
+
+        // Start over on another image. Stage buffers are kept and reused when the
+        // next image needs the same sizes, so one Mosaic can run a whole batch.
+        void resetImage(const cv::Mat& image, const string& image_path);
+        void resetImage(const LoadedImage& loaded, const string& image_path);
+
+        // Start over on stage outputs built elsewhere (runStreamingPipeline):
+        // resized at resize_factor of a source_size file, its edges and segments.
+        // resizeOriginal(resize_factor) is then a no-op and rankSegments can follow.
+        void adoptStages(const string& image_path, cv::Size source_size, double resize_factor,
+                         const cv::Mat& resized, const cv::Mat& edges, SegmentStore&& segments);
+        const WorkspaceStats& workspaceStats() const { return workspace.stats(); }
+
+        // already decoded image, image_path only names the outputs
+        Mosaic(const cv::Mat& image, const string& image_path, int threads = 1);
 
         
 
@@ -25,58 +65,182 @@ class Mosaic {
         void grayImage();
         void blurImage(int kernel_size, double sigma);
         void cannyFilter(int threshold_1, int threshold_2);
-        int detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window);
+        int detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window, bool build_labels = false);
+        // Only trace the edges under region (CV_8U, edges size) and put the
+        // segments after a copy of kept, for frames where only part of the picture
+        // changed. Never a stage cache hit.
+        int detectContours(double max_segment_angle_rad, int min_segment_length, int segment_angle_window,
+                           const cv::Mat& region, const SegmentStore& kept);
+        void paintSegments();
         void rankSegments();
         void selectSegment(int k);
+
+        // Draws are numbered per Mosaic and each one is mixed with the seed, so a
+        // seed gives the same sequence of points on every run (resetImage
+        // restarts it). Calls from several threads get distinct draws, though
+        // which thread gets which then depends on timing.
         cv::Point getRandomPointOnSegment(int k);
+        void setSeed(uint64_t seed);
+        uint64_t seed() const { return random_seed; }
+
+        // options.count points weighted by arc length over the top_k longest
+        // segments (all when top_k <= 0), or along the k-th longest one
+        std::vector<cv::Point> samplePoints(const SampleOptions& options, int top_k = 0) const;
+        std::vector<cv::Point> samplePointsOnSegment(int k, const SampleOptions& options) const;
+        // Direction / coherence / edge distance field from blurred and edges
+        void buildOrientationField(const OrientationOptions& options = OrientationOptions());
+
+        // When enabled and the orientation field is built, placeTiles reads each
+        // tile's angle from it and only searches refine_deg around that angle
+        // (refine_deg = 0 scores just the looked up angle)
+        void setAngleLookup(bool enabled, int refine_deg = 0);
+
+        int placeTiles(int tile_size, int max_segments, double min_gap, int theta_step, double decay_rate);
+
+        // Keep the tiles in keep and only seed new ones where seed_region (CV_8U) is
+        // set; max_segments then counts segments that reach into the region
+        int placeTiles(int tile_size, int max_segments, double min_gap, int theta_step, double decay_rate,
+                       const std::vector<TilePlacement>& keep, const cv::Mat& seed_region);
+
+        // Tile size read per seed from tile_sizes (CV_8UC1, same size as edges)
+        int placeTiles(const cv::Mat& tile_sizes, int max_segments, double min_gap, int theta_step, double decay_rate);
+
+        // Add axis-aligned tiles on Poisson-disk seeds in the space placeTiles left
+        // free, sized from the local spacing. Returns the number of tiles added.
+        int fillBackground(const PoissonOptions& options, double min_gap = 0.0);
+        void renderCanvas(int border_width);
+
+        // Same, but each tile takes the mean color of the photo under it
+        void renderCanvas(int border_width, ColorAccuracy accuracy);
+
+        // Mean / variance of resized under every placed tile. The summed-area
+        // tables behind it are kept until resized changes; NEAREST_ROTATION
+        // also builds the tilted ones.
+        std::vector<TileColor> sampleTileColors(ColorAccuracy accuracy);
+
+        // Write the placed tiles as SVG / PDF in canvas coordinates, colored like
+        // the matching renderCanvas call, without rasterizing them
+        bool exportTiles(const std::string& path, const VectorExportOptions& options, int border_width);
+        bool exportTiles(const std::string& path, const VectorExportOptions& options, int border_width, ColorAccuracy accuracy);
 
         
-        void printColorToPixels();
-        void printColorLengths();
-        void printColorToPixelsK(int k);
-        void printColorLengthsK(int k);
+        void printSegmentPixels();
+        void printSegmentLengths();
+        void printSegmentPixelsK(int k);
+        void printSegmentLengthsK(int k);
+
+        // Segments with their stats and ranking as a segment file (segment_file.hpp),
+        // readable in place by SegmentFileView. Needs rankSegments.
+        bool saveSegments(const std::string& path) const;
         
         void saveImage(const cv::Mat& image, const std::string& output_dir, const std::string& suffix);
 
-
-        cv::Mat original;
+        // Debug dumps per saveImage suffix ("resized", "gray", ...). Stages without
+        // an explicit switch follow setDebugOutput, so setDebugOutput(false) turns them all off.
+        void setDebugOutput(bool enabled);
+        void setDebugStage(const std::string& suffix, bool enabled);
+        bool debugStageEnabled(const std::string& suffix) const;
+
+        // resize -> gray -> blur -> canny -> contours -> rank remember a fingerprint of
+        // their parameters and inputs and return early when nothing upstream changed.
+        // Call invalidateStages() after editing one of the stage images by hand,
+        // original included (e.g. a capture that decodes into the same buffer).
+        void setStageCaching(bool enabled);
+        void invalidateStages();
+        size_t stageCacheHits() const { return stage_cache_hits; }
+
+        // Keep edges, segments and rankings on disk across runs. params_key
+        // fingerprints every parameter from resize to rankSegments; it is combined
+        // with the file's content hash, MOSAIC_CACHE_VERSION and the working size.
+        // Call loadStages after resizeOriginal: a hit fills edges through
+        // rankSegments (grayscale / blurred stay empty) so placement can follow.
+        void setDiskCache(std::shared_ptr<StageDiskCache> cache) { disk_cache = std::move(cache); }
+        bool loadStages(uint64_t params_key);
+        bool saveStages(uint64_t params_key);
+
+
+        cv::Mat original;     // empty when loaded without keep_original
+        cv::Size source_size; // full-resolution size of the input
         cv::Mat resized;
         cv::Mat grayscale;
         cv::Mat blurred;
         cv::Mat edges;
-        cv::Mat segmented;
+        cv::Mat segmented;   // debug colors, filled by paintSegments()
+        cv::Mat labels;      // CV_32S segment id + 1, filled when detectContours builds labels
+        OrientationField orientation;   // filled by buildOrientationField
+
+        SegmentStore segments;
+        std::vector<SegmentStats> segment_stats;   // indexed by segment id, filled by rankSegments
 
         cv::Mat selected_segment;
         cv::Mat canvas;
+        std::vector<TilePlacement> tiles;   // filled by placeTiles
 
         cv::Mat mask;
         std::string file_path;
         std::string image_name;
 
+        int threads;
 
-    private: 
+        // when set, saveImage queues images here instead of writing them inline
+        std::shared_ptr<ImageWriter> image_writer;
 
-        struct Vec3bHash {
-            std::size_t operator()(const cv::Vec3b& color) const noexcept {
-                return std::hash<int>()(
-                    (static_cast<int>(color[0]) << 16) |
-                    (static_cast<int>(color[1]) << 8) |
-                    (static_cast<int>(color[2]))
-                );
-            }
-        };
-        
-        struct Vec3bEqual {
-            bool operator()(const cv::Vec3b& a, const cv::Vec3b& b) const noexcept {
-                return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
-            }
-        };
 
-        std::string vec3bToString(const cv::Vec3b& color);
+    private: 
+
         std::string pointToString(const cv::Point& pt);
 
-        std::unordered_map<cv::Vec3b, std::vector<cv::Point>, Vec3bHash, Vec3bEqual> segment_pixels;
-        std::vector<std::pair<cv::Vec3b, double>> segment_lengths;
+        // (segment id, length) sorted by descending length
+        std::vector<std::pair<int, double>> segment_lengths;
+
+        bool debug_output = true;
+        std::unordered_map<std::string, bool> debug_stages;
+
+        // RESIZE .. RANK is a chain, ORIENT branches off CANNY
+        enum Stage { RESIZE, GRAY, BLUR, CANNY, CONTOURS, RANK, ORIENT, STAGE_COUNT };
+
+        void clearImageState();
+        uint64_t sourceKey();
+        void redecodeResized(double resize_factor);
+        void traceSegments(double max_segment_angle_rad, int min_segment_length, int segment_angle_window, bool build_labels,
+                           const cv::Mat& region, const SegmentStore* kept);
+        bool stageCurrent(Stage stage, uint64_t key);
+        void markStage(Stage stage, uint64_t key);
+
+        // fingerprint each stage output was built from, 0 when missing or stale
+        std::array<uint64_t, STAGE_COUNT> stage_keys{};
+        bool stage_caching = true;
+        size_t stage_cache_hits = 0;
+
+        // bumped on every image change, identifies the source in the resize fingerprint
+        uint64_t image_generation = 0;
+        cv::Mat keyed_original;   // original as of the current generation
+
+        // scale resized was made at, kept apart from stage_keys so invalidateStages
+        // or setStageCaching(false) don't lose it when there is no original; 0 = none
+        double resized_factor = 0.0;
+
+        MosaicWorkspace workspace;
+
+        int placeTiles(int tile_size, const cv::Mat& tile_sizes, int max_segments, double min_gap, int theta_step, double decay_rate,
+                       const std::vector<TilePlacement>& keep, const cv::Mat& seed_region);
+        void renderTiles(int border_width, const std::vector<TileColor>* colors);
+        Graphics::TileRecord tileRecord(size_t i, int border_width, const std::vector<TileColor>* colors) const;
+        bool exportTiles(const std::string& path, const VectorExportOptions& options, int border_width,
+                         const std::vector<TileColor>* colors);
+
+        TileColorSampler color_sampler;
+        uint64_t color_sampler_key = 0;   // stage_keys[RESIZE] the tables were built from
+
+        bool angle_lookup = false;
+        int angle_refine_deg = 0;
+
+        uint64_t random_seed = 0;
+        std::atomic<uint64_t> random_draws{0};
+
+        std::shared_ptr<StageDiskCache> disk_cache;
+        uint64_t diskKey(uint64_t params_key);
+        uint64_t disk_stages_key = 0;   // disk key edges through rankSegments were loaded / saved under
 
 };
 
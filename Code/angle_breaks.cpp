@@ -0,0 +1,134 @@
+#include "angle_breaks.hpp"
+#include <cfloat>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MOSAIC_HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+namespace mosaic_gen {
+
+namespace {
+
+inline bool isBreak(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, float cos2_threshold) {
+    const float v1x = static_cast<float>(x1 - x0);
+    const float v1y = static_cast<float>(y1 - y0);
+    const float v2x = static_cast<float>(x2 - x1);
+    const float v2y = static_cast<float>(y2 - y1);
+
+    const float dot = v1x * v2x + v1y * v2y;
+    const float norms = (v1x * v1x + v1y * v1y) * (v2x * v2x + v2y * v2y);
+
+    return dot * dot < cos2_threshold * norms || norms == 0.0f;
+}
+
+void scanRange(const int32_t* xs, const int32_t* ys, int from, int to, int w, float cos2_threshold, std::vector<int>& breaks) {
+    for (int i = from; i < to; ++i) {
+        if (isBreak(xs[i - w], ys[i - w], xs[i], ys[i], xs[i + w], ys[i + w], cos2_threshold)) {
+            breaks.push_back(i);
+        }
+    }
+}
+
+}
+
+
+float angleBreakCos2(double max_angle_rad) {
+    if (max_angle_rad >= M_PI / 2.0) {
+        return -1.0f;
+    }
+    if (max_angle_rad < 0.0) {
+        // every turn is larger than a negative angle
+        return FLT_MAX;
+    }
+
+    const double c = std::cos(max_angle_rad);
+    return static_cast<float>(c * c);
+}
+
+
+void findAngleBreaksScalar(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks) {
+    if (cos2_threshold < 0.0f) {
+        return;
+    }
+    scanRange(xs, ys, window, len - window, window, cos2_threshold, breaks);
+}
+
+
+#ifdef MOSAIC_HAVE_AVX2_KERNEL
+
+bool angleBreaksHaveAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+
+__attribute__((target("avx2")))
+void findAngleBreaksAvx2(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks) {
+    if (cos2_threshold < 0.0f) {
+        return;
+    }
+
+    const int w = window;
+    const int end = len - w;
+    const __m256 threshold = _mm256_set1_ps(cos2_threshold);
+    const __m256 zero = _mm256_setzero_ps();
+
+    int i = w;
+    for (; i + 8 <= end; i += 8) {
+        const __m256i x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i - w));
+        const __m256i y0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i - w));
+        const __m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i));
+        const __m256i y1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i));
+        const __m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i + w));
+        const __m256i y2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i + w));
+
+        const __m256 v1x = _mm256_cvtepi32_ps(_mm256_sub_epi32(x1, x0));
+        const __m256 v1y = _mm256_cvtepi32_ps(_mm256_sub_epi32(y1, y0));
+        const __m256 v2x = _mm256_cvtepi32_ps(_mm256_sub_epi32(x2, x1));
+        const __m256 v2y = _mm256_cvtepi32_ps(_mm256_sub_epi32(y2, y1));
+
+        // no FMA, so every lane rounds exactly like isBreak
+        const __m256 dot = _mm256_add_ps(_mm256_mul_ps(v1x, v2x), _mm256_mul_ps(v1y, v2y));
+        const __m256 n1 = _mm256_add_ps(_mm256_mul_ps(v1x, v1x), _mm256_mul_ps(v1y, v1y));
+        const __m256 n2 = _mm256_add_ps(_mm256_mul_ps(v2x, v2x), _mm256_mul_ps(v2y, v2y));
+        const __m256 norms = _mm256_mul_ps(n1, n2);
+
+        const __m256 turned = _mm256_cmp_ps(_mm256_mul_ps(dot, dot), _mm256_mul_ps(threshold, norms), _CMP_LT_OQ);
+        const __m256 degenerate = _mm256_cmp_ps(norms, zero, _CMP_EQ_OQ);
+
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_or_ps(turned, degenerate)));
+        while (mask) {
+            breaks.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    scanRange(xs, ys, i, end, w, cos2_threshold, breaks);
+}
+
+#else
+
+bool angleBreaksHaveAvx2() {
+    return false;
+}
+
+
+void findAngleBreaksAvx2(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks) {
+    findAngleBreaksScalar(xs, ys, len, window, cos2_threshold, breaks);
+}
+
+#endif
+
+
+void findAngleBreaks(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks) {
+    if (angleBreaksHaveAvx2()) {
+        findAngleBreaksAvx2(xs, ys, len, window, cos2_threshold, breaks);
+    }
+    else {
+        findAngleBreaksScalar(xs, ys, len, window, cos2_threshold, breaks);
+    }
+}
+
+}
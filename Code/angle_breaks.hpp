@@ -0,0 +1,30 @@
+#ifndef ANGLE_BREAKS_HPP
+#define ANGLE_BREAKS_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace mosaic_gen {
+
+// A contour breaks at i when the turn between (p[i] - p[i - w]) and
+// (p[i + w] - p[i]) exceeds the max angle. With theta = acos(|cos|) that is
+// |cos| < cos(max_angle), compared here without roots or transcendentals as
+//     dot^2 < cos^2(max_angle) * |v1|^2 * |v2|^2
+// A zero-length window counts as a break, same as the old acos loop.
+
+// Squared cosine threshold for findAngleBreaks. Negative when max_angle_rad >= pi/2,
+// where no turn can exceed it.
+float angleBreakCos2(double max_angle_rad);
+
+// Append every break index in [window, len - window) to breaks, in increasing order.
+// xs/ys hold the contour as structure-of-arrays coordinates.
+void findAngleBreaks(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks);
+
+// Fixed implementations, exposed for benchmarking
+void findAngleBreaksScalar(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks);
+bool angleBreaksHaveAvx2();
+void findAngleBreaksAvx2(const int32_t* xs, const int32_t* ys, int len, int window, float cos2_threshold, std::vector<int>& breaks);
+
+}
+
+#endif
@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "batch_runner.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using mosaic_gen::BatchOptions;
+using mosaic_gen::BatchReport;
+using mosaic_gen::MosaicParams;
+using mosaic_gen::Tracer;
+
+
+void printUsage() {
+    cerr << "usage: mosaic_batch <image_dir | manifest> [output_dir]\n"
+         << "         [--decode N] [--process N] [--encode N] [--threads N] [--queue N] [--csv report.csv]\n"
+         << "         [--trace trace.json] [--full-decode] [--vector svg|pdf] [--compress]\n"
+         << "         [--pyramid LEVELS] [--cache DIR] [--stream BUDGET_MB]" << endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    string input = argv[1];
+    string csv_path;
+    string trace_path;
+    BatchOptions options;
+    MosaicParams params;
+
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--decode" && has_value) options.decode_workers = atoi(argv[++i]);
+        else if (arg == "--process" && has_value) options.process_workers = atoi(argv[++i]);
+        else if (arg == "--encode" && has_value) options.encode_workers = atoi(argv[++i]);
+        else if (arg == "--threads" && has_value) options.threads_per_image = atoi(argv[++i]);
+        else if (arg == "--queue" && has_value) options.queue_capacity = atoi(argv[++i]);
+        else if (arg == "--csv" && has_value) csv_path = argv[++i];
+        else if (arg == "--trace" && has_value) trace_path = argv[++i];
+        else if (arg == "--full-decode") options.reduced_decode = false;
+        else if (arg == "--vector" && has_value) {
+            const string format = argv[++i];
+            if (format != "svg" && format != "pdf") {
+                printUsage();
+                return 1;
+            }
+            options.export_vector = true;
+            options.vector.format = format == "pdf" ? mosaic_gen::VectorFormat::PDF : mosaic_gen::VectorFormat::SVG;
+        }
+        else if (arg == "--compress") options.vector.compress = true;
+        else if (arg == "--pyramid" && has_value) {
+            options.use_pyramid = true;
+            options.pyramid.levels = atoi(argv[++i]);
+        }
+        else if (arg == "--cache" && has_value) options.cache_dir = argv[++i];
+        else if (arg == "--stream" && has_value) {
+            options.use_streaming = true;
+            options.streaming.memory_budget_bytes = static_cast<size_t>(atoi(argv[++i])) << 20;
+        }
+        else if (arg.rfind("--", 0) != 0) options.output_dir = arg;
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    vector<string> inputs = mosaic_gen::collectBatchInputs(input);
+    if (inputs.empty()) {
+        cerr << "No images found in: " << input << endl;
+        return 1;
+    }
+
+    cout << "Processing " << inputs.size() << " images -> " << options.output_dir
+         << " (decode " << options.decode_workers << ", process " << options.process_workers
+         << ", encode " << options.encode_workers << ")" << endl;
+
+    if (!trace_path.empty()) {
+        Tracer::instance().enable();
+    }
+
+    BatchReport report = mosaic_gen::runBatch(inputs, params, options);
+    report.printSummary(cout);
+
+    if (!trace_path.empty()) {
+        Tracer::instance().printSummary(cout);
+        Tracer::instance().writeChromeTrace(trace_path);
+    }
+
+    if (!csv_path.empty()) {
+        ofstream csv(csv_path);
+        report.writeCsv(csv);
+    }
+
+    return report.succeeded() == inputs.size() ? 0 : 2;
+}
@@ -0,0 +1,334 @@
+#include "batch_runner.hpp"
+#include "bounded_queue.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+using namespace std;
+namespace fs = std::__fs::filesystem;
+
+namespace mosaic_gen {
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct BatchJob {
+    size_t index = 0;
+    LoadedImage loaded;   // decode -> process
+    cv::Mat image;        // process -> encode
+};
+
+// Start count workers; the last one to finish runs on_done (closes the next queue)
+template <typename Fn, typename Done>
+void startStage(vector<thread>& pool, int count, Fn worker, Done on_done) {
+    count = max(1, count);
+    auto remaining = make_shared<atomic<int>>(count);
+    for (int i = 0; i < count; ++i) {
+        pool.emplace_back([=]() {
+            worker();
+            if (--(*remaining) == 0) {
+                on_done();
+            }
+        });
+    }
+}
+
+// Run one image's work in a stage; an exception (bad file, failed write) fails
+// that image instead of taking the whole batch and its report down
+template <typename Fn>
+bool runGuarded(BatchImageResult& result, Fn work) {
+    try {
+        work();
+        return true;
+    }
+    catch (const exception& e) {
+        result.ok = false;
+        result.error = e.what();
+        cerr << "Batch: " << result.input_path << ": " << e.what() << endl;
+        return false;
+    }
+}
+
+// Quote a CSV field holding a separator, quote or line break, doubling embedded quotes
+string csvField(const string& text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) {
+        return text;
+    }
+    string quoted = "\"";
+    for (char c : text) {
+        quoted += c;
+        if (c == '"') quoted += '"';
+    }
+    return quoted + "\"";
+}
+
+bool isImageFile(const fs::path& path) {
+    string ext = path.extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return tolower(c); });
+    return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" ||
+           ext == ".tif" || ext == ".tiff" || ext == ".webp";
+}
+
+}
+
+
+vector<string> collectBatchInputs(const string& directory_or_manifest) {
+    vector<string> inputs;
+
+    error_code error;
+    if (fs::is_directory(directory_or_manifest, error)) {
+        for (fs::directory_iterator it(directory_or_manifest, error), end; !error && it != end; it.increment(error)) {
+            if (it->is_regular_file(error) && isImageFile(it->path())) {
+                inputs.push_back(it->path().string());
+            }
+        }
+        if (error) {
+            cerr << "Batch: could not list " << directory_or_manifest << ": " << error.message() << endl;
+        }
+        sort(inputs.begin(), inputs.end());
+        return inputs;
+    }
+
+    ifstream manifest(directory_or_manifest);
+    if (!manifest) {
+        cerr << "Batch input is neither a directory nor a readable manifest: " << directory_or_manifest << endl;
+        return inputs;
+    }
+
+    // relative manifest entries are resolved against the manifest's folder
+    const fs::path base = fs::path(directory_or_manifest).parent_path();
+    string line;
+    while (getline(manifest, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        fs::path path(line);
+        inputs.push_back(path.is_absolute() ? path.string() : (base / path).string());
+    }
+    return inputs;
+}
+
+
+BatchReport runBatch(const vector<string>& inputs, const MosaicParams& params, const BatchOptions& options) {
+    BatchReport report;
+    report.images.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        report.images[i].input_path = inputs[i];
+    }
+
+    error_code error;
+    fs::create_directories(options.output_dir, error);
+    if (error) {
+        // every encode will fail and say so, the report still comes back
+        cerr << "Batch: could not create " << options.output_dir << ": " << error.message() << endl;
+    }
+
+    // the .svgz name is only used when the file really gets compressed
+    VectorExportOptions vector_options = options.vector;
+    if (options.export_vector && vector_options.compress && !VectorExporter::compressionAvailable()) {
+        cerr << "Batch: built without zlib, vector files are written uncompressed" << endl;
+        vector_options.compress = false;
+    }
+
+    BoundedQueue<BatchJob> decoded(options.queue_capacity);
+    BoundedQueue<BatchJob> processed(options.queue_capacity);
+    atomic<size_t> next_input{0};
+
+    const auto batch_start = Clock::now();
+    vector<thread> pool;
+
+    // Decode
+    startStage(pool, options.decode_workers, [&]() {
+        for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+            BatchImageResult& result = report.images[i];
+            auto start = Clock::now();
+
+            BatchJob job;
+            job.index = i;
+            if (options.use_streaming) {
+                decoded.push(std::move(job));
+                continue;
+            }
+            const bool loaded = runGuarded(result, [&]() {
+                job.loaded = loadImage(inputs[i], options.reduced_decode ? params.resize_factor : 1.0);
+            });
+            result.decode_seconds = secondsSince(start);
+
+            if (!loaded) {
+                continue;
+            }
+            if (job.loaded.empty()) {
+                result.error = "could not load image";
+                cerr << "Batch: could not load image from path: " << inputs[i] << endl;
+                continue;
+            }
+            result.width = job.loaded.source_size.width;
+            result.height = job.loaded.source_size.height;
+
+            decoded.push(std::move(job));
+        }
+    }, [&]() { decoded.close(); });
+
+    // Process
+    // One Mosaic per worker, so same-sized images reuse its stage buffers
+    atomic<size_t> buffers_reused{0};
+    atomic<size_t> buffers_allocated{0};
+    // shared, so workers also hit on entries the others wrote during this batch
+    shared_ptr<StageDiskCache> disk_cache = options.cache_dir.empty() ? nullptr : make_shared<StageDiskCache>(options.cache_dir);
+    startStage(pool, options.process_workers, [&]() {
+        Mosaic mosaic(options.threads_per_image);
+        mosaic.setDiskCache(disk_cache);
+        BatchJob job;
+        while (decoded.pop(job)) {
+            BatchImageResult& result = report.images[job.index];
+            auto start = Clock::now();
+
+            bool produced = false;
+            const bool finished = runGuarded(result, [&]() {
+                if (options.use_streaming) {
+                    result.tiles = runStreamingPipeline(mosaic, inputs[job.index], params, options.streaming);
+                    result.width = mosaic.source_size.width;
+                    result.height = mosaic.source_size.height;
+                }
+                else {
+                    mosaic.resetImage(job.loaded, inputs[job.index]);
+                    job.loaded = LoadedImage();
+                    result.tiles = options.use_pyramid ? runPyramidPipeline(mosaic, params, options.pyramid) : runPipeline(mosaic, params);
+                }
+                result.segments = mosaic.segments.size();
+
+                if (result.tiles < 0 || mosaic.canvas.empty()) {
+                    result.error = "no mosaic produced";
+                    cerr << "Batch: no mosaic produced for: " << inputs[job.index] << endl;
+                    return;
+                }
+                produced = true;
+
+                if (options.export_vector) {
+                    const string stem = fs::path(inputs[job.index]).stem().string();
+                    const char* extension = options.vector.format == VectorFormat::PDF ? ".pdf" : (vector_options.compress ? ".svgz" : ".svg");
+                    const string vector_path = (fs::path(options.output_dir) / (stem + "_mosaic" + extension)).string();
+                    const bool exported = params.tile_mean_color
+                        ? mosaic.exportTiles(vector_path, vector_options, params.tile_border_width, params.tile_color_accuracy)
+                        : mosaic.exportTiles(vector_path, vector_options, params.tile_border_width);
+                    if (!exported) {
+                        cerr << "Batch: failed to export: " << vector_path << endl;
+                    }
+                }
+            });
+            result.process_seconds = secondsSince(start);
+
+            if (!finished) {
+                // a throw can leave stage images half written
+                mosaic.invalidateStages();
+                continue;
+            }
+            if (!produced) {
+                continue;
+            }
+
+            // the canvas stays shared until encoded, so the next image gets a fresh one
+            job.image = mosaic.canvas;
+            processed.push(std::move(job));
+        }
+        buffers_reused += mosaic.workspaceStats().reused;
+        buffers_allocated += mosaic.workspaceStats().allocated;
+    }, [&]() { processed.close(); });
+
+    // Encode
+    startStage(pool, options.encode_workers, [&]() {
+        BatchJob job;
+        while (processed.pop(job)) {
+            BatchImageResult& result = report.images[job.index];
+            auto start = Clock::now();
+
+            const string stem = fs::path(inputs[job.index]).stem().string();
+            result.output_path = (fs::path(options.output_dir) / (stem + "_mosaic.jpg")).string();
+            runGuarded(result, [&]() {
+                result.ok = cv::imwrite(result.output_path, job.image);
+                if (!result.ok) {
+                    result.error = "could not write output";
+                    cerr << "Batch: failed to save: " << result.output_path << endl;
+                }
+            });
+            result.encode_seconds = secondsSince(start);
+            job.image.release();
+        }
+    }, []() {});
+
+    for (auto& worker : pool) {
+        worker.join();
+    }
+
+    report.wall_seconds = secondsSince(batch_start);
+    report.buffers_reused = buffers_reused;
+    report.buffers_allocated = buffers_allocated;
+    report.disk_cache_hits = disk_cache ? disk_cache->hits() : 0;
+    return report;
+}
+
+
+size_t BatchReport::succeeded() const {
+    return count_if(images.begin(), images.end(), [](const BatchImageResult& r) { return r.ok; });
+}
+
+
+double BatchReport::imagesPerSecond() const {
+    return wall_seconds > 0.0 ? succeeded() / wall_seconds : 0.0;
+}
+
+
+double BatchReport::megapixelsPerSecond() const {
+    double megapixels = 0.0;
+    for (const auto& image : images) {
+        if (image.ok) megapixels += image.megapixels();
+    }
+    return wall_seconds > 0.0 ? megapixels / wall_seconds : 0.0;
+}
+
+
+void BatchReport::printSummary(ostream& out) const {
+    out << fixed << setprecision(3);
+    for (const auto& image : images) {
+        out << "  " << fs::path(image.input_path).filename().string()
+            << (image.ok ? "" : " [failed" + (image.error.empty() ? string() : ": " + image.error) + "]")
+            << "  " << image.megapixels() << " MP"
+            << "  decode " << image.decode_seconds << "s"
+            << "  process " << image.process_seconds << "s"
+            << "  encode " << image.encode_seconds << "s"
+            << "  segments " << image.segments
+            << "  tiles " << image.tiles << "\n";
+    }
+    out << "Batch: " << succeeded() << "/" << images.size() << " images in " << wall_seconds << "s, "
+        << imagesPerSecond() << " images/s, " << megapixelsPerSecond() << " MP/s, "
+        << buffers_reused << " stage buffers reused / " << buffers_allocated << " allocated, "
+        << disk_cache_hits << " disk cache hits" << endl;
+    out.unsetf(ios::floatfield);
+}
+
+
+void BatchReport::writeCsv(ostream& out) const {
+    out << "input,output,ok,width,height,megapixels,decode_s,process_s,encode_s,segments,tiles,error\n";
+    for (const auto& image : images) {
+        out << csvField(image.input_path) << "," << csvField(image.output_path) << "," << image.ok << ","
+            << image.width << "," << image.height << "," << image.megapixels() << ","
+            << image.decode_seconds << "," << image.process_seconds << "," << image.encode_seconds << ","
+            << image.segments << "," << image.tiles << "," << csvField(image.error) << "\n";
+    }
+}
+
+}
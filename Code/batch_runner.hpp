@@ -0,0 +1,74 @@
+#ifndef BATCH_RUNNER_HPP
+#define BATCH_RUNNER_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "pipeline.hpp"
+#include "strip_processor.hpp"
+
+namespace mosaic_gen {
+
+struct BatchOptions {
+    std::string output_dir = "../Results";
+    int decode_workers = 2;
+    int process_workers = 2;
+    int encode_workers = 1;
+    int threads_per_image = 1;     // Mosaic threads inside each process worker
+    std::size_t queue_capacity = 4; // images waiting between two stages
+    bool reduced_decode = true;     // decode JPEGs at the pipeline's resize factor, dropping the original
+    bool use_pyramid = false;       // runPyramidPipeline instead of runPipeline
+    PyramidParams pyramid;
+    bool use_streaming = false;     // runStreamingPipeline, the file is read in the process stage
+    StreamingOptions streaming;     // memory_budget_bytes is per process worker
+    bool export_vector = false;     // also write the tiles as <stem>_mosaic.svg / .svgz / .pdf
+    VectorExportOptions vector;
+    std::string cache_dir;          // keep edges / segments / rankings here across runs, empty = off
+};
+
+
+struct BatchImageResult {
+    std::string input_path;
+    std::string output_path;
+    bool ok = false;
+    std::string error;    // why the image failed, empty when ok
+    int width = 0;
+    int height = 0;
+    int segments = 0;
+    int tiles = 0;
+    double decode_seconds = 0.0;
+    double process_seconds = 0.0;
+    double encode_seconds = 0.0;
+
+    double megapixels() const { return width * static_cast<double>(height) / 1e6; }
+};
+
+
+struct BatchReport {
+    std::vector<BatchImageResult> images;   // same order as the inputs
+    double wall_seconds = 0.0;
+    std::size_t buffers_reused = 0;       // stage buffers recycled across images (MosaicWorkspace)
+    std::size_t buffers_allocated = 0;
+    std::size_t disk_cache_hits = 0;     // images that skipped straight to placement (cache_dir)
+
+    std::size_t succeeded() const;
+    double imagesPerSecond() const;
+    double megapixelsPerSecond() const;
+
+    void printSummary(std::ostream& out) const;
+    void writeCsv(std::ostream& out) const;
+};
+
+
+// A directory lists its image files (sorted), any other file is read as a
+// manifest with one image path per line ('#' starts a comment)
+std::vector<std::string> collectBatchInputs(const std::string& directory_or_manifest);
+
+// Decode, process and encode overlap across images through bounded queues, so at
+// most queue_capacity images wait between two stages plus one per busy worker.
+BatchReport runBatch(const std::vector<std::string>& inputs, const MosaicParams& params, const BatchOptions& options);
+
+}
+
+#endif
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "graphics.hpp"
+#include "parallel.hpp"
+#include "pipeline.hpp"
+
+using namespace std;
+using mosaic_gen::Mosaic;
+using mosaic_gen::MosaicParams;
+
+// Per-stage benchmark of the Mosaic pipeline.
+//
+// usage: mosaic_bench [--images a.jpg,b.jpg] [--mp 1,4,16,100] [--density 0.02,0.08]
+//                     [--threads 1,0] [--repeats 5] [--format json|csv] [--out file]
+//
+// Every stage is timed separately on the bundled photos and on synthetic frames
+// with a controlled edge density, once per thread setting.
+
+
+struct BenchInput {
+    string name;
+    cv::Mat image;
+};
+
+
+struct BenchRecord {
+    string input;
+    int width = 0;
+    int height = 0;
+    double edge_density = 0.0;
+    int threads = 1;
+    string stage;
+    int repeats = 0;
+    long items = 1;                 // calls per repeat, for the per-call stages
+    double min_ms = 0.0;
+    double median_ms = 0.0;
+    double mean_ms = 0.0;
+};
+
+
+vector<string> splitList(const string& list) {
+    vector<string> parts;
+    stringstream ss(list);
+    string part;
+    while (getline(ss, part, ',')) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+
+// Flat gray frame with random straight strokes. Every stroke gives Canny two
+// edges roughly as long as the stroke, so the stroke budget sets the density.
+cv::Mat makeSyntheticImage(double megapixels, double edge_density, uint32_t seed) {
+    const int width = static_cast<int>(std::sqrt(megapixels * 1e6 * 4.0 / 3.0));
+    const int height = static_cast<int>(megapixels * 1e6 / width);
+
+    cv::Mat image(height, width, CV_8UC3, cv::Scalar(128, 128, 128));
+    mt19937 rng(seed);
+    uniform_int_distribution<int> px(0, width - 1), py(0, height - 1), shade(0, 255);
+    uniform_real_distribution<double> len(20.0, 200.0), ang(0.0, 2 * M_PI);
+
+    double budget = edge_density * width * height / 2.0;
+    while (budget > 0) {
+        double l = len(rng), a = ang(rng);
+        cv::Point p0(px(rng), py(rng));
+        cv::Point p1(cvRound(p0.x + l * std::cos(a)), cvRound(p0.y + l * std::sin(a)));
+        int s = shade(rng);
+        cv::line(image, p0, p1, cv::Scalar(s, s, s), 3, cv::LINE_8);
+        budget -= l;
+    }
+    return image;
+}
+
+
+BenchRecord timeStage(const string& stage, int repeats, long items, const function<void()>& fn) {
+    vector<double> samples;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        auto end = chrono::steady_clock::now();
+        samples.push_back(chrono::duration<double, milli>(end - start).count());
+    }
+    sort(samples.begin(), samples.end());
+
+    BenchRecord record;
+    record.stage = stage;
+    record.repeats = repeats;
+    record.items = items;
+    record.min_ms = samples.front();
+    record.median_ms = samples[samples.size() / 2];
+    for (double s : samples) record.mean_ms += s / samples.size();
+    return record;
+}
+
+
+void benchInput(const BenchInput& input, int threads, int repeats, const MosaicParams& params, vector<BenchRecord>& out) {
+    Mosaic mosaic(input.image, input.name, threads);
+    mosaic.setDebugOutput(false);
+    mosaic.setStageCaching(false);   // every repeat must really run the stage
+
+    vector<BenchRecord> records;
+    records.push_back(timeStage("resizeOriginal", repeats, 1, [&] { mosaic.resizeOriginal(params.resize_factor); }));
+    records.push_back(timeStage("grayImage", repeats, 1, [&] { mosaic.grayImage(); }));
+    records.push_back(timeStage("blurImage", repeats, 1, [&] { mosaic.blurImage(params.blur_kernel_size, params.blur_sigma); }));
+    records.push_back(timeStage("cannyFilter", repeats, 1, [&] { mosaic.cannyFilter(params.canny_threshold_1, params.canny_threshold_2); }));
+    records.push_back(timeStage("detectContours", repeats, 1, [&] {
+        mosaic.detectContours(params.max_segment_angle_rad, params.min_segment_length, params.segment_angle_window);
+    }));
+    records.push_back(timeStage("rankSegments", repeats, 1, [&] { mosaic.rankSegments(); }));
+
+    const bool has_segments = mosaic.segments.size() > 0;
+    if (has_segments) {
+        records.push_back(timeStage("selectSegment", repeats, 1, [&] { mosaic.selectSegment(0); }));
+
+        const long point_calls = 100000;
+        records.push_back(timeStage("getRandomPointOnSegment", repeats, point_calls, [&] {
+            for (long i = 0; i < point_calls; ++i) mosaic.getRandomPointOnSegment(0);
+        }));
+    }
+
+    const long square_calls = 10000;
+    cv::Mat canvas = cv::Mat::zeros(mosaic.resized.size(), CV_8UC3);
+    mt19937 rng(7);
+    uniform_int_distribution<int> px(0, canvas.cols - 1), py(0, canvas.rows - 1), deg(-45, 45);
+    vector<cv::Point> centers(square_calls);
+    vector<int> angles(square_calls);
+    for (long i = 0; i < square_calls; ++i) {
+        centers[i] = cv::Point(px(rng), py(rng));
+        angles[i] = deg(rng);
+    }
+    records.push_back(timeStage("Graphics::drawSquare", repeats, square_calls, [&] {
+        for (long i = 0; i < square_calls; ++i) {
+            Graphics::drawSquare(canvas, centers[i], params.tile_size, angles[i], cv::Scalar(0, 255, 0), params.tile_border_width);
+        }
+    }));
+
+    vector<Graphics::TileRecord> tile_records(square_calls);
+    for (long i = 0; i < square_calls; ++i) {
+        auto& record = tile_records[i];
+        record.center = cv::Point2f(centers[i].x, centers[i].y);
+        record.size = static_cast<float>(params.tile_size);
+        record.angle_deg = static_cast<float>(angles[i]);
+        record.border_color = cv::Vec3b(0, 255, 0);
+        record.border_width = params.tile_border_width;
+    }
+    records.push_back(timeStage("Graphics::drawTiles", repeats, square_calls, [&] {
+        Graphics::drawTiles(canvas, tile_records, threads);
+    }));
+
+    const double density = mosaic.edges.empty() ? 0.0 : cv::countNonZero(mosaic.edges) / static_cast<double>(mosaic.edges.total());
+    for (auto& record : records) {
+        record.input = input.name;
+        record.width = input.image.cols;
+        record.height = input.image.rows;
+        record.edge_density = density;
+        record.threads = mosaic_gen::resolveThreadCount(threads);   // "all cores" as the count it meant here
+        out.push_back(record);
+    }
+}
+
+
+// CSV field, quoted when an image path holds a separator, quote or line break
+string csvField(const string& text) {
+    if (text.find_first_of(",\"\r\n") == string::npos) {
+        return text;
+    }
+    string quoted = "\"";
+    for (char c : text) {
+        quoted += c;
+        if (c == '"') quoted += '"';
+    }
+    return quoted + "\"";
+}
+
+
+// Whole text as a finite number
+bool parseNumber(const string& text, double& value) {
+    char* end = nullptr;
+    value = strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && std::isfinite(value);
+}
+
+
+void writeCsv(ostream& out, const vector<BenchRecord>& records) {
+    out << "input,width,height,megapixels,edge_density,threads,stage,repeats,items,min_ms,median_ms,mean_ms\n";
+    for (const auto& r : records) {
+        out << csvField(r.input) << "," << r.width << "," << r.height << "," << r.width * (double)r.height / 1e6 << ","
+            << r.edge_density << "," << r.threads << "," << r.stage << "," << r.repeats << "," << r.items << ","
+            << r.min_ms << "," << r.median_ms << "," << r.mean_ms << "\n";
+    }
+}
+
+
+// Quoted JSON string; image paths may hold quotes or backslashes
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += static_cast<char>(c);
+        }
+        else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else {
+            quoted += static_cast<char>(c);
+        }
+    }
+    return quoted + "\"";
+}
+
+
+void writeJson(ostream& out, const vector<BenchRecord>& records) {
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& r = records[i];
+        out << "    {\"input\": " << jsonString(r.input) << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"megapixels\": " << r.width * (double)r.height / 1e6 << ", \"edge_density\": " << r.edge_density
+            << ", \"threads\": " << r.threads << ", \"stage\": " << jsonString(r.stage) << ", \"repeats\": " << r.repeats
+            << ", \"items\": " << r.items << ", \"min_ms\": " << r.min_ms << ", \"median_ms\": " << r.median_ms
+            << ", \"mean_ms\": " << r.mean_ms << "}" << (i + 1 < records.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+
+int main(int argc, char** argv) {
+
+    string images_arg = "../Images/flower.jpg,../Images/einstein.jpg";
+    string mp_arg = "1,4,16,100";
+    string density_arg = "0.02,0.08";
+    string threads_arg = "1,0";
+    string format = "json";
+    string out_path;
+    int repeats = 5;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--images") images_arg = argv[i + 1];
+        else if (arg == "--mp") mp_arg = argv[i + 1];
+        else if (arg == "--density") density_arg = argv[i + 1];
+        else if (arg == "--threads") threads_arg = argv[i + 1];
+        else if (arg == "--repeats") repeats = max(1, atoi(argv[i + 1]));
+        else if (arg == "--format") format = argv[i + 1];
+        else if (arg == "--out") out_path = argv[i + 1];
+        else {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+
+    MosaicParams params;
+    vector<int> thread_settings;
+    for (const auto& t : splitList(threads_arg)) thread_settings.push_back(atoi(t.c_str()));
+
+    // Inputs are generated one at a time so 100 MP frames don't pile up in memory
+    vector<function<BenchInput()>> inputs;
+    for (const auto& path : splitList(images_arg)) {
+        inputs.push_back([path] { return BenchInput{path, cv::imread(path)}; });
+    }
+    for (const auto& mp : splitList(mp_arg)) {
+        // a frame needs at least one pixel, makeSyntheticImage divides by its width
+        double megapixels = 0.0;
+        if (!parseNumber(mp, megapixels) || megapixels * 1e6 < 1.0) {
+            cerr << "--mp values must be numbers of at least 0.000001, got " << mp << endl;
+            return 1;
+        }
+        for (const auto& density : splitList(density_arg)) {
+            double edge_density = 0.0;
+            if (!parseNumber(density, edge_density) || edge_density < 0.0) {
+                cerr << "--density values must be non-negative numbers, got " << density << endl;
+                return 1;
+            }
+            inputs.push_back([mp, density, megapixels, edge_density] {
+                return BenchInput{"synthetic_" + mp + "mp_d" + density,
+                                  makeSyntheticImage(megapixels, edge_density, 1234)};
+            });
+        }
+    }
+
+    vector<BenchRecord> records;
+    for (const auto& make_input : inputs) {
+        BenchInput input = make_input();
+        if (input.image.empty()) {
+            cerr << "Skipping unreadable input: " << input.name << endl;
+            continue;
+        }
+        for (int threads : thread_settings) {
+            cerr << "bench " << input.name << " (" << input.image.cols << "x" << input.image.rows
+                 << ") threads=" << mosaic_gen::resolveThreadCount(threads) << endl;
+            benchInput(input, threads, repeats, params, records);
+        }
+    }
+
+    ofstream file;
+    if (!out_path.empty()) file.open(out_path);
+    ostream& out = out_path.empty() ? cout : file;
+
+    if (format == "csv") writeCsv(out, records);
+    else writeJson(out, records);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace mosaic_gen {
+
+// Blocking multi-producer / multi-consumer queue with a fixed capacity.
+// push() waits while the queue is full, which is what keeps a pipeline's
+// memory bounded. After close(), pushes fail and pops drain what is left.
+template <typename T>
+class BoundedQueue {
+
+    public:
+
+        explicit BoundedQueue(std::size_t capacity) : max_items(capacity > 0 ? capacity : 1) {}
+
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [&] { return closed || items.size() < max_items; });
+            if (closed) {
+                return false;
+            }
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+            return true;
+        }
+
+        // Non-blocking push, false when full or closed
+        bool tryPush(T item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed || items.size() >= max_items) {
+                return false;
+            }
+            items.push_back(std::move(item));
+            not_empty.notify_one();
+            return true;
+        }
+
+        // Waits for an item, false once the queue is closed and empty
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_empty.wait(lock, [&] { return closed || !items.empty(); });
+            if (items.empty()) {
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+            not_full.notify_one();
+            return true;
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            not_full.notify_all();
+            not_empty.notify_all();
+        }
+
+        std::size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return items.size();
+        }
+
+        std::size_t capacity() const { return max_items; }
+
+
+    private:
+
+        const std::size_t max_items;
+        std::deque<T> items;
+        bool closed = false;
+
+        mutable std::mutex mutex;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+
+};
+
+}
+
+#endif
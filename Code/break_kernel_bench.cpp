@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "angle_breaks.hpp"
+
+using namespace std;
+using mosaic_gen::angleBreakCos2;
+using mosaic_gen::angleBreaksHaveAvx2;
+using mosaic_gen::findAngleBreaksAvx2;
+using mosaic_gen::findAngleBreaksScalar;
+
+// Microbenchmark for the contour break test in detectContours.
+// usage: break_kernel_bench [contour_length] [contour_count] [repeats]
+
+
+// The original per-point loop: two sqrts, normalize, clamp and acos
+void acosBreaks(const vector<int32_t>& xs, const vector<int32_t>& ys, int w, double max_angle_rad, vector<int>& breaks) {
+    int len = xs.size();
+    for (int i = w; i < len - w; ++i) {
+        float v1x = xs[i] - xs[i - w], v1y = ys[i] - ys[i - w];
+        float v2x = xs[i + w] - xs[i], v2y = ys[i + w] - ys[i];
+
+        double norm1 = std::sqrt(v1x * v1x + v1y * v1y) + 1e-8;
+        double norm2 = std::sqrt(v2x * v2x + v2y * v2y) + 1e-8;
+
+        float n1x = v1x / norm1, n1y = v1y / norm1;
+        float n2x = v2x / norm2, n2y = v2y / norm2;
+
+        double cosine = std::clamp(n1x * n2x + n1y * n2y, -1.0f, 1.0f);
+        double angle = std::acos(std::abs(cosine));
+
+        if (angle > max_angle_rad) {
+            breaks.push_back(i);
+        }
+    }
+}
+
+
+// 8-connected random walk with smooth heading, like a Canny contour
+void makeContour(mt19937& rng, int len, vector<int32_t>& xs, vector<int32_t>& ys) {
+    normal_distribution<double> turn(0.0, 0.15);
+    xs.resize(len);
+    ys.resize(len);
+    double heading = 0.0;
+    int x = 32768, y = 32768;
+    for (int i = 0; i < len; ++i) {
+        heading += turn(rng);
+        x += static_cast<int>(std::lround(std::cos(heading)));
+        y += static_cast<int>(std::lround(std::sin(heading)));
+        xs[i] = x;
+        ys[i] = y;
+    }
+}
+
+
+template <typename Fn>
+double timeIt(int repeats, Fn&& fn) {
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+        auto start = chrono::high_resolution_clock::now();
+        fn();
+        auto end = chrono::high_resolution_clock::now();
+        best = std::min(best, chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+
+
+int main(int argc, char** argv) {
+    int contour_length = argc > 1 ? atoi(argv[1]) : 100000;
+    int contour_count = argc > 2 ? atoi(argv[2]) : 20;
+    int repeats = argc > 3 ? atoi(argv[3]) : 5;
+
+    const int WINDOW = 10;
+    const double MAX_SEGMENT_ANGLE_RAD = 40 * M_PI / 180.0;
+
+    mt19937 rng(42);
+    vector<vector<int32_t>> xs(contour_count), ys(contour_count);
+    for (int c = 0; c < contour_count; ++c) {
+        makeContour(rng, contour_length, xs[c], ys[c]);
+    }
+
+    const float cos2 = angleBreakCos2(MAX_SEGMENT_ANGLE_RAD);
+    vector<int> breaks_acos, breaks_scalar, breaks_avx2;
+    breaks_acos.reserve(contour_length);
+    breaks_scalar.reserve(contour_length);
+    breaks_avx2.reserve(contour_length);
+
+    // the AVX2 kernel is only run where the CPU has it, it would fault elsewhere
+    const bool have_avx2 = angleBreaksHaveAvx2();
+    size_t mismatches = 0;
+    size_t break_count = 0;
+    for (int c = 0; c < contour_count; ++c) {
+        breaks_acos.clear();
+        breaks_scalar.clear();
+        breaks_avx2.clear();
+        acosBreaks(xs[c], ys[c], WINDOW, MAX_SEGMENT_ANGLE_RAD, breaks_acos);
+        findAngleBreaksScalar(xs[c].data(), ys[c].data(), contour_length, WINDOW, cos2, breaks_scalar);
+        mismatches += breaks_acos != breaks_scalar;
+        if (have_avx2) {
+            findAngleBreaksAvx2(xs[c].data(), ys[c].data(), contour_length, WINDOW, cos2, breaks_avx2);
+            mismatches += breaks_scalar != breaks_avx2;
+        }
+        break_count += breaks_acos.size();
+    }
+
+    auto run = [&](auto&& kernel) {
+        return timeIt(repeats, [&]() {
+            for (int c = 0; c < contour_count; ++c) {
+                breaks_scalar.clear();
+                kernel(c, breaks_scalar);
+            }
+        });
+    };
+
+    double t_acos = run([&](int c, vector<int>& out) { acosBreaks(xs[c], ys[c], WINDOW, MAX_SEGMENT_ANGLE_RAD, out); });
+    double t_scalar = run([&](int c, vector<int>& out) { findAngleBreaksScalar(xs[c].data(), ys[c].data(), contour_length, WINDOW, cos2, out); });
+    double t_avx2 = have_avx2
+        ? run([&](int c, vector<int>& out) { findAngleBreaksAvx2(xs[c].data(), ys[c].data(), contour_length, WINDOW, cos2, out); })
+        : 0.0;
+
+    double points = static_cast<double>(contour_length) * contour_count;
+    cout << "contours: " << contour_count << " x " << contour_length << " points, " << break_count << " breaks" << endl;
+    cout << "avx2 available: " << (have_avx2 ? "yes" : "no") << endl;
+    cout << "mismatching contours: " << mismatches << endl;
+    cout << "acos loop:   " << t_acos * 1e3 << " ms (" << points / t_acos / 1e6 << " Mpts/s)" << endl;
+    cout << "cos2 scalar: " << t_scalar * 1e3 << " ms (" << points / t_scalar / 1e6 << " Mpts/s), x" << t_acos / t_scalar << endl;
+    if (have_avx2) {
+        cout << "cos2 avx2:   " << t_avx2 * 1e3 << " ms (" << points / t_avx2 / 1e6 << " Mpts/s), x" << t_acos / t_avx2 << endl;
+    }
+    else {
+        cout << "cos2 avx2:   skipped" << endl;
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include "contour_split.hpp"
+#include "angle_breaks.hpp"
+
+namespace mosaic_gen {
+
+void segmentContour(const std::vector<cv::Point>& contour, float break_cos2, int min_segment_length,
+                    int segment_angle_window, ContourScratch& scratch, SegmentStore& out) {
+    if (contour.size() < 3)
+        return;
+
+    int len = contour.size();
+
+    // Break detection runs on structure-of-arrays coordinates
+    scratch.xs.resize(len);
+    scratch.ys.resize(len);
+    for (int i = 0; i < len; ++i) {
+        scratch.xs[i] = contour[i].x;
+        scratch.ys[i] = contour[i].y;
+    }
+
+    scratch.breaks.clear();
+    findAngleBreaks(scratch.xs.data(), scratch.ys.data(), len, segment_angle_window, break_cos2, scratch.breaks);
+    scratch.break_count += scratch.breaks.size();
+
+    // Build split indices
+    std::vector<int>& split_idxs = scratch.split_idxs;
+    split_idxs.assign(1, 0);
+    split_idxs.insert(split_idxs.end(), scratch.breaks.begin(), scratch.breaks.end());
+    split_idxs.push_back(len);
+
+    for (size_t i = 0; i < split_idxs.size() - 1; ++i) {
+        int a = split_idxs[i];
+        int b = split_idxs[i + 1];
+        if (b - a < min_segment_length)
+            continue;
+
+        out.addSegment(contour.data() + a, b - a);
+    }
+}
+
+}
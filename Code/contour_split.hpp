@@ -0,0 +1,28 @@
+#ifndef CONTOUR_SPLIT_HPP
+#define CONTOUR_SPLIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+// Per-worker buffers reused across contours
+struct ContourScratch {
+    std::vector<int32_t> xs;
+    std::vector<int32_t> ys;
+    std::vector<int> breaks;
+    std::vector<int> split_idxs;
+    std::size_t break_count = 0;
+};
+
+// Split one contour at sharp turns (see angle_breaks.hpp) and append the pieces
+// of at least min_segment_length points to out
+void segmentContour(const std::vector<cv::Point>& contour, float break_cos2, int min_segment_length,
+                    int segment_angle_window, ContourScratch& scratch, SegmentStore& out);
+
+}
+
+#endif
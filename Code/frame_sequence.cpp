@@ -0,0 +1,226 @@
+#include "frame_sequence.hpp"
+#include "trace.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace mosaic_gen {
+
+FrameSequenceProcessor::FrameSequenceProcessor(const MosaicParams& params, const FrameSequenceOptions& options)
+    : params(params), options(options), mosaic(options.threads) {
+    mosaic.setDebugOutput(false);
+}
+
+
+void FrameSequenceProcessor::reset() {
+    has_previous = false;
+    previous_tiles.clear();
+    previous_segments.clear();
+    frame_index = 0;
+}
+
+
+int FrameSequenceProcessor::findDirtyCells() {
+    const cv::Size frame = mosaic.edges.size();
+    const int cell = max(1, options.cell_size);
+    const cv::Size grid((frame.width + cell - 1) / cell, (frame.height + cell - 1) / cell);
+
+    // INTER_AREA down to the grid averages each cell
+    cv::bitwise_xor(mosaic.edges, previous_edges, diff);
+    cv::resize(diff, cell_edge_change, grid, 0, 0, cv::INTER_AREA);
+    cv::absdiff(mosaic.blurred, previous_blurred, diff);
+    cv::resize(diff, cell_blur_change, grid, 0, 0, cv::INTER_AREA);
+
+    cv::Mat edge_dirty = cell_edge_change > options.edge_change * 255.0;
+    cv::Mat blur_dirty = cell_blur_change > options.blur_change;
+    cv::bitwise_or(edge_dirty, blur_dirty, dirty_cells);
+    cv::dilate(dirty_cells, dirty_cells, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+    stats.total_cells = grid.area();
+    return cv::countNonZero(dirty_cells);
+}
+
+
+void FrameSequenceProcessor::splitPreviousSegments() {
+    seed_region.copyTo(trace_region);
+    kept_segments.reset(mosaic.edges.size());
+
+    for (int id = 0; id < previous_segments.size(); ++id) {
+        previous_segments.copyPoints(id, segment_points);
+        const bool touches_seed = any_of(segment_points.begin(), segment_points.end(),
+                                         [&](const cv::Point& p) { return seed_region.at<uchar>(p) != 0; });
+        if (!touches_seed) {
+            kept_segments.addSegment(segment_points.data(), segment_points.size());
+            continue;
+        }
+        for (const auto& p : segment_points) {
+            trace_region.at<uchar>(p) = 255;
+        }
+    }
+}
+
+
+const cv::Mat& FrameSequenceProcessor::processFrame(const cv::Mat& frame) {
+    MOSAIC_TRACE_SCOPE("processFrame");
+    auto start = chrono::steady_clock::now();
+
+    stats = FrameStats();
+    stats.index = frame_index++;
+
+    mosaic.resetImage(frame, "frame");
+    mosaic.resizeOriginal(params.resize_factor);
+    mosaic.grayImage();
+    mosaic.blurImage(params.blur_kernel_size, params.blur_sigma);
+    mosaic.cannyFilter(params.canny_threshold_1, params.canny_threshold_2);
+
+    const bool comparable = has_previous && previous_edges.size() == mosaic.edges.size();
+    stats.dirty_cells = comparable ? findDirtyCells() : 0;
+    stats.full_refresh = !comparable || stats.dirty_cells > options.full_refresh_fraction * stats.total_cells;
+
+    if (stats.full_refresh || stats.dirty_cells > 0) {
+        vector<TilePlacement> keep;
+        if (!stats.full_refresh) {
+            // tiles centered in a clean cell stay put
+            const int cell = max(1, options.cell_size);
+            for (const auto& tile : previous_tiles) {
+                if (!dirty_cells.at<uchar>(tile.center.y / cell, tile.center.x / cell)) {
+                    keep.push_back(tile);
+                }
+            }
+            cv::resize(dirty_cells, seed_cells, cv::Size(dirty_cells.cols * cell, dirty_cells.rows * cell), 0, 0, cv::INTER_NEAREST);
+            seed_region = seed_cells(cv::Rect(0, 0, mosaic.edges.cols, mosaic.edges.rows));
+        }
+        stats.tiles_kept = static_cast<int>(keep.size());
+
+        int segment_count = 0;
+        if (stats.full_refresh) {
+            segment_count = mosaic.detectContours(params.max_segment_angle_rad, params.min_segment_length, params.segment_angle_window);
+        }
+        else {
+            splitPreviousSegments();
+            segment_count = mosaic.detectContours(params.max_segment_angle_rad, params.min_segment_length, params.segment_angle_window,
+                                                  trace_region, kept_segments);
+            stats.segments_kept = kept_segments.size();
+        }
+        stats.segments_traced = max(0, segment_count) - stats.segments_kept;
+        previous_segments = mosaic.segments;
+
+        if (segment_count > 0) {
+            mosaic.rankSegments();
+            mosaic.placeTiles(params.tile_size, params.tile_segments, params.tile_gap, params.tile_theta_step,
+                              params.tile_decay_rate, keep, stats.full_refresh ? cv::Mat() : seed_region);
+        }
+        else {
+            mosaic.tiles = keep;
+        }
+        previous_tiles = mosaic.tiles;
+        stats.tiles_placed = static_cast<int>(previous_tiles.size()) - stats.tiles_kept;
+    }
+    else {
+        // nothing moved, same tiles in this frame's colors
+        mosaic.tiles = previous_tiles;
+        stats.tiles_kept = static_cast<int>(previous_tiles.size());
+    }
+
+    mosaic.renderCanvas(params.tile_border_width);
+
+    // own copies, so the Mosaic's recycled buffers are free for the next frame
+    mosaic.blurred.copyTo(previous_blurred);
+    mosaic.edges.copyTo(previous_edges);
+    has_previous = true;
+
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    MOSAIC_TRACE_COUNTER("dirty_cells", stats.dirty_cells);
+    return mosaic.canvas;
+}
+
+
+namespace {
+
+// output is handed to snprintf with the frame number, so it has to hold exactly
+// one int conversion (%d, %05i, %x ...) and nothing else but %%
+bool isFramePattern(const std::string& output) {
+    int conversions = 0;
+    for (size_t i = 0; i < output.size(); ++i) {
+        if (output[i] != '%') {
+            continue;
+        }
+        if (++i < output.size() && output[i] == '%') {
+            continue;
+        }
+        while (i < output.size() && strchr("-+ #0", output[i])) i++;
+        while (i < output.size() && isdigit(static_cast<unsigned char>(output[i]))) i++;
+        if (i < output.size() && output[i] == '.') {
+            i++;
+            while (i < output.size() && isdigit(static_cast<unsigned char>(output[i]))) i++;
+        }
+        if (i >= output.size() || !strchr("diouxX", output[i])) {
+            return false;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+}
+
+
+int runFrameSequence(const std::string& input, const std::string& output, const MosaicParams& params,
+                     const FrameSequenceOptions& options, std::vector<FrameStats>* frame_stats) {
+    const bool numbered_output = output.find('%') != string::npos;
+    if (numbered_output && !isFramePattern(output)) {
+        cerr << "Output pattern needs exactly one integer conversion such as %04d: " << output << endl;
+        return -1;
+    }
+
+    cv::VideoCapture capture(input);
+    if (!capture.isOpened()) {
+        cerr << "Could not open video or image sequence: " << input << endl;
+        return -1;
+    }
+
+    double fps = capture.get(cv::CAP_PROP_FPS);
+    if (fps <= 0.0) {
+        fps = 25.0;
+    }
+
+    FrameSequenceProcessor processor(params, options);
+    cv::VideoWriter writer;
+    cv::Mat frame;
+    int written = 0;
+
+    while (capture.read(frame) && !frame.empty()) {
+        const cv::Mat& canvas = processor.processFrame(frame);
+        if (frame_stats) {
+            frame_stats->push_back(processor.lastFrame());
+        }
+
+        if (numbered_output) {
+            char path[4096];
+            snprintf(path, sizeof(path), output.c_str(), written);
+            if (!cv::imwrite(path, canvas)) {
+                cerr << "Failed to save: " << path << endl;
+                break;
+            }
+        }
+        else {
+            if (!writer.isOpened() &&
+                !writer.open(output, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), fps, canvas.size())) {
+                cerr << "Could not open video writer: " << output << endl;
+                break;
+            }
+            writer.write(canvas);
+        }
+        written++;
+    }
+
+    return written;
+}
+
+}
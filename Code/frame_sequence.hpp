@@ -0,0 +1,102 @@
+#ifndef FRAME_SEQUENCE_HPP
+#define FRAME_SEQUENCE_HPP
+
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "pipeline.hpp"
+
+namespace mosaic_gen {
+
+struct FrameSequenceOptions {
+    int cell_size = 32;                  // change detection grid, in resized pixels
+    double edge_change = 0.02;           // fraction of a cell's edge pixels that flipped
+    double blur_change = 10.0;           // mean |blurred - previous blurred| of a cell, 0..255
+    double full_refresh_fraction = 0.5;  // above this share of dirty cells, redo the whole frame
+    int threads = 0;
+};
+
+
+struct FrameStats {
+    int index = 0;
+    int dirty_cells = 0;
+    int total_cells = 0;
+    bool full_refresh = false;
+    int tiles_kept = 0;
+    int tiles_placed = 0;
+    int segments_kept = 0;     // carried over from the previous frame
+    int segments_traced = 0;   // traced from this frame's edges
+    double seconds = 0.0;
+};
+
+
+// Mosaic for consecutive frames that keeps the previous tiles where the picture
+// did not change. Every frame runs resize / gray / blur / canny; cells whose
+// edges or blurred intensity moved past the thresholds are dirty. Tiles centered
+// in clean cells are kept as they are (so they don't flicker), new tiles are only
+// seeded in dirty cells, and the canvas is recolored from the current frame.
+// Contours are only traced again in the dirty cells, plus along the previous
+// segments reaching into them so those aren't cut short; the other previous
+// segments are kept. Unchanged frames skip contours and placement entirely.
+// mosaic_video prints the per-frame time and these stats.
+class FrameSequenceProcessor {
+
+    public:
+
+        explicit FrameSequenceProcessor(const MosaicParams& params, const FrameSequenceOptions& options = FrameSequenceOptions());
+
+        // Canvas for frame, valid until the next call
+        const cv::Mat& processFrame(const cv::Mat& frame);
+
+        // Forget the previous frame, the next one is processed from scratch
+        void reset();
+
+        const FrameStats& lastFrame() const { return stats; }
+        const std::vector<TilePlacement>& tiles() const { return previous_tiles; }
+
+
+    private:
+
+        // cells over threshold, dilated by one so tiles straddling a border are redone
+        int findDirtyCells();
+
+        // previous_segments outside seed_region into kept_segments, the rest
+        // painted into trace_region along with seed_region
+        void splitPreviousSegments();
+
+        MosaicParams params;
+        FrameSequenceOptions options;
+        Mosaic mosaic;
+        FrameStats stats;
+        int frame_index = 0;
+
+        bool has_previous = false;
+        cv::Mat previous_blurred;
+        cv::Mat previous_edges;
+        std::vector<TilePlacement> previous_tiles;
+        SegmentStore previous_segments;
+        SegmentStore kept_segments;
+
+        cv::Mat diff;
+        cv::Mat cell_edge_change;
+        cv::Mat cell_blur_change;
+        cv::Mat dirty_cells;
+        cv::Mat seed_cells;     // dirty_cells at pixel scale, rounded up to whole cells
+        cv::Mat seed_region;    // seed_cells cropped to the frame
+        cv::Mat trace_region;   // where contours are traced again
+        std::vector<cv::Point> segment_points;
+
+};
+
+
+// Read a video file or numbered image sequence ("frames/%04d.png") through
+// cv::VideoCapture and write the mosaic frames to output: a video through
+// cv::VideoWriter, or numbered images when output contains a printf pattern
+// with one integer conversion. Returns the number of frames written, -1 if the
+// input could not be opened or the pattern is not usable.
+int runFrameSequence(const std::string& input, const std::string& output, const MosaicParams& params,
+                     const FrameSequenceOptions& options, std::vector<FrameStats>* frame_stats = nullptr);
+
+}
+
+#endif
@@ -1,7 +1,10 @@
 #include "graphics.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <cmath>
-#include <vector>
+#include <limits>
 
 using namespace std;
 
@@ -13,26 +16,178 @@ namespace Graphics {
             return;
         }
     
-        float half_size = static_cast<float>(size / 2.0);
-        double theta = angle_deg * M_PI / 180.0;
+        const double half_size = size / 2.0;
+        const double theta = angle_deg * M_PI / 180.0;
+        const double c = cos(theta);
+        const double s = sin(theta);
     
-        std::vector<cv::Point2f> corners = {
-            {-half_size, -half_size},
-            {half_size, -half_size},
-            {half_size, half_size},
-            {-half_size, half_size}
-        };
-    
-        std::vector<cv::Point> rotated_corners;
-        for (const auto& point : corners) {
-            double x_rot = point.x * cos(theta) - point.y * sin(theta);
-            double y_rot = point.x * sin(theta) + point.y * cos(theta);
-            rotated_corners.emplace_back(cv::Point(cvRound(center.x + x_rot), cvRound(center.y + y_rot)));
+        static const double corners[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+        cv::Point rotated_corners[4];
+        for (int i = 0; i < 4; ++i) {
+            const double x = corners[i][0] * half_size;
+            const double y = corners[i][1] * half_size;
+            rotated_corners[i] = cv::Point(cvRound(center.x + x * c - y * s), cvRound(center.y + x * s + y * c));
         }
     
-        std::vector<std::vector<cv::Point>> outer_contour = { rotated_corners };
-        cv::drawContours(image, outer_contour, 0, color, border_width, cv::LINE_AA);
+        const cv::Point* outline = rotated_corners;
+        const int corner_count = 4;
+        cv::polylines(image, &outline, &corner_count, 1, true, color, border_width, cv::LINE_AA);
+    }
+
+
+    void squareRowSpan(const cv::Point2f& center, float cos_t, float sin_t, float half, float y, int& x0, int& x1) {
+        float lo = -numeric_limits<float>::infinity();
+        float hi = numeric_limits<float>::infinity();
+        const float dy = y - center.y;
+
+        // |k * dx + m| <= half for k, m of each axis
+        const float ks[2] = {cos_t, -sin_t};
+        const float ms[2] = {sin_t * dy, cos_t * dy};
+        for (int axis = 0; axis < 2; ++axis) {
+            const float k = ks[axis];
+            const float m = ms[axis];
+            if (fabs(k) < 1e-6f) {
+                if (fabs(m) > half) {
+                    x0 = x1 = 0;
+                    return;
+                }
+                continue;
+            }
+            float a = (-half - m) / k;
+            float b = (half - m) / k;
+            if (a > b) swap(a, b);
+            lo = max(lo, a);
+            hi = min(hi, b);
+        }
+
+        // pixel x is covered when its center x + 0.5 lies in [cx + lo, cx + hi]
+        x0 = static_cast<int>(ceil(center.x + lo - 0.5f));
+        x1 = static_cast<int>(floor(center.x + hi - 0.5f)) + 1;
+    }
+
+
+    namespace {
+
+        // A tile reduced to what the scanline loop needs: the square is
+        // |u| <= half, |v| <= half with u = (p - c) . (cos, sin), v = (p - c) . (-sin, cos)
+        struct RasterTile {
+            cv::Point2f center;
+            float cos_t, sin_t;
+            float fill_half;      // < 0 when not filled
+            float outer_half;     // outline band is inner_half < max(|u|, |v|) <= outer_half
+            float inner_half;
+            int y0, y1;           // rows touched, inclusive
+            cv::Vec3b fill_color;
+            cv::Vec3b border_color;
+        };
+
+
+        inline void fillRow(cv::Vec3b* row, int cols, int x0, int x1, const cv::Vec3b& color) {
+            x0 = max(x0, 0);
+            x1 = min(x1, cols);
+            for (int x = x0; x < x1; ++x) row[x] = color;
+        }
+
+
+        void drawRow(cv::Vec3b* row, int cols, int y, const RasterTile& t) {
+            const float yc = y + 0.5f;
+
+            if (t.fill_half >= 0) {
+                int x0, x1;
+                squareRowSpan(t.center, t.cos_t, t.sin_t, t.fill_half, yc, x0, x1);
+                fillRow(row, cols, x0, x1, t.fill_color);
+            }
+
+            if (t.outer_half > t.inner_half) {
+                int o0, o1;
+                squareRowSpan(t.center, t.cos_t, t.sin_t, t.outer_half, yc, o0, o1);
+                if (o0 >= o1) return;
+
+                int i0 = 0, i1 = 0;
+                if (t.inner_half > 0) squareRowSpan(t.center, t.cos_t, t.sin_t, t.inner_half, yc, i0, i1);
+                if (i0 >= i1) {
+                    fillRow(row, cols, o0, o1, t.border_color);
+                }
+                else {
+                    fillRow(row, cols, o0, max(o0, i0), t.border_color);
+                    fillRow(row, cols, min(o1, i1), o1, t.border_color);
+                }
+            }
+        }
+
+    }
+
+
+    void drawTiles(cv::Mat& image, const TileRecord* tiles, std::size_t count, int threads) {
+        if (image.empty() || image.type() != CV_8UC3) {
+            std::cerr << "drawTiles needs a CV_8UC3 image" << std::endl;
+            return;
+        }
+        if (count == 0) {
+            return;
+        }
+
+        // Prepare every tile once; reach covers the corner at any angle
+        std::vector<RasterTile> raster;
+        raster.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            const TileRecord& tile = tiles[i];
+            const float half = tile.size / 2.0f;
+            const float border = max(0, tile.border_width) / 2.0f;
+            const float outer = tile.border_width > 0 ? half + border : half;
+            if (half <= 0 || (!tile.filled && tile.border_width <= 0)) continue;
+
+            const float theta = static_cast<float>(tile.angle_deg * M_PI / 180.0);
+            const float reach = outer * static_cast<float>(M_SQRT2);
+            RasterTile t;
+            t.center = tile.center;
+            t.cos_t = cos(theta);
+            t.sin_t = sin(theta);
+            t.fill_half = tile.filled ? half : -1.0f;
+            t.outer_half = tile.border_width > 0 ? outer : 0.0f;
+            t.inner_half = tile.border_width > 0 ? half - border : 0.0f;
+            t.y0 = max(0, static_cast<int>(floor(t.center.y - reach)));
+            t.y1 = min(image.rows - 1, static_cast<int>(ceil(t.center.y + reach)));
+            t.fill_color = tile.fill_color;
+            t.border_color = tile.border_color;
+            if (t.y0 <= t.y1) raster.push_back(t);
+        }
+
+        // Bands of at least 32 rows, a few per worker so uneven bands balance out
+        const int workers = mosaic_gen::resolveThreadCount(threads);
+        const int band_rows = max(32, (image.rows + workers * 4 - 1) / (workers * 4));
+        const int band_count = (image.rows + band_rows - 1) / band_rows;
+
+        // Counting sort of tile ids by band, keeping input order inside a band
+        std::vector<uint32_t> band_start(band_count + 1, 0);
+        for (const auto& t : raster) {
+            for (int b = t.y0 / band_rows; b <= t.y1 / band_rows; ++b) band_start[b + 1]++;
+        }
+        for (int b = 0; b < band_count; ++b) band_start[b + 1] += band_start[b];
+
+        std::vector<uint32_t> band_tiles(band_start[band_count]);
+        std::vector<uint32_t> cursor(band_start.begin(), band_start.end() - 1);
+        for (uint32_t i = 0; i < raster.size(); ++i) {
+            for (int b = raster[i].y0 / band_rows; b <= raster[i].y1 / band_rows; ++b) band_tiles[cursor[b]++] = i;
+        }
+
+        mosaic_gen::parallelFor(band_count, threads, [&](std::size_t band) {
+            const int row0 = static_cast<int>(band) * band_rows;
+            const int row1 = min(image.rows, row0 + band_rows);
+            for (uint32_t k = band_start[band]; k < band_start[band + 1]; ++k) {
+                const RasterTile& t = raster[band_tiles[k]];
+                const int y0 = max(t.y0, row0);
+                const int y1 = min(t.y1 + 1, row1);
+                for (int y = y0; y < y1; ++y) {
+                    drawRow(image.ptr<cv::Vec3b>(y), image.cols, y, t);
+                }
+            }
+        });
+    }
+
+
+    void drawTiles(cv::Mat& image, const std::vector<TileRecord>& tiles, int threads) {
+        drawTiles(image, tiles.data(), tiles.size(), threads);
     }
-    
 
-}
\ No newline at end of file
+}
@@ -1,6 +1,8 @@
 #ifndef GRAPHICS_HPP
 #define GRAPHICS_HPP
 
+#include <cstddef>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
 
@@ -8,6 +10,31 @@ namespace Graphics {
 
     void drawSquare(cv::Mat& image, const cv::Point& center, double size, double angle_deg, const cv::Scalar& color, int border_width);
 
+
+    // One oriented square for drawTiles, same center / size / angle convention as drawSquare
+    struct TileRecord {
+        cv::Point2f center;
+        float size = 0.0f;
+        float angle_deg = 0.0f;
+        cv::Vec3b fill_color;
+        cv::Vec3b border_color;
+        int border_width = 0;   // 0 for no outline, the outline is centered on the square's edge
+        bool filled = false;
+    };
+
+    // Columns [x0, x1) whose pixel centers on the row through y lie inside the
+    // square |u| <= half, |v| <= half, where u, v are the offsets from center
+    // along (cos, sin) and (-sin, cos). Empty when x0 >= x1; not clipped to any image.
+    void squareRowSpan(const cv::Point2f& center, float cos_t, float sin_t, float half, float y, int& x0, int& x1);
+
+    // Scanline rasterizer for a whole batch of tiles on a CV_8UC3 image. The
+    // image is cut into horizontal bands drawn on up to `threads` workers
+    // (<= 0 uses every core); tiles are bucketed per band once, so nothing is
+    // allocated per tile. Later tiles draw over earlier ones, as with repeated
+    // drawSquare calls. Edges are hard, without drawSquare's anti-aliasing.
+    void drawTiles(cv::Mat& image, const TileRecord* tiles, std::size_t count, int threads = 1);
+    void drawTiles(cv::Mat& image, const std::vector<TileRecord>& tiles, int threads = 1);
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,227 @@
+#include "image_loader.hpp"
+#include "mapped_file.hpp"
+#include "trace.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+namespace mosaic_gen {
+
+namespace {
+
+int readBigEndian16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+
+
+uint32_t readTiff(const unsigned char* p, int bytes, bool little_endian) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= uint32_t(p[little_endian ? i : bytes - 1 - i]) << (8 * i);
+    }
+    return value;
+}
+
+
+// ImageWidth / ImageLength of the first IFD of a classic (not Big) TIFF
+cv::Size peekTiffSize(const unsigned char* data, size_t size) {
+    const bool little_endian = data[0] == 'I';
+    const size_t ifd = readTiff(data + 4, 4, little_endian);
+    if (ifd + 2 > size) {
+        return cv::Size();
+    }
+    const size_t entries = readTiff(data + ifd, 2, little_endian);
+    int width = 0, height = 0;
+    for (size_t i = 0; i < entries && ifd + 2 + 12 * (i + 1) <= size; ++i) {
+        const unsigned char* entry = data + ifd + 2 + 12 * i;
+        const uint32_t tag = readTiff(entry, 2, little_endian);
+        const uint32_t type = readTiff(entry + 2, 2, little_endian);
+        if ((tag != 256 && tag != 257) || (type != 3 && type != 4)) {
+            continue;
+        }
+        const int value = static_cast<int>(readTiff(entry + 8, type == 3 ? 2 : 4, little_endian));
+        (tag == 256 ? width : height) = value;
+    }
+    return width > 0 && height > 0 ? cv::Size(width, height) : cv::Size();
+}
+
+
+bool isJpeg(const unsigned char* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+
+// Largest decoder reduction that keeps the image at or above the target scale
+int decodeDenominator(double resize_factor) {
+    for (int denominator : {8, 4, 2}) {
+        if (resize_factor * denominator <= 1.0 + 1e-9) {
+            return denominator;
+        }
+    }
+    return 1;
+}
+
+
+int reducedColorFlag(int denominator) {
+    switch (denominator) {
+        case 2: return cv::IMREAD_REDUCED_COLOR_2;
+        case 4: return cv::IMREAD_REDUCED_COLOR_4;
+        case 8: return cv::IMREAD_REDUCED_COLOR_8;
+        default: return cv::IMREAD_COLOR;
+    }
+}
+
+}
+
+
+cv::Size peekImageSize(const unsigned char* data, size_t size) {
+    // PNG: IHDR is always the first chunk
+    static const unsigned char png_magic[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (size >= 24 && equal(png_magic, png_magic + 8, data)) {
+        const auto be32 = [&](size_t at) {
+            return static_cast<int>((uint32_t(data[at]) << 24) | (uint32_t(data[at + 1]) << 16) |
+                                    (uint32_t(data[at + 2]) << 8) | uint32_t(data[at + 3]));
+        };
+        return cv::Size(be32(16), be32(20));
+    }
+
+    if (size >= 8 && ((data[0] == 'I' && data[1] == 'I' && data[2] == 42 && data[3] == 0) ||
+                      (data[0] == 'M' && data[1] == 'M' && data[2] == 0 && data[3] == 42))) {
+        return peekTiffSize(data, size);
+    }
+
+    // BMP: BITMAPINFOHEADER width / height, height is negative for top-down rows
+    if (size >= 26 && data[0] == 'B' && data[1] == 'M') {
+        const int width = static_cast<int32_t>(readTiff(data + 18, 4, true));
+        const int height = static_cast<int32_t>(readTiff(data + 22, 4, true));
+        return width > 0 && height != 0 ? cv::Size(width, abs(height)) : cv::Size();
+    }
+
+    // JPEG: walk the marker segments up to the first start-of-frame
+    if (!isJpeg(data, size)) {
+        return cv::Size();
+    }
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return cv::Size();
+        }
+        const unsigned char marker = data[pos + 1];
+        if (marker == 0xFF) {   // fill byte
+            pos++;
+            continue;
+        }
+        const bool is_sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (is_sof && pos + 9 <= size) {
+            return cv::Size(readBigEndian16(data + pos + 7), readBigEndian16(data + pos + 5));
+        }
+        if (marker == 0xD9 || marker == 0xDA) {   // end of image / start of scan before any frame
+            return cv::Size();
+        }
+        pos += 2 + readBigEndian16(data + pos + 2);
+    }
+    return cv::Size();
+}
+
+
+LoadedImage decodeImage(const std::string& path, double resize_factor, size_t max_bytes, bool memory_map) {
+    MOSAIC_TRACE_SCOPE("decodeImage");
+
+    LoadedImage loaded;
+
+    // Map the file, or fall back to one read into a buffer
+    unique_ptr<MappedFile> mapped;
+    vector<unsigned char> buffer;
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    if (memory_map) {
+        mapped = make_unique<MappedFile>(path);
+        if (mapped->valid()) {
+            data = mapped->data();
+            size = mapped->size();
+        }
+    }
+    if (!data) {
+        ifstream file(path, ios::binary);
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+    }
+    if (size == 0) {
+        cerr << "Error: Could not load image from path: " << path << endl;
+        return loaded;
+    }
+
+    // imdecode reads straight from the mapping, no copy of the compressed bytes
+    const cv::Mat encoded(1, static_cast<int>(size), CV_8U, const_cast<unsigned char*>(data));
+    cv::Size source_size = peekImageSize(data, size);
+
+    int denominator = 1;
+    if (isJpeg(data, size) && source_size.area() > 0) {
+        denominator = decodeDenominator(resize_factor);
+    }
+
+    if (max_bytes > 0) {
+        const double decoded_bytes = 3.0 * ((source_size.width + denominator - 1) / denominator)
+                                         * ((source_size.height + denominator - 1) / denominator);
+        if (source_size.area() == 0 || decoded_bytes > static_cast<double>(max_bytes)) {
+            cerr << "Error: decoding " << path << " needs "
+                 << (source_size.area() == 0 ? string("an unknown amount of") : to_string(static_cast<size_t>(decoded_bytes) >> 20) + " MB")
+                 << " of memory, the limit is " << (max_bytes >> 20) << " MB" << endl;
+            return loaded;
+        }
+    }
+
+    cv::Mat decoded = cv::imdecode(encoded, reducedColorFlag(denominator));
+    if (decoded.empty()) {
+        cerr << "Error: Could not decode image from path: " << path << endl;
+        return loaded;
+    }
+
+    // The decoder applies EXIF orientation, so the header size may be transposed
+    if (source_size.area() == 0) {
+        source_size = decoded.size();
+        denominator = 1;
+    }
+    else if (source_size.width != source_size.height &&
+             decoded.cols == (source_size.height + denominator - 1) / denominator &&
+             decoded.rows == (source_size.width + denominator - 1) / denominator) {
+        swap(source_size.width, source_size.height);
+    }
+
+    loaded.image = decoded;
+    loaded.source_size = source_size;
+    loaded.resize_factor = 1.0 / denominator;
+    loaded.decode_denominator = denominator;
+    MOSAIC_TRACE_COUNTER("decode_denominator", denominator);
+    return loaded;
+}
+
+
+LoadedImage loadImage(const std::string& path, double resize_factor, bool memory_map) {
+    MOSAIC_TRACE_SCOPE("loadImage");
+
+    LoadedImage loaded = decodeImage(path, resize_factor, 0, memory_map);
+    if (loaded.empty()) {
+        return loaded;
+    }
+    loaded.resize_factor = resize_factor;
+
+    // Residual step to the exact size resizeOriginal would produce
+    const cv::Size target(cvRound(loaded.source_size.width * resize_factor), cvRound(loaded.source_size.height * resize_factor));
+    if (loaded.image.size() != target) {
+        cv::Mat decoded = loaded.image;
+        cv::resize(decoded, loaded.image, target, 0, 0, cv::INTER_LINEAR);
+    }
+    return loaded;
+}
+
+}
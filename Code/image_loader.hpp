@@ -0,0 +1,45 @@
+#ifndef IMAGE_LOADER_HPP
+#define IMAGE_LOADER_HPP
+
+#include <cstddef>
+#include <string>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+struct LoadOptions {
+    double resize_factor = 1.0;    // scale the stages will work at
+    bool keep_original = true;     // false lets JPEGs decode straight at the reduced size
+    bool memory_map = true;        // hand the mapped file to cv::imdecode instead of reading a copy
+};
+
+
+struct LoadedImage {
+    cv::Mat image;                 // BGR, already scaled by resize_factor
+    cv::Size source_size;          // full-resolution size of the file
+    double resize_factor = 1.0;
+    int decode_denominator = 1;    // 1, 2, 4 or 8 when the decoder did part of the scaling
+
+    bool empty() const { return image.empty(); }
+};
+
+
+// Decode path at resize_factor. For JPEGs the decoder's DCT scaling
+// (cv::IMREAD_REDUCED_COLOR_2/4/8) does the largest power-of-two step that
+// does not undershoot, then a small residual resize lands on the same size
+// cv::resize(fx = fy = resize_factor) gives on the full image.
+// Other formats decode fully and are resized afterwards.
+LoadedImage loadImage(const std::string& path, double resize_factor = 1.0, bool memory_map = true);
+
+// The decode step of loadImage without the residual resize: image is the file
+// at 1 / decode_denominator (rounded up) and resize_factor is that scale. With
+// max_bytes > 0 nothing is decoded, and an empty image returned, when the
+// decoded image would be larger or the header gives no size to check.
+LoadedImage decodeImage(const std::string& path, double resize_factor, std::size_t max_bytes = 0, bool memory_map = true);
+
+// Width / height from a JPEG, PNG, TIFF or BMP header without decoding, or an empty size
+cv::Size peekImageSize(const unsigned char* data, size_t size);
+
+}
+
+#endif
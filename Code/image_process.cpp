@@ -1,4 +1,5 @@
 #include "image_process.hpp"
+#include "segment_stats.hpp"
 #include <iostream>
 #include <filesystem>
 #include <random>
@@ -88,7 +89,8 @@ int detectContours(ImageState& state, double max_segment_angle_rad, int min_segm
     int contour_id = 0;
     std::vector<cv::Vec3b> colors_used;
 
-    std::mt19937 rng(std::random_device{}());
+    std::mt19937& rng = state.rng;
+    rng.seed(state.seed);
     std::uniform_int_distribution<int> color_dist(64, 255);
 
     for (const auto& contour : contours) {
@@ -169,30 +171,9 @@ void rankSegments(ImageState& state) {
         }
     }
 
-    // Helper lambda for PCA length
-    auto pca_length = [](const std::vector<cv::Point>& points) -> double {
-        if (points.size() < 2)
-            return 0.0;
-
-        cv::Mat data(points.size(), 2, CV_64F);
-        for (size_t i = 0; i < points.size(); ++i) {
-            data.at<double>(i, 0) = points[i].x;
-            data.at<double>(i, 1) = points[i].y;
-        }
-
-        cv::PCA pca(data, cv::Mat(), cv::PCA::DATA_AS_ROW, 1);
-        cv::Mat projected;
-        pca.project(data, projected);
-
-        double minVal, maxVal;
-        cv::minMaxLoc(projected.col(0), &minVal, &maxVal);
-
-        return maxVal - minVal;
-    };
-
-    // Compute PCA length per color segment
+    // Compute principal-axis length per color segment
     for (const auto& [color, pixels] : state.segment_pixels) {
-        double length = pca_length(pixels);
+        double length = mosaic_gen::computeSegmentStats(pixels).length;
         state.segment_lengths.emplace_back(color, length);
     }
 
@@ -257,12 +238,11 @@ cv::Point getRandomPointOnSegment(ImageState& state, int k) {
         throw std::runtime_error("No points in the selected segment");
     }
 
-    // Random engine and distribution
-    static std::mt19937 rng(std::random_device{}());
+    // Continues the stream detectContours seeded
     std::uniform_int_distribution<> dist(0, static_cast<int>(points.size()) - 1);
 
     // Pick a random index and return the point
-    return points[dist(rng)];
+    return points[dist(state.rng)];
 }
 
 
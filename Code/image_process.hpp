@@ -1,6 +1,8 @@
 #ifndef IMAGE_PROCESS_HPP
 #define IMAGE_PROCESS_HPP
 
+#include <cstdint>
+#include <random>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -47,6 +49,11 @@ namespace ImageProcess {
         std::string file_name;
         std::string file_path;
 
+        // detectContours reseeds rng from seed, so segment colors and the
+        // points drawn after it repeat from run to run
+        uint32_t seed = 0;
+        std::mt19937 rng;
+
         // param constructor
         ImageState(const std::string& image_path);
     };
@@ -0,0 +1,135 @@
+#include "image_writer.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+namespace fs = std::__fs::filesystem;
+
+namespace mosaic_gen {
+
+ImageWriter::ImageWriter(int worker_count, size_t queue_capacity) : queue(queue_capacity) {
+    worker_count = max(1, worker_count);
+    for (int i = 0; i < worker_count; ++i) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+
+ImageWriter::~ImageWriter() {
+    shutdown();
+}
+
+
+void ImageWriter::write(const cv::Mat& image, const string& output_path) {
+    if (image.empty()) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(state_mutex);
+        if (stopped) {
+            cerr << "ImageWriter stopped, dropping: " << output_path << endl;
+            return;
+        }
+        ++pending;
+    }
+
+    if (!queue.push(WriteJob{image, output_path})) {
+        lock_guard<mutex> lock(state_mutex);
+        --pending;
+        idle.notify_all();
+    }
+}
+
+
+void ImageWriter::flush() {
+    unique_lock<mutex> lock(state_mutex);
+    idle.wait(lock, [&] { return pending == 0; });
+}
+
+
+void ImageWriter::shutdown() {
+    {
+        lock_guard<mutex> lock(state_mutex);
+        if (stopped) {
+            return;
+        }
+        stopped = true;
+    }
+
+    // workers drain what is queued before they see the close
+    queue.close();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+
+size_t ImageWriter::written() const {
+    lock_guard<mutex> lock(state_mutex);
+    return written_count;
+}
+
+
+size_t ImageWriter::failed() const {
+    lock_guard<mutex> lock(state_mutex);
+    return failed_count;
+}
+
+
+bool ImageWriter::ensureDirectory(const string& output_path) {
+    const string dir = fs::path(output_path).parent_path().string();
+    if (dir.empty()) {
+        return true;
+    }
+
+    lock_guard<mutex> lock(state_mutex);
+    if (created_dirs.count(dir)) {
+        return true;
+    }
+    error_code error;
+    if (!fs::exists(dir, error)) {
+        fs::create_directories(dir, error);
+        if (error) {
+            cerr << "Could not create " << dir << ": " << error.message() << endl;
+            return false;
+        }
+    }
+    created_dirs.insert(dir);
+    return true;
+}
+
+
+void ImageWriter::workerLoop() {
+    WriteJob job;
+    while (queue.pop(job)) {
+        // an encoder throwing must not take the thread down, flush() waits on pending
+        bool ok = false;
+        try {
+            ok = ensureDirectory(job.path) && cv::imwrite(job.path, job.image);
+        }
+        catch (const exception& e) {
+            cerr << "Exception while saving " << job.path << ": " << e.what() << endl;
+        }
+        if (!ok) {
+            cerr << "Failed to save: " << job.path << endl;
+        }
+        job.image.release();
+
+        lock_guard<mutex> lock(state_mutex);
+        if (ok) {
+            ++written_count;
+        }
+        else {
+            ++failed_count;
+        }
+        --pending;
+        if (pending == 0) {
+            idle.notify_all();
+        }
+    }
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef IMAGE_WRITER_HPP
+#define IMAGE_WRITER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "bounded_queue.hpp"
+
+namespace mosaic_gen {
+
+// Background image encoder for debug dumps. write() queues a reference to the
+// Mat (no pixel copy) and returns; worker threads encode and save it. The
+// queue is bounded, so write() blocks when the disk falls behind.
+//
+// Because pixels are shared, callers must not modify a queued image in place
+// until flush(). Mosaic stages get a fresh buffer from MosaicWorkspace::prepare
+// while a queued image still holds a reference to the old one.
+class ImageWriter {
+
+    public:
+
+        explicit ImageWriter(int workers = 1, std::size_t queue_capacity = 8);
+        ~ImageWriter();
+
+        ImageWriter(const ImageWriter&) = delete;
+        ImageWriter& operator=(const ImageWriter&) = delete;
+
+        void write(const cv::Mat& image, const std::string& output_path);
+
+        // Wait until every queued image has been written
+        void flush();
+
+        // flush() and stop the workers, later writes are dropped
+        void shutdown();
+
+        std::size_t written() const;
+        std::size_t failed() const;
+
+
+    private:
+
+        struct WriteJob {
+            cv::Mat image;
+            std::string path;
+        };
+
+        void workerLoop();
+        bool ensureDirectory(const std::string& output_path);
+
+        BoundedQueue<WriteJob> queue;
+        std::vector<std::thread> workers;
+
+        mutable std::mutex state_mutex;
+        std::condition_variable idle;
+        std::size_t pending = 0;
+        std::size_t written_count = 0;
+        std::size_t failed_count = 0;
+        std::set<std::string> created_dirs;
+        bool stopped = false;
+
+};
+
+}
+
+#endif
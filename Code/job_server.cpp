@@ -0,0 +1,553 @@
+#include "job_server.hpp"
+#include "image_loader.hpp"
+#include "trace.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace mosaic_gen {
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+double secondsBetween(Clock::time_point start, Clock::time_point end) {
+    return chrono::duration<double>(end - start).count();
+}
+
+bool parseValue(const string& text, string& value) {
+    value = text;
+    return true;
+}
+
+bool parseValue(const string& text, int& value) {
+    char* end = nullptr;
+    const long parsed = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0') {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+bool parseValue(const string& text, double& value) {
+    char* end = nullptr;
+    const double parsed = strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0' || !std::isfinite(parsed)) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+bool parseValue(const string& text, bool& value) {
+    if (text == "1" || text == "true" || text == "on") {
+        value = true;
+        return true;
+    }
+    if (text == "0" || text == "false" || text == "off") {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+bool endsWith(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// send() the whole buffer, without SIGPIPE when the client went away
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Longest request line a connection buffers before giving up on it
+constexpr size_t kMaxLineBytes = 64 * 1024;
+
+
+// One job on a worker's Mosaic; returns the reply after "ok " or throws
+string executeJob(Mosaic& mosaic, const ServerJob& job) {
+    const MosaicParams& params = job.params;
+    LoadedImage loaded = loadImage(job.input_path, params.resize_factor);
+    if (loaded.empty()) {
+        throw runtime_error("could not load " + job.input_path);
+    }
+    mosaic.resetImage(loaded, job.input_path);
+
+    const int tiles = job.use_pyramid ? runPyramidPipeline(mosaic, params, job.pyramid) : runPipeline(mosaic, params);
+    if (tiles < 0 || mosaic.canvas.empty()) {
+        throw runtime_error("no mosaic produced for " + job.input_path);
+    }
+
+    if (!job.output_path.empty() && !cv::imwrite(job.output_path, mosaic.canvas)) {
+        throw runtime_error("could not write " + job.output_path);
+    }
+    if (!job.vector_path.empty()) {
+        VectorExportOptions vector;
+        vector.format = endsWith(job.vector_path, ".pdf") ? VectorFormat::PDF : VectorFormat::SVG;
+        vector.compress = endsWith(job.vector_path, ".svgz");
+        if (vector.compress && !VectorExporter::compressionAvailable()) {
+            throw runtime_error("built without zlib, cannot write " + job.vector_path);
+        }
+        const bool exported = params.tile_mean_color
+            ? mosaic.exportTiles(job.vector_path, vector, params.tile_border_width, params.tile_color_accuracy)
+            : mosaic.exportTiles(job.vector_path, vector, params.tile_border_width);
+        if (!exported) {
+            throw runtime_error("could not write " + job.vector_path);
+        }
+    }
+    if (!job.segments_path.empty() && !mosaic.saveSegments(job.segments_path)) {
+        throw runtime_error("could not write " + job.segments_path);
+    }
+
+    return "tiles=" + to_string(tiles) + " segments=" + to_string(mosaic.segments.size());
+}
+
+}
+
+
+bool parseServerJob(const string& arguments, const ServerJob& defaults, ServerJob& job, string& error) {
+    job = defaults;
+    MosaicParams& p = job.params;
+    double max_angle_deg = p.max_segment_angle_rad * 180.0 / M_PI;
+    int pyramid_levels = job.use_pyramid ? job.pyramid.levels : 0;
+
+    istringstream tokens(arguments);
+    string token;
+    while (tokens >> token) {
+        const size_t equals = token.find('=');
+        if (equals == string::npos) {
+            error = "expected key=value, got " + token;
+            return false;
+        }
+        const string key = token.substr(0, equals);
+        const string value = token.substr(equals + 1);
+
+        bool ok = true;
+        if (key == "input") ok = parseValue(value, job.input_path);
+        else if (key == "output") ok = parseValue(value, job.output_path);
+        else if (key == "vector") ok = parseValue(value, job.vector_path);
+        else if (key == "segments") ok = parseValue(value, job.segments_path);
+        else if (key == "resize") ok = parseValue(value, p.resize_factor) && p.resize_factor > 0.0;
+        else if (key == "blur_kernel") ok = parseValue(value, p.blur_kernel_size) && p.blur_kernel_size > 0;
+        else if (key == "blur_sigma") ok = parseValue(value, p.blur_sigma);
+        else if (key == "canny1") ok = parseValue(value, p.canny_threshold_1);
+        else if (key == "canny2") ok = parseValue(value, p.canny_threshold_2);
+        else if (key == "max_angle_deg") ok = parseValue(value, max_angle_deg);
+        else if (key == "min_length") ok = parseValue(value, p.min_segment_length);
+        else if (key == "angle_window") ok = parseValue(value, p.segment_angle_window);
+        else if (key == "tile_size") ok = parseValue(value, p.tile_size) && p.tile_size > 0;
+        else if (key == "tile_segments") ok = parseValue(value, p.tile_segments);
+        else if (key == "tile_gap") ok = parseValue(value, p.tile_gap);
+        else if (key == "theta_step") ok = parseValue(value, p.tile_theta_step) && p.tile_theta_step > 0;
+        else if (key == "decay") ok = parseValue(value, p.tile_decay_rate);
+        else if (key == "border") ok = parseValue(value, p.tile_border_width);
+        else if (key == "mean_color") ok = parseValue(value, p.tile_mean_color);
+        else if (key == "angle_lookup") ok = parseValue(value, p.tile_angle_lookup);
+        else if (key == "background") ok = parseValue(value, p.fill_background);
+        else if (key == "pyramid") ok = parseValue(value, pyramid_levels);
+        else {
+            error = "unknown key " + key;
+            return false;
+        }
+
+        if (!ok) {
+            error = "bad value for " + key + ": " + value;
+            return false;
+        }
+    }
+
+    if (job.input_path.empty()) {
+        error = "missing input";
+        return false;
+    }
+    p.max_segment_angle_rad = max_angle_deg * M_PI / 180.0;
+    job.use_pyramid = pyramid_levels > 0;
+    if (job.use_pyramid) {
+        job.pyramid.levels = pyramid_levels;
+    }
+    return true;
+}
+
+
+LatencyWindow::LatencyWindow(size_t capacity) : max_samples(max<size_t>(1, capacity)) {
+    samples.reserve(max_samples);
+}
+
+
+void LatencyWindow::add(double seconds) {
+    lock_guard<mutex> lock(sample_mutex);
+    if (samples.size() < max_samples) {
+        samples.push_back(seconds);
+    }
+    else {
+        samples[next] = seconds;
+        next = (next + 1) % samples.size();
+    }
+    total++;
+}
+
+
+double LatencyWindow::percentile(double q) const {
+    vector<double> sorted;
+    {
+        lock_guard<mutex> lock(sample_mutex);
+        sorted = samples;
+    }
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    // nearest rank
+    const size_t rank = static_cast<size_t>(ceil(clamp(q, 0.0, 1.0) * sorted.size()));
+    const size_t index = min(sorted.size() - 1, rank > 0 ? rank - 1 : 0);
+    nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+
+size_t LatencyWindow::count() const {
+    lock_guard<mutex> lock(sample_mutex);
+    return total;
+}
+
+
+struct JobServer::PendingJob {
+    ServerJob job;
+    Clock::time_point admitted;
+    promise<string> reply;
+};
+
+
+JobServer::JobServer(const JobServerOptions& options, const ServerJob& defaults)
+    : options(options), defaults(defaults), queue(options.queue_capacity),
+      wait_latency(options.latency_window), total_latency(options.latency_window) {
+    if (!options.cache_dir.empty()) {
+        disk_cache = make_shared<StageDiskCache>(options.cache_dir);
+    }
+}
+
+
+JobServer::~JobServer() {
+    stop();
+}
+
+
+bool JobServer::start() {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (options.socket_path.empty() || options.socket_path.size() >= sizeof(address.sun_path)) {
+        cerr << "JobServer: socket path must be 1.." << sizeof(address.sun_path) - 1 << " characters" << endl;
+        return false;
+    }
+    strncpy(address.sun_path, options.socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        cerr << "JobServer: socket failed: " << strerror(errno) << endl;
+        return false;
+    }
+    // a socket file left behind by an earlier server would make bind fail
+    ::unlink(options.socket_path.c_str());
+    if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(listen_fd, static_cast<int>(min<size_t>(options.max_connections, SOMAXCONN))) != 0) {
+        cerr << "JobServer: could not listen on " << options.socket_path << ": " << strerror(errno) << endl;
+        ::close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    // Non-blocking so a client that hangs up between poll and accept can't
+    // stall the acceptor; the pipe wakes it on stop() on every platform
+    if (::fcntl(listen_fd, F_SETFL, ::fcntl(listen_fd, F_GETFL) | O_NONBLOCK) != 0 || ::pipe(wake_pipe) != 0) {
+        cerr << "JobServer: could not set up the accept loop: " << strerror(errno) << endl;
+        ::close(listen_fd);
+        ::unlink(options.socket_path.c_str());
+        listen_fd = -1;
+        return false;
+    }
+
+    for (int i = 0; i < max(1, options.workers); ++i) {
+        workers.emplace_back(&JobServer::workerLoop, this);
+    }
+    acceptor = thread(&JobServer::acceptLoop, this);
+    return true;
+}
+
+
+void JobServer::stop() {
+    {
+        lock_guard<mutex> lock(state_mutex);
+        if (stopped) {
+            return;
+        }
+        stopped = true;
+        stop_requested = true;
+    }
+    stopped_signal.notify_all();
+
+    // No new connections. Shutting down a listening socket doesn't wake accept
+    // on macOS and the BSDs, so the acceptor polls a pipe alongside it
+    if (wake_pipe[1] >= 0) {
+        const char wake = 0;
+        while (::write(wake_pipe[1], &wake, 1) < 0 && errno == EINTR) {
+        }
+    }
+    if (acceptor.joinable()) {
+        acceptor.join();
+    }
+    for (int& fd : wake_pipe) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+        ::unlink(options.socket_path.c_str());
+        listen_fd = -1;
+    }
+
+    // Queued jobs still run and answer their clients before connections close
+    queue.close();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    unique_lock<mutex> lock(connection_mutex);
+    for (int fd : connection_fds) {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+    connections_closed.wait(lock, [&] { return connection_fds.empty(); });
+}
+
+
+void JobServer::wait() {
+    unique_lock<mutex> lock(state_mutex);
+    stopped_signal.wait(lock, [&] { return stop_requested; });
+}
+
+
+string JobServer::handle(const string& line) {
+    istringstream in(line);
+    string command;
+    in >> command;
+    string arguments;
+    getline(in, arguments);
+
+    if (command == "run") {
+        return runJob(arguments);
+    }
+    if (command == "stats") {
+        return formatStats();
+    }
+    if (command == "shutdown") {
+        {
+            lock_guard<mutex> lock(state_mutex);
+            stop_requested = true;
+        }
+        stopped_signal.notify_all();
+        return "ok";
+    }
+    return "error unknown command " + command;
+}
+
+
+string JobServer::runJob(const string& arguments) {
+    auto pending = make_shared<PendingJob>();
+    string error;
+    if (!parseServerJob(arguments, defaults, pending->job, error)) {
+        return "error " + error;
+    }
+    {
+        lock_guard<mutex> lock(state_mutex);
+        if (stop_requested) {
+            return "error shutting down";
+        }
+    }
+
+    future<string> reply = pending->reply.get_future();
+    pending->admitted = Clock::now();
+    if (!queue.tryPush(pending)) {
+        rejected++;
+        MOSAIC_TRACE_COUNTER("server_rejected", rejected.load());
+        return "busy queued=" + to_string(queue.size());
+    }
+    return reply.get();
+}
+
+
+void JobServer::workerLoop() {
+    // One warm Mosaic per worker: stage buffers and caches survive between jobs
+    Mosaic mosaic(options.threads_per_job);
+    mosaic.setDiskCache(disk_cache);
+
+    shared_ptr<PendingJob> pending;
+    while (queue.pop(pending)) {
+        const auto start = Clock::now();
+        const double wait_seconds = secondsBetween(pending->admitted, start);
+        wait_latency.add(wait_seconds);
+        running++;
+
+        string reply;
+        try {
+            MOSAIC_TRACE_SCOPE("serverJob");
+            const string result = executeJob(mosaic, pending->job);
+            ostringstream out;
+            out << fixed << setprecision(1) << "ok " << result << " wait_ms=" << wait_seconds * 1e3
+                << " run_ms=" << secondsBetween(start, Clock::now()) * 1e3;
+            reply = out.str();
+            completed++;
+        }
+        catch (const exception& e) {
+            // a bad input or a failed write fails the job, not the server
+            reply = string("error ") + e.what();
+            failed++;
+        }
+        running--;
+
+        total_latency.add(secondsBetween(pending->admitted, Clock::now()));
+        pending->reply.set_value(reply);
+        pending.reset();
+    }
+}
+
+
+void JobServer::acceptLoop() {
+    pollfd watched[2] = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+    while (true) {
+        if (::poll(watched, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "JobServer: poll failed: " << strerror(errno) << endl;
+            break;
+        }
+        if (watched[1].revents != 0) {
+            break;   // woken by stop()
+        }
+        if (watched[0].revents == 0) {
+            continue;
+        }
+
+        const int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            cerr << "JobServer: accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        // BSD sockets inherit O_NONBLOCK from the listener, connections block on recv
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+        lock_guard<mutex> lock(connection_mutex);
+        if (connection_fds.size() >= options.max_connections) {
+            rejected++;
+            sendAll(fd, "busy connections=" + to_string(connection_fds.size()) + "\n");
+            ::close(fd);
+            continue;
+        }
+        connection_fds.insert(fd);
+        thread(&JobServer::connectionLoop, this, fd).detach();
+    }
+}
+
+
+void JobServer::connectionLoop(int fd) {
+    string buffer;
+    char chunk[4096];
+    bool open = true;
+    while (open) {
+        const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+
+        size_t newline;
+        while (open && (newline = buffer.find('\n')) != string::npos) {
+            string line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            open = sendAll(fd, handle(line) + "\n");
+        }
+        if (buffer.size() > kMaxLineBytes) {
+            sendAll(fd, "error request line too long\n");
+            break;
+        }
+    }
+
+    // Closed under the lock, so stop() never shuts down a reused descriptor
+    lock_guard<mutex> lock(connection_mutex);
+    connection_fds.erase(fd);
+    ::close(fd);
+    connections_closed.notify_all();
+}
+
+
+JobServerStats JobServer::stats() const {
+    JobServerStats result;
+    result.queued = queue.size();
+    result.running = running;
+    result.completed = completed;
+    result.failed = failed;
+    result.rejected = rejected;
+    {
+        lock_guard<mutex> lock(connection_mutex);
+        result.connections = connection_fds.size();
+    }
+    result.wait_p50 = wait_latency.percentile(0.50);
+    result.wait_p99 = wait_latency.percentile(0.99);
+    result.total_p50 = total_latency.percentile(0.50);
+    result.total_p90 = total_latency.percentile(0.90);
+    result.total_p99 = total_latency.percentile(0.99);
+    return result;
+}
+
+
+string JobServer::formatStats() const {
+    const JobServerStats s = stats();
+    ostringstream out;
+    out << fixed << setprecision(1)
+        << "queued=" << s.queued << " running=" << s.running << " completed=" << s.completed
+        << " failed=" << s.failed << " rejected=" << s.rejected << " connections=" << s.connections
+        << " wait_p50_ms=" << s.wait_p50 * 1e3 << " wait_p99_ms=" << s.wait_p99 * 1e3
+        << " p50_ms=" << s.total_p50 * 1e3 << " p90_ms=" << s.total_p90 * 1e3 << " p99_ms=" << s.total_p99 * 1e3;
+    return out.str();
+}
+
+}
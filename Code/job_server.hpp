@@ -0,0 +1,164 @@
+#ifndef JOB_SERVER_HPP
+#define JOB_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bounded_queue.hpp"
+#include "pipeline.hpp"
+
+namespace mosaic_gen {
+
+struct JobServerOptions {
+    std::string socket_path = "/tmp/mosaic.sock";
+    int workers = 2;                    // jobs running at once, one warm Mosaic each
+    int threads_per_job = 1;            // Mosaic threads inside each worker
+    std::size_t queue_capacity = 16;    // jobs waiting for a worker, more are refused as busy
+    std::size_t max_connections = 64;   // clients connected at once, more are refused as busy
+    std::size_t latency_window = 4096;  // most recent jobs the percentiles cover
+    std::string cache_dir;              // StageDiskCache shared by the workers, empty = off
+};
+
+
+// One "run" request: the input, what to write, and the parameters
+struct ServerJob {
+    std::string input_path;
+    std::string output_path;     // canvas, format from the extension; empty = don't write
+    std::string vector_path;     // .svg / .svgz / .pdf of the tiles
+    std::string segments_path;   // segment file (segment_file.hpp)
+    MosaicParams params;
+    bool use_pyramid = false;
+    PyramidParams pyramid;
+};
+
+
+// Parse the key=value tokens of a run request on top of defaults. Keys:
+//   input output vector segments resize blur_kernel blur_sigma canny1 canny2
+//   max_angle_deg min_length angle_window tile_size tile_segments tile_gap
+//   theta_step decay border mean_color angle_lookup background pyramid
+// Returns false and sets error on an unknown key or a bad value.
+bool parseServerJob(const std::string& arguments, const ServerJob& defaults, ServerJob& job, std::string& error);
+
+
+// Percentiles over the last capacity samples, safe to share between threads
+class LatencyWindow {
+
+    public:
+
+        explicit LatencyWindow(std::size_t capacity);
+
+        void add(double seconds);
+        double percentile(double q) const;   // q in [0, 1], 0 when empty
+        std::size_t count() const;           // samples ever added
+
+
+    private:
+
+        const std::size_t max_samples;
+        mutable std::mutex sample_mutex;
+        std::vector<double> samples;
+        std::size_t next = 0;
+        std::size_t total = 0;
+
+};
+
+
+struct JobServerStats {
+    std::size_t queued = 0;
+    std::size_t running = 0;
+    std::size_t completed = 0;
+    std::size_t failed = 0;
+    std::size_t rejected = 0;      // refused by admission control
+    std::size_t connections = 0;
+    double wait_p50 = 0.0;         // seconds queued before a worker took the job
+    double wait_p99 = 0.0;
+    double total_p50 = 0.0;        // seconds from admission to reply
+    double total_p90 = 0.0;
+    double total_p99 = 0.0;
+};
+
+
+// Long-running job server on a Unix domain socket. Workers keep their Mosaic
+// (stage buffers, optional disk cache) across jobs, so a job only pays for its
+// own stages. Clients send one request per line and get one reply line:
+//
+//   run input=a.jpg output=a_mosaic.png tile_size=16   ->  ok tiles=.. segments=.. wait_ms=.. run_ms=..
+//                                                       |  busy queued=..  |  error <reason>
+//   stats                                               ->  queued=.. running=.. ... p99_ms=..
+//   shutdown                                            ->  ok  (queued jobs still finish)
+//
+// Admission is a non-blocking push into a bounded queue: when every worker is
+// busy and queue_capacity jobs wait, new jobs are refused straight away instead
+// of piling up, so a client can back off or go to another server.
+class JobServer {
+
+    public:
+
+        JobServer(const JobServerOptions& options, const ServerJob& defaults = ServerJob());
+        ~JobServer();
+
+        JobServer(const JobServer&) = delete;
+        JobServer& operator=(const JobServer&) = delete;
+
+        // Bind the socket and start the workers, false if the socket can't be bound
+        bool start();
+
+        // Stop accepting, finish queued jobs, close connections and join everything
+        void stop();
+
+        // Block until a shutdown request or stop()
+        void wait();
+
+        // Answer one request line, what each connection does per line
+        std::string handle(const std::string& line);
+
+        JobServerStats stats() const;
+
+
+    private:
+
+        struct PendingJob;
+
+        void acceptLoop();
+        void connectionLoop(int fd);
+        void workerLoop();
+        std::string runJob(const std::string& arguments);
+        std::string formatStats() const;
+
+        JobServerOptions options;
+        ServerJob defaults;
+
+        std::shared_ptr<StageDiskCache> disk_cache;
+        BoundedQueue<std::shared_ptr<PendingJob>> queue;
+        std::vector<std::thread> workers;
+        std::thread acceptor;
+        int listen_fd = -1;
+        int wake_pipe[2] = {-1, -1};    // stop() writes here to wake the acceptor's poll
+
+        mutable std::mutex connection_mutex;
+        std::condition_variable connections_closed;
+        std::set<int> connection_fds;   // open connections, each served by a detached thread
+
+        std::mutex state_mutex;
+        std::condition_variable stopped_signal;
+        bool stop_requested = false;
+        bool stopped = false;
+
+        std::atomic<std::size_t> running{0};
+        std::atomic<std::size_t> completed{0};
+        std::atomic<std::size_t> failed{0};
+        std::atomic<std::size_t> rejected{0};
+        LatencyWindow wait_latency;
+        LatencyWindow total_latency;
+
+};
+
+}
+
+#endif
@@ -1,24 +1,33 @@
 #include <iostream>
-#include <chrono>
 #include <cmath>
 #include <opencv2/opencv.hpp>
 #include "image_process.hpp"
 #include "graphics.hpp"
 
 #include "Mosaic.hpp"
+#include "tile_placer.hpp"
+#include "tile_index.hpp"
+#include "image_writer.hpp"
+#include "trace.hpp"
 
 using namespace std;
 namespace fs = std::__fs::filesystem;
 using ImageProcess::ImageState;
 
 using mosaic_gen::Mosaic;
+using mosaic_gen::TilePlacer;
+using mosaic_gen::TilePlacement;
+using mosaic_gen::TileIndex;
+using mosaic_gen::OrientedSquare;
+using mosaic_gen::ImageWriter;
+using mosaic_gen::Tracer;
 
 
 
 
 int main() { 
 
-    auto start = chrono::high_resolution_clock::now();
+    Tracer::instance().enable();
 
     cout << "Hello From Mosaic" << endl;
 
@@ -34,101 +43,149 @@ int main() {
     double MAX_SEGMENT_ANGLE_RAD = 40 * M_PI / 180.0;
     int MIN_SEGMENT_LENGTH = 20;
     int SEGMENT_ANGLE_WINDOW = 10;
-
-
-    // Load Image
-
-    Mosaic my_mosaic(image_path);
-    cout << "Loaded image: " << my_mosaic.image_name << endl;
-    cout << "Original dimensions: " << my_mosaic.original.size() << endl;
-
-    // Resize Image
-
-    my_mosaic.resizeOriginal(RESIZE_FACTOR);
-    my_mosaic.saveImage(my_mosaic.resized, results_dir, "resized");
-    cout << "Resized image to size: " << my_mosaic.resized.size() << endl;
-
-    // Grayscale Image
-    my_mosaic.grayImage();
-    my_mosaic.saveImage(my_mosaic.grayscale, results_dir, "gray");
-
-    // Blur Image
-    my_mosaic.blurImage(BLUR_KERNEL_SIZE, BLUR_SIGMA);
-    my_mosaic.saveImage(my_mosaic.blurred, results_dir, "blurred");
-
-    // Canny Filter
-    my_mosaic.cannyFilter(CANNY_THRESHOLD_1, CANNY_THRESHOLD_2);
-    my_mosaic.saveImage(my_mosaic.edges, results_dir, "canny_edges");
-
-    // Detect Contours
-    int contour_count = my_mosaic.detectContours(MAX_SEGMENT_ANGLE_RAD, MIN_SEGMENT_LENGTH, SEGMENT_ANGLE_WINDOW);
-    my_mosaic.saveImage(my_mosaic.segmented, results_dir, "segmented_edges");
-    cout << "Detedted: " << contour_count << " edges" << endl;
-
-
-    // Rank Segments
-    my_mosaic.rankSegments();
-    my_mosaic.printColorToPixelsK(5);
-    my_mosaic.printColorLengthsK(5);
-
-    // Select Segment
-    my_mosaic.selectSegment(1);
-    my_mosaic.saveImage(my_mosaic.selected_segment, results_dir, "selected_segment");
-
-    // Draw Square
-
-    // mosaic.resizeOriginal(RESIZE_FACTOR);
-
-    // // Load Image
-    // ImageState img_state(image_path);
-    // ImageProcess::saveImage(img_state.original, results_dir, img_state.file_name, "original");
-    // cout << "Loaded image: " << img_state.file_name << endl;
-    // cout << "Original dimensions: " << img_state.original.size() << endl;
-
-    /*
-    // Resize Image
-    ImageProcess::resizeImage(img_state, RESIZE_FACTOR);
-    ImageProcess::saveImage(img_state.resized, results_dir, img_state.file_name, "rescaled");
-    cout << "Resized image to size: " << img_state.resized.size() << endl;
-
-    // Grayscale Image
-    ImageProcess::grayImage(img_state);
-    ImageProcess::saveImage(img_state.grayscale, results_dir, img_state.file_name, "grayscale");
-
-    // Blur Image
-    ImageProcess::blurImage(img_state, BLUR_KERNEL_SIZE, BLUR_SIGMA);
-    ImageProcess::saveImage(img_state.blurred, results_dir, img_state.file_name, "blurred");
-
-    // Canny Filter
-    ImageProcess::cannyFilter(img_state, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2);
-    ImageProcess::saveImage(img_state.edges, results_dir, img_state.file_name, "canny_edges");
-
-    // Detect Contours
-    int contour_count = ImageProcess::detectContours(img_state, MAX_SEGMENT_ANGLE, MIN_SEGMENT_LENGTH, SEGMENT_ANGLE_WINDOW);
-    ImageProcess::saveImage(img_state.segmented, results_dir, img_state.file_name, "segmented");
-    cout << "Found " << contour_count << " contour segments" << endl;
-
-    // Rank Segments
-    ImageProcess::rankSegments(img_state);
-    ImageProcess::printColorToPixelsK(img_state.segment_pixels);
-    ImageProcess::printColorLengthsK(img_state.segment_lengths);
-
-    // Select Segment
-    ImageProcess::selectSegment(img_state, 1);
-    ImageProcess::saveImage(img_state.selected_segment, results_dir, img_state.file_name, "selected_segment");
-
-    // Draw Square
-    img_state.canvas = img_state.selected_segment.clone();
-    cv::Point random_point = ImageProcess::getRandomPointOnSegment(img_state, 1);
-    Graphics::drawSquare(img_state.canvas, random_point, 30, 42, cv::Scalar(0, 0, 255), 5);
-    ImageProcess::saveImage(img_state.canvas, results_dir, img_state.file_name, "canvas");
-
-
-    */
-
-    auto end = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed_time = end - start;
-    cout << "Time to complete: " << elapsed_time.count() << " seconds" << endl;
+    int THREADS = 0; // 0 = one per core
+    int TILE_SIZE = 20;
+    double TILE_DECAY_RATE = 2.0;
+    int TILE_THETA_STEP = 8;
+    double TILE_GAP = 2.0;
+    bool DEBUG_IMAGES = true;
+    int DEBUG_WRITER_THREADS = 2;
+    uint64_t SEED = 0;   // same seed, same random points
+
+
+    {  // whole run, closed before the summary is printed
+        MOSAIC_TRACE_SCOPE("main");
+
+        // Load Image
+
+        // JPEG decodes at RESIZE_FACTOR directly, the full-size original is never kept
+        Mosaic my_mosaic(image_path, mosaic_gen::LoadOptions{RESIZE_FACTOR, false}, THREADS);
+        my_mosaic.setDebugOutput(DEBUG_IMAGES);
+        my_mosaic.setSeed(SEED);
+        my_mosaic.image_writer = make_shared<ImageWriter>(DEBUG_WRITER_THREADS);
+        cout << "Loaded image: " << my_mosaic.image_name << endl;
+        cout << "Original dimensions: " << my_mosaic.source_size << endl;
+
+        // Resize Image (a no-op here, the loader already decoded at this scale)
+
+        my_mosaic.resizeOriginal(RESIZE_FACTOR);
+        my_mosaic.saveImage(my_mosaic.resized, results_dir, "resized");
+        cout << "Resized image to size: " << my_mosaic.resized.size() << endl;
+
+        // Grayscale Image
+        my_mosaic.grayImage();
+        my_mosaic.saveImage(my_mosaic.grayscale, results_dir, "gray");
+
+        // Blur Image
+        my_mosaic.blurImage(BLUR_KERNEL_SIZE, BLUR_SIGMA);
+        my_mosaic.saveImage(my_mosaic.blurred, results_dir, "blurred");
+
+        // Canny Filter
+        my_mosaic.cannyFilter(CANNY_THRESHOLD_1, CANNY_THRESHOLD_2);
+        my_mosaic.saveImage(my_mosaic.edges, results_dir, "canny_edges");
+
+        // Detect Contours
+        int contour_count = my_mosaic.detectContours(MAX_SEGMENT_ANGLE_RAD, MIN_SEGMENT_LENGTH, SEGMENT_ANGLE_WINDOW);
+        my_mosaic.paintSegments();
+        my_mosaic.saveImage(my_mosaic.segmented, results_dir, "segmented_edges");
+        cout << "Detedted: " << contour_count << " edges" << endl;
+
+
+        // Rank Segments
+        my_mosaic.rankSegments();
+        my_mosaic.printSegmentPixelsK(5);
+        my_mosaic.printSegmentLengthsK(5);
+
+        // Select Segment
+        my_mosaic.selectSegment(1);
+        my_mosaic.saveImage(my_mosaic.selected_segment, results_dir, "selected_segment");
+
+        // Place Tile
+        TilePlacer placer(TILE_DECAY_RATE);
+        placer.setGuide(my_mosaic.selected_segment);
+        TileIndex placed_tiles(my_mosaic.selected_segment.size(), TILE_SIZE + TILE_GAP, TILE_GAP);
+
+        cv::Point seed = my_mosaic.getRandomPointOnSegment(1);
+        TilePlacement tile = placer.findBestTheta(seed, TILE_SIZE, -45, 45, TILE_THETA_STEP,
+            [&](const cv::Point& center, int size, int theta) {
+                return !placed_tiles.overlaps(OrientedSquare(center, size, -theta));
+            });
+        cout << "Tile at " << tile.center << " theta: " << tile.theta_deg << " (" << tile.evaluations << " angles scored)" << endl;
+
+        if (tile.valid) { 
+            placed_tiles.insert(OrientedSquare(tile.center, tile.size, tile.squareAngleDeg()));
+        }
+        placed_tiles.renderMask(my_mosaic.mask);
+        my_mosaic.saveImage(my_mosaic.mask, results_dir, "mask");
+
+        // Draw Square
+        my_mosaic.canvas = my_mosaic.selected_segment.clone();
+        if (tile.valid) { 
+            Graphics::drawSquare(my_mosaic.canvas, tile.center, tile.size, tile.squareAngleDeg(), cv::Scalar(0, 255, 0), 5);
+        }
+        my_mosaic.saveImage(my_mosaic.canvas, results_dir, "canvas");
+
+        // mosaic.resizeOriginal(RESIZE_FACTOR);
+
+        // // Load Image
+        // ImageState img_state(image_path);
+        // ImageProcess::saveImage(img_state.original, results_dir, img_state.file_name, "original");
+        // cout << "Loaded image: " << img_state.file_name << endl;
+        // cout << "Original dimensions: " << img_state.original.size() << endl;
+
+        /*
+        // Resize Image
+        ImageProcess::resizeImage(img_state, RESIZE_FACTOR);
+        ImageProcess::saveImage(img_state.resized, results_dir, img_state.file_name, "rescaled");
+        cout << "Resized image to size: " << img_state.resized.size() << endl;
+
+        // Grayscale Image
+        ImageProcess::grayImage(img_state);
+        ImageProcess::saveImage(img_state.grayscale, results_dir, img_state.file_name, "grayscale");
+
+        // Blur Image
+        ImageProcess::blurImage(img_state, BLUR_KERNEL_SIZE, BLUR_SIGMA);
+        ImageProcess::saveImage(img_state.blurred, results_dir, img_state.file_name, "blurred");
+
+        // Canny Filter
+        ImageProcess::cannyFilter(img_state, CANNY_THRESHOLD_1, CANNY_THRESHOLD_2);
+        ImageProcess::saveImage(img_state.edges, results_dir, img_state.file_name, "canny_edges");
+
+        // Detect Contours
+        int contour_count = ImageProcess::detectContours(img_state, MAX_SEGMENT_ANGLE, MIN_SEGMENT_LENGTH, SEGMENT_ANGLE_WINDOW);
+        ImageProcess::saveImage(img_state.segmented, results_dir, img_state.file_name, "segmented");
+        cout << "Found " << contour_count << " contour segments" << endl;
+
+        // Rank Segments
+        ImageProcess::rankSegments(img_state);
+        ImageProcess::printColorToPixelsK(img_state.segment_pixels);
+        ImageProcess::printColorLengthsK(img_state.segment_lengths);
+
+        // Select Segment
+        ImageProcess::selectSegment(img_state, 1);
+        ImageProcess::saveImage(img_state.selected_segment, results_dir, img_state.file_name, "selected_segment");
+
+        // Draw Square
+        img_state.canvas = img_state.selected_segment.clone();
+        cv::Point random_point = ImageProcess::getRandomPointOnSegment(img_state, 1);
+        Graphics::drawSquare(img_state.canvas, random_point, 30, 42, cv::Scalar(0, 0, 255), 5);
+        ImageProcess::saveImage(img_state.canvas, results_dir, img_state.file_name, "canvas");
+
+
+        */
+
+        // Wait for the queued debug images before closing the run span
+        {
+            MOSAIC_TRACE_SCOPE("flushDebugImages");
+            my_mosaic.image_writer->flush();
+        }
+    }
+
+    // Open in chrome://tracing or ui.perfetto.dev
+    Tracer::instance().printSummary(cout);
+    if (Tracer::instance().writeChromeTrace(results_dir + "/trace.json")) {
+        cout << "Trace written to: " << results_dir << "/trace.json" << endl;
+    }
 
     return 0;
 }
\ No newline at end of file
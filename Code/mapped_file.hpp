@@ -0,0 +1,57 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mosaic_gen {
+
+// Read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+
+    public:
+
+        explicit MappedFile(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return;
+            }
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    addr = mapped;
+                    length = static_cast<size_t>(st.st_size);
+                }
+            }
+            ::close(fd);
+        }
+
+        ~MappedFile() {
+            if (addr) {
+                ::munmap(addr, length);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* data() const { return static_cast<const unsigned char*>(addr); }
+        size_t size() const { return length; }
+        bool valid() const { return addr != nullptr; }
+
+
+    private:
+
+        void* addr = nullptr;
+        size_t length = 0;
+
+};
+
+}
+
+#endif
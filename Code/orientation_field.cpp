@@ -0,0 +1,102 @@
+#include "orientation_field.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace mosaic_gen {
+
+void OrientationField::clear() {
+    angle.release();
+    coherence.release();
+    distance.release();
+}
+
+
+std::size_t OrientationField::memoryBytes() const {
+    return angle.total() * angle.elemSize() + coherence.total() * coherence.elemSize() + distance.total() * distance.elemSize();
+}
+
+
+int OrientationField::tileThetaDeg(const cv::Point& p) const {
+    // 256 steps per 180 degrees, so a quarter turn is 128 steps
+    const int q = angle.at<uchar>(p);
+    const int folded = ((q + 64) & 127) - 64;
+    return static_cast<int>(std::lround(folded * (180.0 / 256.0)));
+}
+
+
+void OrientationField::build(const cv::Mat& gray, const cv::Mat& edges, const OrientationOptions& options, int threads) {
+    if (gray.empty() || gray.type() != CV_8UC1 || edges.size() != gray.size()) {
+        std::cerr << "OrientationField needs a CV_8UC1 image and edges of the same size" << std::endl;
+        clear();
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("OrientationField::build");
+    const int rows = gray.rows;
+    angle.create(gray.size(), CV_8UC1);
+    coherence.create(gray.size(), CV_8UC1);
+
+    // Gaussian support plus the Sobel radius, so band seams match a whole-frame run
+    const int gauss_radius = std::max(1, static_cast<int>(std::ceil(3.0 * options.tensor_sigma)));
+    const cv::Size gauss_size(2 * gauss_radius + 1, 2 * gauss_radius + 1);
+    const int halo = gauss_radius + options.sobel_size / 2;
+
+    const int band_rows = std::max(64, rows / (4 * resolveThreadCount(threads)));
+    const int band_count = (rows + band_rows - 1) / band_rows;
+
+    parallelFor(band_count, threads, [&](size_t band) {
+        const int r0 = static_cast<int>(band) * band_rows;
+        const int r1 = std::min(rows, r0 + band_rows);
+        const int h0 = std::max(0, r0 - halo);
+        const int h1 = std::min(rows, r1 + halo);
+
+        // Sobel on a view reads real pixels past the view, like the whole frame would
+        const cv::Mat src = gray.rowRange(h0, h1);
+        cv::Mat gx, gy;
+        cv::Sobel(src, gx, CV_32F, 1, 0, options.sobel_size);
+        cv::Sobel(src, gy, CV_32F, 0, 1, options.sobel_size);
+
+        cv::Mat jxx, jyy, jxy;
+        cv::multiply(gx, gx, jxx);
+        cv::multiply(gy, gy, jyy);
+        cv::multiply(gx, gy, jxy);
+        cv::GaussianBlur(jxx, jxx, gauss_size, options.tensor_sigma);
+        cv::GaussianBlur(jyy, jyy, gauss_size, options.tensor_sigma);
+        cv::GaussianBlur(jxy, jxy, gauss_size, options.tensor_sigma);
+
+        const float to_steps = static_cast<float>(256.0 / M_PI);
+        for (int y = r0; y < r1; ++y) {
+            const float* xx = jxx.ptr<float>(y - h0);
+            const float* yy = jyy.ptr<float>(y - h0);
+            const float* xy = jxy.ptr<float>(y - h0);
+            uchar* a = angle.ptr<uchar>(y);
+            uchar* c = coherence.ptr<uchar>(y);
+            for (int x = 0; x < gray.cols; ++x) {
+                const float diff = xx[x] - yy[x];
+                const float trace = xx[x] + yy[x];
+                const float spread = std::sqrt(diff * diff + 4.0f * xy[x] * xy[x]);
+
+                // gradient at phi = atan2(2 jxy, jxx - jyy) / 2; with y pointing
+                // down the edge then runs along (cos, -sin) of pi/2 - phi
+                const float phi = 0.5f * std::atan2(2.0f * xy[x], diff);
+                const float theta = static_cast<float>(M_PI / 2) - phi;
+                a[x] = static_cast<uchar>(static_cast<int>(std::lround(theta * to_steps)) & 255);
+                c[x] = trace > 1e-6f ? cv::saturate_cast<uchar>(255.0f * spread / trace) : 0;
+            }
+        }
+    });
+
+    // Distance to the nearest edge: distanceTransform measures to zero pixels
+    cv::Mat background, exact;
+    cv::compare(edges, 0, background, cv::CMP_EQ);
+    cv::distanceTransform(background, exact, cv::DIST_L2, cv::DIST_MASK_PRECISE);
+    exact.convertTo(distance, CV_16U, 8.0);
+
+    MOSAIC_TRACE_MEMORY("orientation_field", memoryBytes());
+}
+
+}
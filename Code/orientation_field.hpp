@@ -0,0 +1,60 @@
+#ifndef ORIENTATION_FIELD_HPP
+#define ORIENTATION_FIELD_HPP
+
+#include <cstddef>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+struct OrientationOptions {
+    int sobel_size = 3;
+    double tensor_sigma = 2.0;   // smoothing of the structure tensor, sets the scale an orientation describes
+};
+
+
+// Per-pixel edge guidance built once from blurred and edges:
+//
+//   angle      CV_8U  dominant edge direction, 256 steps over 180 degrees
+//   coherence  CV_8U  (l1 - l2) / (l1 + l2) of the smoothed structure tensor, 0..255
+//   distance   CV_16U distance to the nearest edge pixel in 1/8 px (saturates at 8191 px)
+//
+// Angles follow TilePlacement: a direction theta runs along (cos, -sin) in
+// image coordinates, so tileThetaDeg is what TilePlacer would search for.
+// The tensor is filtered in row bands with a halo on parallelFor, so the
+// result does not depend on the thread count.
+class OrientationField {
+
+    public:
+
+        // gray CV_8UC1 (blurred), edges CV_8UC1 nonzero = edge; threads <= 0 uses every core
+        void build(const cv::Mat& gray, const cv::Mat& edges, const OrientationOptions& options, int threads = 1);
+        void clear();
+        bool empty() const { return angle.empty(); }
+        std::size_t memoryBytes() const;
+
+        // Edge direction in [0, 180) degrees
+        float directionDeg(const cv::Point& p) const {
+            return angle.at<uchar>(p) * (180.0f / 256.0f);
+        }
+
+        // The direction folded into a square's period, [-45, 45)
+        int tileThetaDeg(const cv::Point& p) const;
+
+        // 0 for flat or isotropic neighbourhoods, 1 for a single clean edge
+        float coherenceAt(const cv::Point& p) const {
+            return coherence.at<uchar>(p) / 255.0f;
+        }
+
+        float edgeDistance(const cv::Point& p) const {
+            return distance.at<uint16_t>(p) / 8.0f;
+        }
+
+        cv::Mat angle;
+        cv::Mat coherence;
+        cv::Mat distance;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace mosaic_gen {
+
+// threads <= 0 means one per hardware core
+inline int resolveThreadCount(int threads) {
+    if (threads > 0) {
+        return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+// Run fn(task) for every task in [0, task_count) on up to `threads` workers.
+// Tasks are handed out dynamically, so callers that need deterministic output
+// should write into per-task buffers and merge them in task order afterwards.
+template <typename Fn>
+void parallelFor(std::size_t task_count, int threads, Fn&& fn) {
+    const std::size_t worker_count = std::min<std::size_t>(resolveThreadCount(threads), task_count);
+
+    if (worker_count <= 1) {
+        for (std::size_t task = 0; task < task_count; ++task) fn(task);
+        return;
+    }
+
+    std::atomic<std::size_t> next_task{0};
+    auto worker = [&]() {
+        for (std::size_t task = next_task++; task < task_count; task = next_task++) {
+            fn(task);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(worker_count - 1);
+    for (std::size_t i = 0; i + 1 < worker_count; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+}
+
+#endif
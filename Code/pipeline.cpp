@@ -0,0 +1,310 @@
+#include "pipeline.hpp"
+#include "parallel.hpp"
+#include "stage_cache.hpp"
+#include "trace.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <tuple>
+
+namespace mosaic_gen {
+
+namespace {
+
+// Replace sets by one copy per value of the axis
+template <typename T>
+void expandAxis(std::vector<MosaicParams>& sets, const std::vector<T>& values, T MosaicParams::*field) {
+    if (values.empty()) {
+        return;
+    }
+    std::vector<MosaicParams> expanded;
+    expanded.reserve(sets.size() * values.size());
+    for (const auto& set : sets) {
+        for (const T& value : values) {
+            expanded.push_back(set);
+            expanded.back().*field = value;
+        }
+    }
+    sets.swap(expanded);
+}
+
+// Stage parameters in chain order, so sorting groups shared prefixes
+auto stageOrder(const MosaicParams& p) {
+    return std::make_tuple(p.resize_factor, p.blur_kernel_size, p.blur_sigma,
+                           p.canny_threshold_1, p.canny_threshold_2,
+                           p.max_segment_angle_rad, p.min_segment_length, p.segment_angle_window,
+                           p.tile_size, p.tile_segments, p.tile_gap, p.tile_theta_step, p.tile_decay_rate,
+                           p.tile_border_width);
+}
+
+
+// Every parameter that shapes edges, segments and rankings, for Mosaic::loadStages
+uint64_t edgeStagesKey(const MosaicParams& p) {
+    return hashValues(hashBytes("single", 6), {p.resize_factor, double(p.blur_kernel_size), p.blur_sigma,
+                                               double(p.canny_threshold_1), double(p.canny_threshold_2),
+                                               p.max_segment_angle_rad, double(p.min_segment_length),
+                                               double(p.segment_angle_window)});
+}
+
+uint64_t edgeStagesKey(const MosaicParams& p, const PyramidParams& pyramid) {
+    const uint64_t base = edgeStagesKey(p);
+    return hashValues(hashBytes(&base, sizeof(base), hashBytes("pyramid", 7)),
+                      {double(pyramid.levels), double(pyramid.cell_size), double(pyramid.halo)});
+}
+
+
+// Small tiles where edges are dense, large ones where they are sparse
+cv::Mat densityTileSizes(const cv::Mat& edges, int cell, const PyramidParams& pyramid) {
+    const int window = std::max(cell, pyramid.density_cell);
+    const cv::Size density_grid((edges.cols + window - 1) / window, (edges.rows + window - 1) / window);
+    cv::Mat density;
+    cv::resize(edges, density, density_grid, 0, 0, cv::INTER_AREA);
+    cv::Mat sizes(density_grid, CV_32F);
+    for (int y = 0; y < density.rows; ++y) {
+        const uchar* d = density.ptr<uchar>(y);
+        float* s = sizes.ptr<float>(y);
+        for (int x = 0; x < density.cols; ++x) {
+            const double t = std::min(1.0, d[x] / 255.0 / std::max(1e-6, pyramid.dense_fraction));
+            s[x] = static_cast<float>(pyramid.max_tile_size - t * (pyramid.max_tile_size - pyramid.min_tile_size));
+        }
+    }
+    cv::Mat tile_sizes;
+    cv::resize(sizes, sizes, edges.size(), 0, 0, cv::INTER_LINEAR);
+    sizes.convertTo(tile_sizes, CV_8U);
+    return tile_sizes;
+}
+
+
+// The orientation field reads blurred. The per-cell pyramid blur leaves
+// inactive cells unblurred and isn't in the disk cache, so cold and warm runs
+// both give the field a whole-frame blur and place the same tiles.
+void wholeFrameBlur(Mosaic& mosaic, const MosaicParams& params) {
+    mosaic.grayImage();
+    mosaic.blurImage(params.blur_kernel_size, params.blur_sigma);
+}
+
+
+// One level's blur + Canny, computed only on the active cells. Runs of
+// neighbouring active cells in a cell row are one task, read with a halo so
+// the blur and most of Canny's hysteresis see the same pixels as a whole-frame
+// run. Inactive cells keep the gray value as "blurred" and have no edges.
+void refineLevel(const cv::Mat& gray, const cv::Mat& active, int cell, int halo, const MosaicParams& params,
+                 int kernel_size, int threads, cv::Mat& blurred, cv::Mat& edges) {
+    gray.copyTo(blurred);
+    edges.create(gray.size(), CV_8UC1);
+    edges.setTo(cv::Scalar::all(0));
+
+    std::vector<cv::Rect> runs;
+    for (int cy = 0; cy < active.rows; ++cy) {
+        const uchar* row = active.ptr<uchar>(cy);
+        for (int cx = 0; cx < active.cols;) {
+            if (!row[cx]) {
+                ++cx;
+                continue;
+            }
+            const int start = cx;
+            while (cx < active.cols && row[cx]) ++cx;
+            const cv::Rect run(start * cell, cy * cell, (cx - start) * cell, cell);
+            runs.push_back(run & cv::Rect(0, 0, gray.cols, gray.rows));
+        }
+    }
+
+    parallelFor(runs.size(), threads, [&](size_t i) {
+        const cv::Rect& run = runs[i];
+        const cv::Rect outer = cv::Rect(run.x - halo, run.y - halo, run.width + 2 * halo, run.height + 2 * halo)
+                             & cv::Rect(0, 0, gray.cols, gray.rows);
+        const cv::Rect inner(run.x - outer.x, run.y - outer.y, run.width, run.height);
+
+        cv::Mat local_blurred, local_edges;
+        cv::GaussianBlur(gray(outer), local_blurred, cv::Size(kernel_size, kernel_size), params.blur_sigma);
+        cv::Canny(local_blurred, local_edges, params.canny_threshold_1, params.canny_threshold_2);
+        local_blurred(inner).copyTo(blurred(run));
+        local_edges(inner).copyTo(edges(run));
+    });
+}
+
+}
+
+
+int placeAndRender(Mosaic& mosaic, const MosaicParams& params, const cv::Mat& tile_sizes) {
+    mosaic.setAngleLookup(params.tile_angle_lookup, params.tile_angle_refine);
+    if (params.tile_angle_lookup) {
+        mosaic.buildOrientationField();
+    }
+
+    int tile_count = tile_sizes.empty()
+        ? mosaic.placeTiles(params.tile_size, params.tile_segments, params.tile_gap, params.tile_theta_step, params.tile_decay_rate)
+        : mosaic.placeTiles(tile_sizes, params.tile_segments, params.tile_gap, params.tile_theta_step, params.tile_decay_rate);
+    if (params.fill_background) {
+        tile_count += std::max(0, mosaic.fillBackground(params.background, params.tile_gap));
+    }
+    if (params.tile_mean_color) {
+        mosaic.renderCanvas(params.tile_border_width, params.tile_color_accuracy);
+    }
+    else {
+        mosaic.renderCanvas(params.tile_border_width);
+    }
+    return tile_count;
+}
+
+
+int runPipeline(Mosaic& mosaic, const MosaicParams& params) {
+    if (mosaic.original.empty() && mosaic.resized.empty()) {
+        return -1;
+    }
+
+    mosaic.resizeOriginal(params.resize_factor);
+    if (mosaic.resized.empty()) {
+        return -1;
+    }
+
+    const uint64_t cache_key = edgeStagesKey(params);
+    if (mosaic.loadStages(cache_key)) {
+        // the orientation field still reads blurred, which the disk cache doesn't keep
+        if (params.tile_angle_lookup) {
+            mosaic.grayImage();
+            mosaic.blurImage(params.blur_kernel_size, params.blur_sigma);
+        }
+        return placeAndRender(mosaic, params, cv::Mat());
+    }
+
+    mosaic.grayImage();
+    mosaic.blurImage(params.blur_kernel_size, params.blur_sigma);
+    mosaic.cannyFilter(params.canny_threshold_1, params.canny_threshold_2);
+
+    if (mosaic.detectContours(params.max_segment_angle_rad, params.min_segment_length, params.segment_angle_window) <= 0) {
+        return -1;
+    }
+    mosaic.rankSegments();
+    mosaic.saveStages(cache_key);
+
+    return placeAndRender(mosaic, params, cv::Mat());
+}
+
+
+int runPyramidPipeline(Mosaic& mosaic, const MosaicParams& params, const PyramidParams& pyramid, PyramidStats* stats) {
+    if (mosaic.original.empty() && mosaic.resized.empty()) {
+        return -1;
+    }
+
+    MOSAIC_TRACE_SCOPE("runPyramidPipeline");
+    mosaic.resizeOriginal(params.resize_factor);
+    if (mosaic.resized.empty()) {
+        return -1;
+    }
+
+    const int cell = std::max(8, pyramid.cell_size);
+    const uint64_t cache_key = edgeStagesKey(params, pyramid);
+    if (mosaic.loadStages(cache_key)) {
+        if (stats) {
+            *stats = PyramidStats();
+        }
+        if (params.tile_angle_lookup) {
+            wholeFrameBlur(mosaic, params);
+        }
+        return placeAndRender(mosaic, params, densityTileSizes(mosaic.edges, cell, pyramid));
+    }
+
+    mosaic.grayImage();
+    const int kernel_size = params.blur_kernel_size | 1;
+
+    // gray[0] is the working resolution, every level above halves it
+    std::vector<cv::Mat> gray = {mosaic.grayscale};
+    while (static_cast<int>(gray.size()) < std::max(1, pyramid.levels)
+           && std::min(gray.back().cols, gray.back().rows) >= 4 * cell) {
+        cv::Mat down;
+        cv::pyrDown(gray.back(), down);
+        gray.push_back(down);
+    }
+
+    PyramidStats local_stats;
+    local_stats.active_fraction.assign(gray.size(), 1.0);
+
+    cv::Mat blurred, edges;
+    for (int level = static_cast<int>(gray.size()) - 1; level >= 0; --level) {
+        MOSAIC_TRACE_SCOPE("pyramidLevel");
+        const cv::Size grid((gray[level].cols + cell - 1) / cell, (gray[level].rows + cell - 1) / cell);
+
+        // Coarsest level runs everywhere, the others only around the coarser edges
+        cv::Mat active(grid, CV_8UC1, cv::Scalar::all(255));
+        if (!edges.empty()) {
+            // float, so a single edge pixel in a cell doesn't round away
+            cv::Mat coarse_edges, coarse_density;
+            edges.convertTo(coarse_edges, CV_32F);
+            cv::resize(coarse_edges, coarse_density, grid, 0, 0, cv::INTER_AREA);
+            cv::compare(coarse_density, 0, active, cv::CMP_GT);
+            cv::dilate(active, active, cv::Mat());
+        }
+        local_stats.active_fraction[level] = cv::countNonZero(active) / static_cast<double>(grid.area());
+
+        refineLevel(gray[level], active, cell, pyramid.halo, params, kernel_size, mosaic.threads, blurred, edges);
+    }
+
+    // The edges skip the blur / Canny stages, so their cache keys no longer hold
+    mosaic.blurred = blurred;
+    mosaic.edges = edges;
+    mosaic.invalidateStages();
+
+    if (stats) {
+        *stats = local_stats;
+    }
+
+    if (mosaic.detectContours(params.max_segment_angle_rad, params.min_segment_length, params.segment_angle_window) <= 0) {
+        return -1;
+    }
+    mosaic.rankSegments();
+    mosaic.saveStages(cache_key);
+
+    if (params.tile_angle_lookup) {
+        wholeFrameBlur(mosaic, params);
+    }
+    return placeAndRender(mosaic, params, densityTileSizes(edges, cell, pyramid));
+}
+
+
+std::vector<MosaicParams> MosaicParamGrid::expand() const {
+    std::vector<MosaicParams> sets = {base};
+    expandAxis(sets, resize_factor, &MosaicParams::resize_factor);
+    expandAxis(sets, blur_kernel_size, &MosaicParams::blur_kernel_size);
+    expandAxis(sets, blur_sigma, &MosaicParams::blur_sigma);
+    expandAxis(sets, canny_threshold_1, &MosaicParams::canny_threshold_1);
+    expandAxis(sets, canny_threshold_2, &MosaicParams::canny_threshold_2);
+    expandAxis(sets, max_segment_angle_rad, &MosaicParams::max_segment_angle_rad);
+    expandAxis(sets, min_segment_length, &MosaicParams::min_segment_length);
+    expandAxis(sets, segment_angle_window, &MosaicParams::segment_angle_window);
+    expandAxis(sets, tile_size, &MosaicParams::tile_size);
+    expandAxis(sets, tile_decay_rate, &MosaicParams::tile_decay_rate);
+    return sets;
+}
+
+
+std::vector<SweepResult> runSweep(Mosaic& mosaic, const std::vector<MosaicParams>& param_sets, bool keep_canvas) {
+    MOSAIC_TRACE_SCOPE("runSweep");
+
+    std::vector<size_t> order(param_sets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return stageOrder(param_sets[a]) < stageOrder(param_sets[b]);
+    });
+
+    std::vector<SweepResult> results(param_sets.size());
+    for (size_t i : order) {
+        SweepResult& result = results[i];
+        result.params = param_sets[i];
+
+        auto start = std::chrono::steady_clock::now();
+        result.tiles = runPipeline(mosaic, result.params);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.segments = mosaic.segments.size();
+
+        // renderCanvas allocates a fresh canvas per run, so sharing it is safe
+        if (keep_canvas && result.tiles >= 0) {
+            result.canvas = mosaic.canvas;
+        }
+    }
+    return results;
+}
+
+}
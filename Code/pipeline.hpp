@@ -0,0 +1,110 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <cmath>
+#include <vector>
+#include "Mosaic.hpp"
+
+namespace mosaic_gen {
+
+// Every knob of the Mosaic stage chain, defaults match main.cpp
+struct MosaicParams {
+    double resize_factor = 0.8;
+    int blur_kernel_size = 3;
+    double blur_sigma = 1.4;
+    int canny_threshold_1 = 50;
+    int canny_threshold_2 = 100;
+    double max_segment_angle_rad = 40 * M_PI / 180.0;
+    int min_segment_length = 20;
+    int segment_angle_window = 10;
+
+    int tile_size = 20;
+    int tile_segments = 200;   // longest segments to tile, <= 0 for all
+    double tile_gap = 2.0;
+    int tile_theta_step = 8;
+    double tile_decay_rate = 2.0;
+    int tile_border_width = 3;
+    bool tile_angle_lookup = false;   // angles from the orientation field instead of a full search
+    int tile_angle_refine = 4;        // degrees searched around the looked up angle
+    bool tile_mean_color = false;   // mean color under the tile instead of the center pixel
+    ColorAccuracy tile_color_accuracy = ColorAccuracy::EXACT;
+
+    bool fill_background = false;   // Poisson-disk tiles in the gaps placeTiles leaves
+    PoissonOptions background;
+};
+
+
+// Run resize through renderCanvas on an already loaded Mosaic.
+// Returns the number of placed tiles, or -1 if a stage had nothing to work on.
+// With a disk cache on the Mosaic (setDiskCache) a warm run loads edges through
+// rankSegments and skips gray / blur / Canny / contours, a cold one stores them.
+int runPipeline(Mosaic& mosaic, const MosaicParams& params);
+
+// The stages after rankSegments: orientation field, placeTiles, fillBackground
+// and renderCanvas. tile_sizes, when not empty, overrides params.tile_size per seed.
+int placeAndRender(Mosaic& mosaic, const MosaicParams& params, const cv::Mat& tile_sizes = cv::Mat());
+
+
+// Coarse-to-fine edges: blur + Canny run on the whole coarsest level, then at
+// each finer level only on the cells next to edges found one level up, so their
+// cost follows the amount of structure. Tile sizes then follow the local edge
+// density of the finest level.
+struct PyramidParams {
+    int levels = 3;              // 1 is a plain single-scale run
+    int cell_size = 32;          // refinement block at every level, px
+    int halo = 8;                // pixels read around a block for the blur and Canny hysteresis
+    int density_cell = 64;       // window of the edge density that picks tile sizes, px
+    double dense_fraction = 0.08;   // edge share that gets min_tile_size
+    int min_tile_size = 10;
+    int max_tile_size = 32;
+};
+
+
+struct PyramidStats {
+    std::vector<double> active_fraction;   // share of cells refined per level, finest first
+};
+
+
+// runPipeline with PyramidParams edges and adaptive tile sizes (params.tile_size
+// is ignored). Edges can differ from a single-scale run near cells whose
+// coarse parent had no edges. Disk cache hits leave stats empty. With
+// tile_angle_lookup the orientation field reads a whole-frame blur, cached or not.
+int runPyramidPipeline(Mosaic& mosaic, const MosaicParams& params, const PyramidParams& pyramid, PyramidStats* stats = nullptr);
+
+
+// Values to try per knob, an empty axis keeps the base value
+struct MosaicParamGrid {
+    MosaicParams base;
+    std::vector<double> resize_factor;
+    std::vector<int> blur_kernel_size;
+    std::vector<double> blur_sigma;
+    std::vector<int> canny_threshold_1;
+    std::vector<int> canny_threshold_2;
+    std::vector<double> max_segment_angle_rad;
+    std::vector<int> min_segment_length;
+    std::vector<int> segment_angle_window;
+    std::vector<int> tile_size;
+    std::vector<double> tile_decay_rate;
+
+    // Cartesian product of every axis
+    std::vector<MosaicParams> expand() const;
+};
+
+
+struct SweepResult {
+    MosaicParams params;
+    int tiles = -1;
+    int segments = 0;
+    double seconds = 0.0;
+    cv::Mat canvas;      // only kept when asked for
+};
+
+
+// Run every parameter set on one loaded Mosaic. Sets sharing a stage prefix are
+// run back to back, so the Mosaic stage cache only recomputes what changed.
+// Results are returned in the order of param_sets.
+std::vector<SweepResult> runSweep(Mosaic& mosaic, const std::vector<MosaicParams>& param_sets, bool keep_canvas = false);
+
+}
+
+#endif
@@ -0,0 +1,186 @@
+#include "point_sampler.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_map>
+
+namespace mosaic_gen {
+
+uint64_t mixSeed(uint64_t seed, uint64_t stream) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull * (stream + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+namespace {
+
+// Accepted points bucketed by cells of min_spacing, so a spacing check only
+// looks at the 3x3 cells around a candidate
+class SpacingGrid {
+
+    public:
+
+        explicit SpacingGrid(double min_spacing) : spacing(min_spacing), spacing2(min_spacing * min_spacing) {}
+
+        bool accepts(const cv::Point& p) const {
+            const int cx = cellOf(p.x);
+            const int cy = cellOf(p.y);
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    auto it = cells.find(key(cx + dx, cy + dy));
+                    if (it == cells.end()) {
+                        continue;
+                    }
+                    for (const cv::Point& q : it->second) {
+                        const double ddx = p.x - q.x;
+                        const double ddy = p.y - q.y;
+                        if (ddx * ddx + ddy * ddy < spacing2) {
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
+        }
+
+        void insert(const cv::Point& p) {
+            cells[key(cellOf(p.x), cellOf(p.y))].push_back(p);
+        }
+
+
+    private:
+
+        int cellOf(int v) const { return static_cast<int>(std::floor(v / spacing)); }
+        static uint64_t key(int cx, int cy) { return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy); }
+
+        double spacing;
+        double spacing2;
+        std::unordered_map<uint64_t, std::vector<cv::Point>> cells;
+
+};
+
+}
+
+
+SegmentSampler::SegmentSampler(const SegmentStore& segments) {
+    points.reserve(segments.totalPoints());
+    cumulative.reserve(segments.totalPoints());
+    for (int id = 0; id < segments.size(); ++id) {
+        addSegment(segments, id);
+    }
+}
+
+
+SegmentSampler::SegmentSampler(const SegmentStore& segments, const std::vector<int>& ids) {
+    for (int id : ids) {
+        addSegment(segments, id);
+    }
+}
+
+
+void SegmentSampler::addSegment(const SegmentStore& segments, int id) {
+    double length = totalLength();
+    ids.push_back(id);
+    segment_start.push_back(length);
+
+    // The first point carries a unit weight, every later one the step that reaches it
+    bool first = true;
+    int px = 0, py = 0;
+    segments.forEachPoint(id, [&](int x, int y) {
+        const int dx = std::abs(x - px);
+        const int dy = std::abs(y - py);
+        length += first ? 1.0 : (dx && dy ? M_SQRT2 : (dx || dy ? 1.0 : 0.0));
+        first = false;
+        px = x;
+        py = y;
+        points.emplace_back(x, y);
+        cumulative.push_back(length);
+    });
+}
+
+
+template <typename Rng>
+cv::Point SegmentSampler::draw(Rng& rng, double a, double b) const {
+    std::uniform_real_distribution<double> arc(a, b);
+    const double s = arc(rng);
+    // first point whose cumulative length passes s; duplicates have zero weight and are never picked
+    auto it = std::upper_bound(cumulative.begin(), cumulative.end(), s);
+    if (it == cumulative.end()) {
+        --it;
+    }
+    return points[it - cumulative.begin()];
+}
+
+
+std::vector<cv::Point> SegmentSampler::sampleRange(double a, double b, const SampleOptions& options) const {
+    std::vector<cv::Point> out;
+    if (b <= a || options.count == 0) {
+        return out;
+    }
+
+    if (options.min_spacing <= 0.0) {
+        // Fixed-size blocks with their own stream, so the result doesn't depend on threads
+        const std::size_t block_size = 4096;
+        const std::size_t block_count = (options.count + block_size - 1) / block_size;
+        out.resize(options.count);
+        parallelFor(block_count, options.threads, [&](std::size_t block) {
+            std::mt19937_64 rng(mixSeed(options.seed, block));
+            const std::size_t end = std::min(options.count, (block + 1) * block_size);
+            for (std::size_t i = block * block_size; i < end; ++i) {
+                out[i] = draw(rng, a, b);
+            }
+        });
+        return out;
+    }
+
+    // Dart throwing against the accepted points
+    std::mt19937_64 rng(mixSeed(options.seed, 0));
+    SpacingGrid grid(options.min_spacing);
+    const std::size_t max_attempts = options.count * static_cast<std::size_t>(std::max(1, options.attempts_per_point));
+    out.reserve(options.count);
+    for (std::size_t attempt = 0; attempt < max_attempts && out.size() < options.count; ++attempt) {
+        const cv::Point p = draw(rng, a, b);
+        if (grid.accepts(p)) {
+            grid.insert(p);
+            out.push_back(p);
+        }
+    }
+    return out;
+}
+
+
+std::vector<cv::Point> SegmentSampler::sample(const SampleOptions& options) const {
+    return sampleRange(0.0, totalLength(), options);
+}
+
+
+std::vector<cv::Point> SegmentSampler::sampleSegment(int id, const SampleOptions& options) const {
+    auto it = std::find(ids.begin(), ids.end(), id);
+    if (it == ids.end()) {
+        return {};
+    }
+    const std::size_t k = it - ids.begin();
+    const double end = k + 1 < ids.size() ? segment_start[k + 1] : totalLength();
+    return sampleRange(segment_start[k], end, options);
+}
+
+
+std::vector<cv::Point> filterMinSpacing(const std::vector<cv::Point>& points, double min_spacing) {
+    if (min_spacing <= 0.0) {
+        return points;
+    }
+    std::vector<cv::Point> kept;
+    SpacingGrid grid(min_spacing);
+    for (const auto& p : points) {
+        if (grid.accepts(p)) {
+            grid.insert(p);
+            kept.push_back(p);
+        }
+    }
+    return kept;
+}
+
+}
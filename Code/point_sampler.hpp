@@ -0,0 +1,75 @@
+#ifndef POINT_SAMPLER_HPP
+#define POINT_SAMPLER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+struct SampleOptions {
+    std::size_t count = 1;
+    double min_spacing = 0.0;     // > 0 keeps accepted points at least this far apart
+    uint64_t seed = 0;            // same seed and segments give the same points
+    int attempts_per_point = 30;  // with min_spacing, give up after count * this many draws
+    int threads = 1;              // without min_spacing, draws are split over threads
+};
+
+
+// Draws points along segments with probability proportional to arc length:
+// a diagonal step between contour points counts sqrt(2), a straight one 1, so
+// diagonal runs aren't undersampled next to axis-aligned ones. Weighting
+// across several segments follows the same rule, so longer segments get more.
+//
+// Sampling is const and keeps its RNG on the caller's stack (seeded from
+// options.seed), so one sampler can serve many threads without contention.
+class SegmentSampler {
+
+    public:
+
+        // Every segment of the store
+        explicit SegmentSampler(const SegmentStore& segments);
+
+        // Only the given ids, e.g. the k longest after rankSegments
+        SegmentSampler(const SegmentStore& segments, const std::vector<int>& ids);
+
+        std::vector<cv::Point> sample(const SampleOptions& options) const;
+
+        // Points of one segment only (must be one of the sampler's ids)
+        std::vector<cv::Point> sampleSegment(int id, const SampleOptions& options) const;
+
+        double totalLength() const { return cumulative.empty() ? 0.0 : cumulative.back(); }
+
+
+    private:
+
+        void addSegment(const SegmentStore& segments, int id);
+
+        // Point drawn from arc length range [a, b)
+        template <typename Rng>
+        cv::Point draw(Rng& rng, double a, double b) const;
+
+        std::vector<cv::Point> sampleRange(double a, double b, const SampleOptions& options) const;
+
+        std::vector<int> ids;
+        std::vector<double> segment_start;   // arc length where each id begins
+        std::vector<cv::Point> points;       // points of ids, in order
+        std::vector<double> cumulative;      // arc length up to and including each point
+
+};
+
+
+// Seed of an independent RNG stream derived from one seed (splitmix64), so
+// blocks of work drawn in parallel stay reproducible
+uint64_t mixSeed(uint64_t seed, uint64_t stream);
+
+// Keep points (in order) that are at least min_spacing from every point kept
+// before them. Same result as the notebook's filter_points, through a grid
+// instead of comparing against every kept point.
+std::vector<cv::Point> filterMinSpacing(const std::vector<cv::Point>& points, double min_spacing);
+
+}
+
+#endif
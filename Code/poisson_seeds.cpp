@@ -0,0 +1,234 @@
+#include "poisson_seeds.hpp"
+#include "parallel.hpp"
+#include "point_sampler.hpp"
+#include "trace.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace mosaic_gen {
+
+namespace {
+
+struct GridSeed {
+    float x = -1.0f;   // < 0 for an empty cell
+    float y = 0.0f;
+    float r = 0.0f;
+};
+
+
+// Spacing per grid cell, computed on the grid instead of the full frame
+cv::Mat spacingField(cv::Size grid, double cell, const cv::Mat& edges, const PoissonOptions& options) {
+    const double low = options.min_spacing;
+    const double high = std::max(options.min_spacing, options.max_spacing);
+
+    if (options.source == SpacingSource::UNIFORM || edges.empty() || high == low) {
+        return cv::Mat(grid, CV_32F, cv::Scalar(options.source == SpacingSource::UNIFORM ? low : high));
+    }
+
+    // mean edge value per cell
+    cv::Mat density;
+    cv::resize(edges, density, grid, 0, 0, cv::INTER_AREA);
+    density.convertTo(density, CV_32F, 1.0 / 255.0);
+
+    cv::Mat t;   // 0 = dense / on an edge, 1 = empty, clamped below
+    if (options.source == SpacingSource::EDGE_DISTANCE) {
+        cv::Mat empty;
+        cv::compare(density, 0.0, empty, cv::CMP_LE);
+        cv::distanceTransform(empty, t, cv::DIST_L2, cv::DIST_MASK_5, CV_32F);
+        t.convertTo(t, CV_32F, cell / std::max(1.0, options.falloff));
+    }
+    else {
+        const int window = std::max(1, cvRound(options.falloff / cell)) | 1;
+        cv::blur(density, density, cv::Size(window, window));
+        density.convertTo(t, CV_32F, -1.0 / std::max(1e-6, options.dense_fraction), 1.0);
+    }
+
+    for (int y = 0; y < t.rows; ++y) {
+        float* row = t.ptr<float>(y);
+        for (int x = 0; x < t.cols; ++x) {
+            row[x] = static_cast<float>(low + (high - low) * std::min(1.0f, std::max(0.0f, row[x])));
+        }
+    }
+    return t;
+}
+
+
+class SeedGrid {
+
+    public:
+
+        // field: spacing per cell, row-major cols x rows
+        SeedGrid(int cols, int rows, double cell, double max_spacing, std::vector<float> field)
+            : cell(cell), cols(cols), rows(rows), field(std::move(field)) {
+            reach = static_cast<int>(std::ceil(max_spacing / cell));
+            cells.resize(static_cast<size_t>(cols) * rows);
+        }
+
+        float spacingAt(float x, float y) const {
+            return field[static_cast<size_t>(cellY(y)) * cols + cellX(x)];
+        }
+
+        // Free when no seed within max(r, its own spacing)
+        bool accepts(float x, float y, float r) const {
+            const int cx = cellX(x), cy = cellY(y);
+            const int x0 = std::max(0, cx - reach), x1 = std::min(cols - 1, cx + reach);
+            const int y0 = std::max(0, cy - reach), y1 = std::min(rows - 1, cy + reach);
+            for (int gy = y0; gy <= y1; ++gy) {
+                const GridSeed* row = &cells[static_cast<size_t>(gy) * cols];
+                for (int gx = x0; gx <= x1; ++gx) {
+                    const GridSeed& s = row[gx];
+                    if (s.x < 0.0f) {
+                        continue;
+                    }
+                    const float dx = s.x - x, dy = s.y - y;
+                    const float d = std::max(r, s.r);
+                    if (dx * dx + dy * dy < d * d) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        void insert(float x, float y, float r) {
+            cells[static_cast<size_t>(cellY(y)) * cols + cellX(x)] = GridSeed{x, y, r};
+        }
+
+        const GridSeed& at(int gx, int gy) const { return cells[static_cast<size_t>(gy) * cols + gx]; }
+
+        int cellX(float x) const { return std::min(cols - 1, static_cast<int>(x / cell)); }
+        int cellY(float y) const { return std::min(rows - 1, static_cast<int>(y / cell)); }
+
+        double cell;
+        int cols = 0;
+        int rows = 0;
+        int reach = 0;
+
+
+    private:
+
+        std::vector<float> field;
+        std::vector<GridSeed> cells;
+
+};
+
+
+// Bridson inside [x0, x1) x [y0, y1), against everything already in the grid
+void fillTile(SeedGrid& grid, float x0, float y0, float x1, float y1, int k, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<float> ux(x0, x1), uy(y0, y1), unit(0.0f, 1.0f);
+    std::vector<cv::Point2f> active;
+
+    auto tryInsert = [&](float x, float y) {
+        if (x < x0 || x >= x1 || y < y0 || y >= y1) {
+            return false;
+        }
+        const float r = grid.spacingAt(x, y);
+        if (!grid.accepts(x, y, r)) {
+            return false;
+        }
+        grid.insert(x, y, r);
+        active.emplace_back(x, y);
+        return true;
+    };
+
+    // Random throws start the fill and pick up pockets the active front missed;
+    // a round of k failed throws ends the tile
+    for (;;) {
+        bool started = false;
+        for (int i = 0; i < k && !started; ++i) {
+            started = tryInsert(ux(rng), uy(rng));
+        }
+        if (!started) {
+            return;
+        }
+
+        while (!active.empty()) {
+            std::uniform_int_distribution<size_t> pick(0, active.size() - 1);
+            const size_t index = pick(rng);
+            const cv::Point2f p = active[index];
+            const float r = grid.spacingAt(p.x, p.y);
+
+            bool spawned = false;
+            for (int i = 0; i < k && !spawned; ++i) {
+                // uniform by area in the annulus [r, 2r]
+                const float radius = r * std::sqrt(1.0f + 3.0f * unit(rng));
+                const float angle = 2.0f * static_cast<float>(M_PI) * unit(rng);
+                spawned = tryInsert(p.x + radius * std::cos(angle), p.y + radius * std::sin(angle));
+            }
+            if (!spawned) {
+                active[index] = active.back();
+                active.pop_back();
+            }
+        }
+    }
+}
+
+}
+
+
+int PoissonSeed::tileSize(double gap) const {
+    // a square of side s spans at most s / sqrt(2) from its center at any angle
+    return std::max(1, static_cast<int>(spacing / M_SQRT2 - gap));
+}
+
+
+std::vector<PoissonSeed> poissonDiskSeeds(cv::Size frame, const cv::Mat& edges, const PoissonOptions& options) {
+    MOSAIC_TRACE_SCOPE("poissonDiskSeeds");
+    std::vector<PoissonSeed> seeds;
+    if (frame.area() <= 0 || options.min_spacing <= 0.0) {
+        return seeds;
+    }
+
+    const double max_spacing = std::max(options.min_spacing, options.max_spacing);
+    const double cell = options.min_spacing / M_SQRT2;
+    const cv::Size grid_size(static_cast<int>(std::ceil(frame.width / cell)), static_cast<int>(std::ceil(frame.height / cell)));
+
+    const cv::Mat field = spacingField(grid_size, cell, edges, options);
+    std::vector<float> spacing(static_cast<size_t>(grid_size.area()));
+    for (int y = 0; y < field.rows; ++y) {
+        std::copy(field.ptr<float>(y), field.ptr<float>(y) + field.cols, spacing.begin() + static_cast<size_t>(y) * field.cols);
+    }
+    SeedGrid grid(grid_size.width, grid_size.height, cell, max_spacing, std::move(spacing));
+
+    // Tiles at least one neighbourhood wide, so same-phase tiles never read each other's cells
+    const int tile_cells = std::max(grid.reach + 1, 32);
+    const double tile_px = tile_cells * cell;
+    const int tiles_x = static_cast<int>(std::ceil(frame.width / tile_px));
+    const int tiles_y = static_cast<int>(std::ceil(frame.height / tile_px));
+    const int k = std::max(1, options.candidates);
+
+    for (int phase = 0; phase < 4; ++phase) {
+        std::vector<cv::Point> tiles;
+        for (int ty = phase >> 1; ty < tiles_y; ty += 2) {
+            for (int tx = phase & 1; tx < tiles_x; tx += 2) {
+                tiles.emplace_back(tx, ty);
+            }
+        }
+
+        parallelFor(tiles.size(), options.threads, [&](size_t i) {
+            const cv::Point t = tiles[i];
+            const float x0 = static_cast<float>(t.x * tile_px);
+            const float y0 = static_cast<float>(t.y * tile_px);
+            const float x1 = static_cast<float>(std::min<double>(frame.width, (t.x + 1) * tile_px));
+            const float y1 = static_cast<float>(std::min<double>(frame.height, (t.y + 1) * tile_px));
+            fillTile(grid, x0, y0, x1, y1, k, mixSeed(options.seed, static_cast<uint64_t>(t.y) * tiles_x + t.x));
+        });
+    }
+
+    // Row-major over the grid, a stable order for a given seed
+    for (int gy = 0; gy < grid.rows; ++gy) {
+        for (int gx = 0; gx < grid.cols; ++gx) {
+            const GridSeed& s = grid.at(gx, gy);
+            if (s.x >= 0.0f) {
+                seeds.push_back(PoissonSeed{cv::Point(static_cast<int>(s.x), static_cast<int>(s.y)), s.r});
+            }
+        }
+    }
+    MOSAIC_TRACE_COUNTER("poisson_seeds", seeds.size());
+    return seeds;
+}
+
+}
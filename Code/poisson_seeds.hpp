@@ -0,0 +1,52 @@
+#ifndef POISSON_SEEDS_HPP
+#define POISSON_SEEDS_HPP
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+enum class SpacingSource {
+    UNIFORM,          // min_spacing everywhere
+    EDGE_DISTANCE,    // min_spacing on edges, growing to max_spacing over falloff px
+    EDGE_DENSITY      // min_spacing where edge density reaches dense_fraction, max_spacing where there are none
+};
+
+
+struct PoissonOptions {
+    double min_spacing = 12.0;
+    double max_spacing = 40.0;
+    SpacingSource source = SpacingSource::EDGE_DISTANCE;
+    double falloff = 80.0;          // EDGE_DISTANCE ramp length / EDGE_DENSITY window, in px
+    double dense_fraction = 0.08;   // EDGE_DENSITY: share of edge pixels that counts as fully dense
+    int candidates = 20;            // Bridson's k
+    uint64_t seed = 0;
+    int threads = 0;                // <= 0 uses every core
+};
+
+
+struct PoissonSeed {
+    cv::Point center;
+    float spacing = 0.0f;   // local minimum distance to any other seed
+
+    // Side of an axis-aligned or rotated square (Graphics::drawSquare) that can
+    // sit on this seed without touching its neighbours
+    int tileSize(double gap = 0.0) const;
+};
+
+
+// Blue-noise seeds over a frame, Bridson's algorithm with a background grid.
+// Two seeds are at least max(spacing of either) apart, and the spacing follows
+// edges (CV_8U, nonzero = edge, may be empty for UNIFORM).
+//
+// The grid has one cell per min_spacing / sqrt(2), so a cell holds at most one
+// seed. The frame is split into tiles wider than the largest spacing and the
+// tiles are filled in four phases of a 2x2 checkerboard: tiles of one phase
+// cannot reach each other and run in parallel. Each tile has its own RNG
+// stream, so the result depends on the seed, not on the thread count.
+std::vector<PoissonSeed> poissonDiskSeeds(cv::Size frame, const cv::Mat& edges, const PoissonOptions& options);
+
+}
+
+#endif
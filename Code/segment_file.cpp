@@ -0,0 +1,369 @@
+#include "segment_file.hpp"
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+namespace mosaic_gen {
+
+namespace {
+
+constexpr char kHeaderMagic[8] = {'M', 'O', 'S', 'A', 'I', 'S', 'E', 'G'};
+constexpr char kFooterMagic[8] = {'M', 'O', 'S', 'A', 'I', 'E', 'N', 'D'};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    int32_t width;
+    int32_t height;
+    uint32_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(FileHeader) == 32, "FileHeader is part of the file format");
+
+struct FileFooter {
+    uint64_t segment_count;
+    uint64_t point_count;
+    uint64_t streams_end;
+    uint64_t table_offset;
+    uint64_t ranking_offset;   // 0 when the file has no ranking
+    char magic[8];
+};
+static_assert(sizeof(FileFooter) == 48, "FileFooter is part of the file format");
+
+
+// Chain codes of one segment, two per byte
+class ChainEncoder {
+
+    public:
+
+        explicit ChainEncoder(vector<uint8_t>& out) : out(out) { out.clear(); }
+
+        void add(int x, int y, SegmentRecord& record) {
+            if (record.point_count == 0) {
+                record.first_x = record.min_x = record.max_x = x;
+                record.first_y = record.min_y = record.max_y = y;
+            }
+            else {
+                const int dx = x - last_x;
+                const int dy = y - last_y;
+                const int code = neighbourCode(dx, dy);
+                if (code >= 0) {
+                    put(code);
+                }
+                else {
+                    put(chain_code::escape);
+                    putVarint(dx);
+                    putVarint(dy);
+                }
+                record.min_x = min(record.min_x, x);
+                record.min_y = min(record.min_y, y);
+                record.max_x = max(record.max_x, x);
+                record.max_y = max(record.max_y, y);
+            }
+            last_x = x;
+            last_y = y;
+            record.point_count++;
+        }
+
+
+    private:
+
+        static int neighbourCode(int dx, int dy) {
+            // indexed by (dy + 1) * 3 + dx + 1, -1 for (0, 0) and longer jumps
+            static constexpr int codes[9] = {3, 2, 1, 4, -1, 0, 5, 6, 7};
+            if (dx < -1 || dx > 1 || dy < -1 || dy > 1) {
+                return -1;
+            }
+            return codes[(dy + 1) * 3 + dx + 1];
+        }
+
+        void put(int nibble) {
+            if (odd) {
+                out.back() |= static_cast<uint8_t>(nibble << 4);
+            }
+            else {
+                out.push_back(static_cast<uint8_t>(nibble));
+            }
+            odd = !odd;
+        }
+
+        void putVarint(int64_t value) {
+            uint64_t bits = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+            while (bits >= 8) {
+                put(static_cast<int>(bits & 7) | 8);
+                bits >>= 3;
+            }
+            put(static_cast<int>(bits));
+        }
+
+        vector<uint8_t>& out;
+        bool odd = false;
+        int last_x = 0;
+        int last_y = 0;
+
+};
+
+
+void fillStats(SegmentRecord& record, const SegmentStats& stats) {
+    record.length = static_cast<float>(stats.length);
+    record.straightness = static_cast<float>(stats.straightness);
+    record.centroid_x = static_cast<float>(stats.centroid.x);
+    record.centroid_y = static_cast<float>(stats.centroid.y);
+    record.direction_x = static_cast<float>(stats.direction.x);
+    record.direction_y = static_cast<float>(stats.direction.y);
+    record.variance_major = static_cast<float>(stats.variance_major);
+    record.variance_minor = static_cast<float>(stats.variance_minor);
+}
+
+}
+
+
+SegmentFileWriter::SegmentFileWriter(ostream& out, cv::Size frame_size) : out(out), frame_size(frame_size) {
+    FileHeader header = {};
+    memcpy(header.magic, kHeaderMagic, sizeof(kHeaderMagic));
+    header.version = SEGMENT_FILE_VERSION;
+    header.header_bytes = sizeof(FileHeader);
+    header.width = frame_size.width;
+    header.height = frame_size.height;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset = sizeof(header);
+}
+
+
+int SegmentFileWriter::add(const SegmentStore& segments, int id, const SegmentStats& stats) {
+    SegmentRecord record = {};
+    ChainEncoder encoder(chain);
+    segments.forEachPoint(id, [&](int x, int y) { encoder.add(x, y, record); });
+    fillStats(record, stats);
+    return commit(record);
+}
+
+
+int SegmentFileWriter::add(const cv::Point* points, size_t count, const SegmentStats& stats) {
+    SegmentRecord record = {};
+    ChainEncoder encoder(chain);
+    for (size_t i = 0; i < count; ++i) {
+        encoder.add(points[i].x, points[i].y, record);
+    }
+    fillStats(record, stats);
+    return commit(record);
+}
+
+
+int SegmentFileWriter::commit(SegmentRecord& record) {
+    record.stream_offset = offset;
+    record.stream_bytes = static_cast<uint32_t>(chain.size());
+    out.write(reinterpret_cast<const char*>(chain.data()), chain.size());
+    offset += chain.size();
+    point_count += record.point_count;
+    table.push_back(record);
+    return static_cast<int>(table.size()) - 1;
+}
+
+
+bool SegmentFileWriter::finish(const vector<int>& ranking) {
+    if (finished) {
+        return false;
+    }
+    finished = true;
+
+    FileFooter footer = {};
+    footer.segment_count = table.size();
+    footer.point_count = point_count;
+    footer.streams_end = offset;
+    memcpy(footer.magic, kFooterMagic, sizeof(kFooterMagic));
+
+    // table aligned for the reader's in-place access
+    static const char padding[8] = {};
+    const size_t pad = (8 - offset % 8) % 8;
+    out.write(padding, pad);
+    offset += pad;
+
+    footer.table_offset = offset;
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(SegmentRecord));
+    offset += table.size() * sizeof(SegmentRecord);
+
+    if (!ranking.empty()) {
+        vector<uint32_t> ids(ranking.begin(), ranking.end());
+        footer.ranking_offset = offset;
+        out.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+        offset += ids.size() * sizeof(uint32_t);
+        if (ids.size() % 2) {
+            out.write(padding, 4);
+            offset += 4;
+        }
+    }
+
+    out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    offset += sizeof(footer);
+    return static_cast<bool>(out.flush());
+}
+
+
+bool writeSegmentFile(const string& path, const SegmentStore& segments, const vector<SegmentStats>& stats,
+                      const vector<int>& ranking) {
+    if (stats.size() != static_cast<size_t>(segments.size())) {
+        cerr << "writeSegmentFile: " << stats.size() << " stats for " << segments.size() << " segments" << endl;
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("writeSegmentFile");
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) {
+        cerr << "writeSegmentFile: could not open " << path << endl;
+        return false;
+    }
+    SegmentFileWriter writer(out, segments.frameSize());
+    for (int id = 0; id < segments.size(); ++id) {
+        writer.add(segments, id, stats[id]);
+    }
+    return writer.finish(ranking);
+}
+
+
+bool SegmentFileView::open(const string& path) {
+    auto mapped = make_shared<MappedFile>(path);
+    if (!mapped->valid() || !attach(mapped->data(), mapped->size())) {
+        close();
+        return false;
+    }
+    mapping = mapped;
+    return true;
+}
+
+
+bool SegmentFileView::attach(const unsigned char* data, size_t size) {
+    close();
+    if (!data || size < sizeof(FileHeader) + sizeof(FileFooter) || reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+        return false;
+    }
+
+    FileHeader header;
+    FileFooter footer;
+    memcpy(&header, data, sizeof(header));
+    memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+    if (memcmp(header.magic, kHeaderMagic, sizeof(kHeaderMagic)) != 0 || header.version != SEGMENT_FILE_VERSION
+        || header.header_bytes != sizeof(FileHeader) || header.width < 0 || header.height < 0
+        || memcmp(footer.magic, kFooterMagic, sizeof(kFooterMagic)) != 0) {
+        return false;
+    }
+
+    // Sections must follow each other and fit before the footer
+    const uint64_t body_end = size - sizeof(footer);
+    const uint64_t table_bytes = footer.segment_count * sizeof(SegmentRecord);
+    const uint64_t ranking_bytes = footer.ranking_offset ? footer.segment_count * sizeof(uint32_t) : 0;
+    const bool layout_ok = footer.segment_count <= body_end / sizeof(SegmentRecord)
+        && footer.streams_end >= sizeof(FileHeader) && footer.streams_end <= footer.table_offset
+        // a point past each segment's first costs at least half a byte
+        && footer.point_count <= footer.segment_count + 2 * (footer.streams_end - sizeof(FileHeader))
+        && footer.table_offset % 8 == 0 && footer.table_offset <= body_end && table_bytes <= body_end - footer.table_offset
+        && (footer.ranking_offset == 0
+            || (footer.ranking_offset % 4 == 0   // ranking is read in place as uint32_t
+                && footer.ranking_offset >= footer.table_offset + table_bytes && footer.ranking_offset <= body_end
+                && ranking_bytes <= body_end - footer.ranking_offset));
+    if (!layout_ok) {
+        return false;
+    }
+
+    base = data;
+    frame_size = cv::Size(header.width, header.height);
+    segment_count = footer.segment_count;
+    point_count = footer.point_count;
+    streams_end = footer.streams_end;
+    table = reinterpret_cast<const SegmentRecord*>(data + footer.table_offset);
+    ranking = footer.ranking_offset ? reinterpret_cast<const uint32_t*>(data + footer.ranking_offset) : nullptr;
+    return true;
+}
+
+
+void SegmentFileView::close() {
+    mapping.reset();
+    base = nullptr;
+    frame_size = cv::Size();
+    segment_count = 0;
+    point_count = 0;
+    streams_end = 0;
+    table = nullptr;
+    ranking = nullptr;
+}
+
+
+SegmentStats SegmentFileView::stats(int id) const {
+    const SegmentRecord& r = table[id];
+    SegmentStats result;
+    result.point_count = r.point_count;
+    result.centroid = cv::Point2d(r.centroid_x, r.centroid_y);
+    result.direction = cv::Point2d(r.direction_x, r.direction_y);
+    result.variance_major = r.variance_major;
+    result.variance_minor = r.variance_minor;
+    result.length = r.length;
+    result.straightness = r.straightness;
+    return result;
+}
+
+
+cv::Rect SegmentFileView::boundingBox(int id) const {
+    const SegmentRecord& r = table[id];
+    if (r.point_count == 0) {
+        return cv::Rect();
+    }
+    return cv::Rect(cv::Point(r.min_x, r.min_y), cv::Point(r.max_x + 1, r.max_y + 1));
+}
+
+
+bool SegmentFileView::copyPoints(int id, vector<cv::Point>& out) const {
+    out.clear();
+    // a corrupt count must not turn into a huge reserve
+    if (!recordInBounds(table[id])) {
+        return false;
+    }
+    out.reserve(table[id].point_count);
+    return forEachPoint(id, [&](int x, int y) { out.emplace_back(x, y); });
+}
+
+
+bool SegmentFileView::toStore(SegmentStore& out, int threads) const {
+    out.reset(frame_size);
+    if (!valid()) {
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("SegmentFileView::toStore");
+    // Blocks decode into their own stores, appended in order so ids match the file
+    const size_t block_size = 4096;
+    const size_t block_count = (segment_count + block_size - 1) / block_size;
+    vector<SegmentStore> blocks(block_count);
+    vector<char> block_ok(block_count, 1);
+
+    parallelFor(block_count, threads, [&](size_t block) {
+        const int begin = static_cast<int>(block * block_size);
+        const int end = static_cast<int>(min<uint64_t>(segment_count, (block + 1) * block_size));
+        SegmentStore& store = blocks[block];
+        store.reset(frame_size);
+
+        vector<cv::Point> points;
+        for (int id = begin; id < end && block_ok[block]; ++id) {
+            block_ok[block] = copyPoints(id, points);
+            store.addSegment(points.data(), points.size());
+        }
+    });
+
+    if (find(block_ok.begin(), block_ok.end(), 0) != block_ok.end()) {
+        out.clear();
+        return false;
+    }
+    out.reserve(segment_count, point_count);
+    for (const auto& block : blocks) {
+        out.append(block);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,210 @@
+#ifndef SEGMENT_FILE_HPP
+#define SEGMENT_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+class MappedFile;
+
+// Segment set on disk, native (little-endian) byte order:
+//
+//   header   32 B   "MOSAISEG", version, header size, frame width / height
+//   streams         one chain code per segment, each starting on a byte
+//   table    72 B   SegmentRecord per segment, 8-byte aligned
+//   ranking   4 B   optional, segment ids by descending length
+//   footer   48 B   counts, table / ranking offsets, "MOSAIEND"
+//
+// A chain code is a run of 4-bit codes, low nibble first, for the steps after
+// the segment's first point (kept in its record): 0-7 step to one of the 8
+// neighbours in Freeman order (y down), 8 escapes a longer jump whose dx and dy
+// follow as zigzag varints of 3 bits per nibble. Contours step between
+// neighbours, so a point costs half a byte.
+//
+// Offsets count from the header, and nothing before the footer depends on what
+// comes after it, so the writer never seeks and the reader only checks the
+// header and footer on open. Records and chain codes are touched on demand.
+constexpr uint32_t SEGMENT_FILE_VERSION = 1;
+
+struct SegmentRecord {
+    uint64_t stream_offset;      // chain code position from the header
+    uint32_t stream_bytes;
+    uint32_t point_count;
+    int32_t first_x, first_y;
+    int32_t min_x, min_y;        // bounding box, inclusive
+    int32_t max_x, max_y;
+    float length;                // SegmentStats, narrowed to float
+    float straightness;
+    float centroid_x, centroid_y;
+    float direction_x, direction_y;
+    float variance_major, variance_minor;
+};
+static_assert(sizeof(SegmentRecord) == 72, "SegmentRecord is part of the file format");
+
+
+namespace chain_code {
+inline constexpr int dx[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+inline constexpr int dy[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+inline constexpr int escape = 8;
+}
+
+
+// Streams a segment file: add every segment, then finish. out only has to
+// accept writes, so a pipe or socket works as well as a file.
+class SegmentFileWriter {
+
+    public:
+
+        SegmentFileWriter(std::ostream& out, cv::Size frame_size);
+
+        // Append one segment and return its id in the file
+        int add(const SegmentStore& segments, int id, const SegmentStats& stats);
+        int add(const cv::Point* points, std::size_t count, const SegmentStats& stats);
+
+        // Write table, ranking (may be empty) and footer. False if the stream failed.
+        bool finish(const std::vector<int>& ranking = std::vector<int>());
+
+        uint64_t bytesWritten() const { return offset; }
+
+
+    private:
+
+        int commit(SegmentRecord& record);
+
+        std::ostream& out;
+        cv::Size frame_size;
+        uint64_t offset = 0;
+        uint64_t point_count = 0;
+        std::vector<SegmentRecord> table;
+        std::vector<uint8_t> chain;   // current segment's codes, two per byte
+        bool finished = false;
+
+};
+
+
+// Every segment of segments with its stats (indexed by id) and ranking, e.g.
+// Mosaic's segment_stats and the ids of its rankSegments order
+bool writeSegmentFile(const std::string& path, const SegmentStore& segments, const std::vector<SegmentStats>& stats,
+                      const std::vector<int>& ranking);
+
+
+// Read access to a segment file without parsing it. open maps the file; attach
+// reads bytes the caller keeps alive (8-byte aligned), e.g. part of a larger
+// mapping. Corrupt chain codes are reported per segment by forEachPoint.
+class SegmentFileView {
+
+    public:
+
+        bool open(const std::string& path);
+        bool attach(const unsigned char* data, std::size_t size);
+        void close();
+
+        bool valid() const { return table != nullptr; }
+        int size() const { return static_cast<int>(segment_count); }
+        std::size_t totalPoints() const { return point_count; }
+        cv::Size frameSize() const { return frame_size; }
+
+        const SegmentRecord& record(int id) const { return table[id]; }
+        SegmentStats stats(int id) const;
+        cv::Rect boundingBox(int id) const;
+
+        bool hasRanking() const { return ranking != nullptr; }
+        int rankedId(int k) const { return static_cast<int>(ranking[k]); }
+
+        // Call fn(x, y) for every point of segment id in contour order. Returns
+        // false (possibly after some calls) if the chain code is corrupt.
+        template <typename Fn>
+        bool forEachPoint(int id, Fn&& fn) const;
+
+        bool copyPoints(int id, std::vector<cv::Point>& out) const;
+
+        // Decode everything into a SegmentStore (same ids); threads <= 0 uses every core
+        bool toStore(SegmentStore& out, int threads = 1) const;
+
+
+    private:
+
+        // chain code inside the streams, and no more points than it can hold
+        bool recordInBounds(const SegmentRecord& r) const {
+            return r.stream_offset <= streams_end && r.stream_bytes <= streams_end - r.stream_offset
+                && r.point_count <= 1 + 2 * static_cast<uint64_t>(r.stream_bytes);
+        }
+
+        std::shared_ptr<MappedFile> mapping;
+        const unsigned char* base = nullptr;
+        cv::Size frame_size;
+        uint64_t segment_count = 0;
+        uint64_t point_count = 0;
+        uint64_t streams_end = 0;
+        const SegmentRecord* table = nullptr;
+        const uint32_t* ranking = nullptr;
+
+};
+
+
+template <typename Fn>
+bool SegmentFileView::forEachPoint(int id, Fn&& fn) const {
+    const SegmentRecord& r = table[id];
+    if (r.point_count == 0) {
+        return true;
+    }
+    if (!recordInBounds(r)) {
+        return false;
+    }
+
+    const unsigned char* codes = base + r.stream_offset;
+    const std::size_t nibbles = static_cast<std::size_t>(r.stream_bytes) * 2;
+    std::size_t n = 0;
+    auto next = [&]() { const int v = (codes[n >> 1] >> ((n & 1) * 4)) & 15; ++n; return v; };
+    auto varint = [&](int64_t& value) {
+        uint64_t bits = 0;
+        for (int shift = 0; shift < 64 && n < nibbles; shift += 3) {
+            const int v = next();
+            bits |= static_cast<uint64_t>(v & 7) << shift;
+            if (!(v & 8)) {
+                value = static_cast<int64_t>(bits >> 1) ^ -static_cast<int64_t>(bits & 1);
+                return true;
+            }
+        }
+        return false;
+    };
+
+    int64_t x = r.first_x;
+    int64_t y = r.first_y;
+    for (uint32_t i = 0; i < r.point_count; ++i) {
+        if (i > 0) {
+            if (n >= nibbles) {
+                return false;
+            }
+            const int code = next();
+            if (code < chain_code::escape) {
+                x += chain_code::dx[code];
+                y += chain_code::dy[code];
+            }
+            else {
+                int64_t jump_x, jump_y;
+                if (code != chain_code::escape || !varint(jump_x) || !varint(jump_y)) {
+                    return false;
+                }
+                x += jump_x;
+                y += jump_y;
+            }
+        }
+        if (x < 0 || y < 0 || x >= frame_size.width || y >= frame_size.height) {
+            return false;
+        }
+        fn(static_cast<int>(x), static_cast<int>(y));
+    }
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include "segment_stats.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace mosaic_gen {
+
+SegmentStats solveMoments(const SegmentMoments& moments) {
+    SegmentStats stats;
+    stats.point_count = static_cast<std::size_t>(moments.count);
+    if (moments.count == 0.0) {
+        return stats;
+    }
+
+    const double n = moments.count;
+    const double mean_x = moments.sum_x / n;
+    const double mean_y = moments.sum_y / n;
+    stats.centroid = cv::Point2d(moments.origin_x + mean_x, moments.origin_y + mean_y);
+
+    // Population covariance [[a, b], [b, c]], same scaling cv::PCA uses
+    const double a = std::max(0.0, moments.sum_xx / n - mean_x * mean_x);
+    const double b = moments.sum_xy / n - mean_x * mean_y;
+    const double c = std::max(0.0, moments.sum_yy / n - mean_y * mean_y);
+
+    // Closed-form eigenvalues of a symmetric 2x2 matrix
+    const double half_trace = 0.5 * (a + c);
+    const double radius = std::sqrt(0.25 * (a - c) * (a - c) + b * b);
+    stats.variance_major = half_trace + radius;
+    stats.variance_minor = std::max(0.0, half_trace - radius);
+
+    // Major axis angle, atan2 keeps this stable when b is tiny
+    const double theta = 0.5 * std::atan2(2.0 * b, a - c);
+    stats.direction = cv::Point2d(std::cos(theta), std::sin(theta));
+
+    stats.straightness = stats.variance_major > 0.0
+        ? 1.0 - stats.variance_minor / stats.variance_major
+        : 0.0;
+
+    return stats;
+}
+
+
+SegmentStats computeSegmentStats(const std::vector<cv::Point>& points) {
+    SegmentMoments moments;
+    for (const auto& pt : points) {
+        moments.add(pt.x, pt.y);
+    }
+
+    SegmentStats stats = solveMoments(moments);
+    measureExtent(stats, [&](auto&& fn) {
+        for (const auto& pt : points) fn(pt.x, pt.y);
+    });
+    return stats;
+}
+
+}
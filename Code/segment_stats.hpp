@@ -0,0 +1,88 @@
+#ifndef SEGMENT_STATS_HPP
+#define SEGMENT_STATS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+// Running first and second moments of a point set. Sums are taken relative to
+// the first point so large image coordinates don't cancel out in the covariance.
+struct SegmentMoments {
+    double origin_x = 0.0;
+    double origin_y = 0.0;
+    double count = 0.0;
+    double sum_x = 0.0;
+    double sum_y = 0.0;
+    double sum_xx = 0.0;
+    double sum_xy = 0.0;
+    double sum_yy = 0.0;
+
+    void add(int x, int y) {
+        if (count == 0.0) {
+            origin_x = x;
+            origin_y = y;
+        }
+        const double dx = x - origin_x;
+        const double dy = y - origin_y;
+        count += 1.0;
+        sum_x += dx;
+        sum_y += dy;
+        sum_xx += dx * dx;
+        sum_xy += dx * dy;
+        sum_yy += dy * dy;
+    }
+};
+
+
+struct SegmentStats {
+    std::size_t point_count = 0;
+    cv::Point2d centroid;
+    cv::Point2d direction = cv::Point2d(1.0, 0.0);  // unit principal axis
+    double variance_major = 0.0;                     // covariance eigenvalues
+    double variance_minor = 0.0;
+    double length = 0.0;                             // extent along the principal axis
+    double straightness = 0.0;                       // 1 - minor / major, 1 for a straight line
+};
+
+
+// Centroid, principal axis and straightness from the moments alone (length is left at 0)
+SegmentStats solveMoments(const SegmentMoments& moments);
+
+// Full statistics including the projected extent
+SegmentStats computeSegmentStats(const std::vector<cv::Point>& points);
+
+
+// Extent of the points along stats.direction, one pass, no allocation.
+// forEachPoint is called with a callback taking (int x, int y).
+template <typename ForEachPoint>
+void measureExtent(SegmentStats& stats, ForEachPoint&& forEachPoint) {
+    if (stats.point_count < 2) {
+        stats.length = 0.0;
+        return;
+    }
+
+    double min_proj = 0.0;
+    double max_proj = 0.0;
+    bool first = true;
+
+    forEachPoint([&](int x, int y) {
+        const double proj = (x - stats.centroid.x) * stats.direction.x + (y - stats.centroid.y) * stats.direction.y;
+        if (first) {
+            min_proj = max_proj = proj;
+            first = false;
+        }
+        else {
+            min_proj = std::min(min_proj, proj);
+            max_proj = std::max(max_proj, proj);
+        }
+    });
+
+    stats.length = max_proj - min_proj;
+}
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+void SegmentStore::reset(cv::Size size) {
+    frame_size = size;
+    // coordinates are always inside the frame, so 16 bits is enough up to 65536 px per side
+    compact_coords = size.width <= 65536 && size.height <= 65536;
+    clear();
+}
+
+
+void SegmentStore::clear() {
+    xs_16.clear();
+    ys_16.clear();
+    xs_32.clear();
+    ys_32.clear();
+    offsets.assign(1, 0);
+    moments.clear();
+}
+
+
+void SegmentStore::reserve(std::size_t segment_count, std::size_t point_count) {
+    offsets.reserve(segment_count + 1);
+    moments.reserve(segment_count);
+    if (compact_coords) {
+        xs_16.reserve(point_count);
+        ys_16.reserve(point_count);
+    }
+    else {
+        xs_32.reserve(point_count);
+        ys_32.reserve(point_count);
+    }
+}
+
+
+int SegmentStore::addSegment(const cv::Point* points, std::size_t count) {
+    SegmentMoments segment_moments;
+
+    if (compact_coords) {
+        for (std::size_t i = 0; i < count; ++i) {
+            xs_16.push_back(static_cast<uint16_t>(points[i].x));
+            ys_16.push_back(static_cast<uint16_t>(points[i].y));
+            segment_moments.add(points[i].x, points[i].y);
+        }
+    }
+    else {
+        for (std::size_t i = 0; i < count; ++i) {
+            xs_32.push_back(points[i].x);
+            ys_32.push_back(points[i].y);
+            segment_moments.add(points[i].x, points[i].y);
+        }
+    }
+
+    offsets.push_back(offsets.back() + count);
+    moments.push_back(segment_moments);
+    return size() - 1;
+}
+
+
+void SegmentStore::append(const SegmentStore& other) {
+    const std::size_t base = offsets.back();
+
+    if (compact_coords) {
+        xs_16.insert(xs_16.end(), other.xs_16.begin(), other.xs_16.end());
+        ys_16.insert(ys_16.end(), other.ys_16.begin(), other.ys_16.end());
+    }
+    else {
+        xs_32.insert(xs_32.end(), other.xs_32.begin(), other.xs_32.end());
+        ys_32.insert(ys_32.end(), other.ys_32.begin(), other.ys_32.end());
+    }
+
+    for (std::size_t i = 1; i < other.offsets.size(); ++i) {
+        offsets.push_back(base + other.offsets[i]);
+    }
+    moments.insert(moments.end(), other.moments.begin(), other.moments.end());
+}
+
+
+void SegmentStore::resolveOverlaps(int first, cv::Rect area, cv::Mat& owner) {
+    if (first >= size() || area.empty()) {
+        return;
+    }
+
+    owner.create(area.size(), CV_32S);
+    owner.setTo(cv::Scalar(0));
+    for (int id = first; id < size(); ++id) {
+        const int32_t label = id + 1;
+        forEachPoint(id, [&](int x, int y) { owner.at<int32_t>(y - area.y, x - area.x) = label; });
+    }
+
+    // A point survives where its segment owns the pixel; releasing the pixel
+    // afterwards keeps only the first visit in contour order
+    std::vector<cv::Point> kept;
+    std::vector<std::size_t> kept_ends;
+    kept.reserve(offsets.back() - offsets[first]);
+    kept_ends.reserve(size() - first);
+    for (int id = first; id < size(); ++id) {
+        const int32_t label = id + 1;
+        forEachPoint(id, [&](int x, int y) {
+            int32_t& pixel = owner.at<int32_t>(y - area.y, x - area.x);
+            if (pixel == label) {
+                kept.emplace_back(x, y);
+                pixel = 0;
+            }
+        });
+        kept_ends.push_back(kept.size());
+    }
+
+    const std::size_t base = offsets[first];
+    if (compact_coords) {
+        xs_16.resize(base);
+        ys_16.resize(base);
+    }
+    else {
+        xs_32.resize(base);
+        ys_32.resize(base);
+    }
+    offsets.resize(first + 1);
+    moments.resize(first);
+
+    std::size_t start = 0;
+    for (std::size_t end : kept_ends) {
+        if (end > start) {
+            addSegment(kept.data() + start, end - start);
+        }
+        start = end;
+    }
+}
+
+
+std::size_t SegmentStore::memoryBytes() const {
+    return xs_16.capacity() * sizeof(uint16_t) + ys_16.capacity() * sizeof(uint16_t) +
+           xs_32.capacity() * sizeof(int32_t) + ys_32.capacity() * sizeof(int32_t) +
+           offsets.capacity() * sizeof(std::size_t) +
+           moments.capacity() * sizeof(SegmentMoments);
+}
+
+
+SegmentStats SegmentStore::stats(int id) const {
+    SegmentStats result = solveMoments(moments[id]);
+    measureExtent(result, [&](auto&& fn) { forEachPoint(id, fn); });
+    return result;
+}
+
+
+cv::Point SegmentStore::point(int id, std::size_t i) const {
+    const std::size_t idx = offsets[id] + i;
+    if (compact_coords) {
+        return cv::Point(xs_16[idx], ys_16[idx]);
+    }
+    return cv::Point(xs_32[idx], ys_32[idx]);
+}
+
+
+void SegmentStore::copyPoints(int id, std::vector<cv::Point>& out) const {
+    out.clear();
+    out.reserve(segmentSize(id));
+    forEachPoint(id, [&](int x, int y) { out.emplace_back(x, y); });
+}
+
+
+void SegmentStore::paintLabels(cv::Mat& labels) const {
+    labels.create(frame_size, CV_32S);
+    labels.setTo(cv::Scalar(0));
+
+    for (int id = 0; id < size(); ++id) {
+        const int32_t label = id + 1;
+        forEachPoint(id, [&](int x, int y) { labels.at<int32_t>(y, x) = label; });
+    }
+}
+
+
+void SegmentStore::paintColors(cv::Mat& image) const {
+    image.create(frame_size, CV_8UC3);
+    image.setTo(cv::Scalar(0, 0, 0));
+
+    for (int id = 0; id < size(); ++id) {
+        const cv::Vec3b color = segmentColor(id);
+        forEachPoint(id, [&](int x, int y) { image.at<cv::Vec3b>(y, x) = color; });
+    }
+}
+
+
+cv::Vec3b SegmentStore::segmentColor(int id) {
+    // Each channel stays in [64, 255] like the old random colors. Multiplying by a
+    // constant coprime to 192^3 scatters neighbouring ids while staying unique
+    // for the first 192^3 segments.
+    constexpr uint64_t channel_range = 192;
+    constexpr uint64_t color_count = channel_range * channel_range * channel_range;
+    const uint64_t idx = (static_cast<uint64_t>(id) * 2654435761ull) % color_count;
+
+    return cv::Vec3b(
+        static_cast<uchar>(64 + idx % channel_range),
+        static_cast<uchar>(64 + (idx / channel_range) % channel_range),
+        static_cast<uchar>(64 + idx / (channel_range * channel_range))
+    );
+}
+
+}
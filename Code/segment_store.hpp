@@ -0,0 +1,99 @@
+#ifndef SEGMENT_STORE_HPP
+#define SEGMENT_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "segment_stats.hpp"
+
+namespace mosaic_gen {
+
+// Contiguous storage for every segment produced by detectContours.
+// Segments get dense integer ids in the order they are added. Points are kept
+// in contour order as structure-of-arrays x/y buffers, using 16-bit
+// coordinates whenever the frame fits, with one offset per segment.
+// detectContours resolves overlaps, so there each pixel is one point of one segment.
+class SegmentStore {
+
+    public:
+
+        void reset(cv::Size frame_size);
+        void clear();
+        void reserve(std::size_t segment_count, std::size_t point_count);
+
+        // Append one segment and return its id
+        int addSegment(const cv::Point* points, std::size_t count);
+
+        // Append every segment of other (same frame size), renumbering its ids after ours
+        void append(const SegmentStore& other);
+
+        // Give every pixel covered by segments first.. one point, in the last of them
+        // that covers it, like painting them in id order. findContours walks a 1 px
+        // edge both ways, so this drops the repeats; segments left empty are removed
+        // and the later ids move down. Their points must lie inside area; owner is
+        // CV_32S scratch of area's size.
+        void resolveOverlaps(int first, cv::Rect area, cv::Mat& owner);
+
+        int size() const { return static_cast<int>(offsets.size()) - 1; }
+        bool empty() const { return size() <= 0; }
+        std::size_t totalPoints() const { return offsets.back(); }
+        std::size_t segmentSize(int id) const { return offsets[id + 1] - offsets[id]; }
+        std::size_t segmentOffset(int id) const { return offsets[id]; }
+
+        bool compact() const { return compact_coords; }
+        cv::Size frameSize() const { return frame_size; }
+        std::size_t memoryBytes() const;
+
+        const SegmentMoments& segmentMoments(int id) const { return moments[id]; }
+        SegmentStats stats(int id) const;
+
+        cv::Point point(int id, std::size_t i) const;
+        void copyPoints(int id, std::vector<cv::Point>& out) const;
+
+        // Call fn(x, y) for every point of segment id, in contour order
+        template <typename Fn>
+        void forEachPoint(int id, Fn&& fn) const {
+            const std::size_t a = offsets[id];
+            const std::size_t b = offsets[id + 1];
+            if (compact_coords) {
+                const uint16_t* xs = xs_16.data();
+                const uint16_t* ys = ys_16.data();
+                for (std::size_t i = a; i < b; ++i) fn(static_cast<int>(xs[i]), static_cast<int>(ys[i]));
+            }
+            else {
+                const int32_t* xs = xs_32.data();
+                const int32_t* ys = ys_32.data();
+                for (std::size_t i = a; i < b; ++i) fn(static_cast<int>(xs[i]), static_cast<int>(ys[i]));
+            }
+        }
+
+        // Write id + 1 into a CV_32S label map (0 = background); later segments win
+        void paintLabels(cv::Mat& labels) const;
+
+        // Write a distinct debug color per segment into a CV_8UC3 image
+        void paintColors(cv::Mat& image) const;
+        static cv::Vec3b segmentColor(int id);
+
+
+    private:
+
+        cv::Size frame_size;
+        bool compact_coords = true;
+
+        std::vector<uint16_t> xs_16;
+        std::vector<uint16_t> ys_16;
+        std::vector<int32_t> xs_32;
+        std::vector<int32_t> ys_32;
+
+        // offsets[id] .. offsets[id + 1] index the point buffers
+        std::vector<std::size_t> offsets = {0};
+
+        // accumulated while points are added, one per segment
+        std::vector<SegmentMoments> moments;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "job_server.hpp"
+#include "trace.hpp"
+
+using namespace std;
+using mosaic_gen::JobServer;
+using mosaic_gen::JobServerOptions;
+using mosaic_gen::ServerJob;
+using mosaic_gen::Tracer;
+
+
+void printUsage() {
+    cerr << "usage: mosaic_server [--socket PATH] [--workers N] [--threads N] [--queue N]\n"
+         << "         [--connections N] [--cache DIR] [--trace trace.json] [--trace-events N]\n"
+         << "\n"
+         << "One request per line on the socket, e.g. with socat:\n"
+         << "  echo 'run input=a.jpg output=a_mosaic.png tile_size=16' | socat - UNIX-CONNECT:/tmp/mosaic.sock\n"
+         << "  echo stats | socat - UNIX-CONNECT:/tmp/mosaic.sock" << endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    string trace_path;
+    long trace_events = 0;
+    JobServerOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--socket" && has_value) options.socket_path = argv[++i];
+        else if (arg == "--workers" && has_value) options.workers = atoi(argv[++i]);
+        else if (arg == "--threads" && has_value) options.threads_per_job = atoi(argv[++i]);
+        else if (arg == "--queue" && has_value) options.queue_capacity = atoi(argv[++i]);
+        else if (arg == "--connections" && has_value) options.max_connections = atoi(argv[++i]);
+        else if (arg == "--cache" && has_value) options.cache_dir = argv[++i];
+        else if (arg == "--trace" && has_value) trace_path = argv[++i];
+        else if (arg == "--trace-events" && has_value) trace_events = atol(argv[++i]);
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!trace_path.empty()) {
+        // the trace keeps the most recent events of a server that runs for days
+        if (trace_events > 0) {
+            Tracer::instance().setEventCapacity(trace_events);
+        }
+        Tracer::instance().enable();
+    }
+
+    // Every thread inherits the blocked signals, so only the waiter below sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    JobServer server(options, ServerJob());
+    if (!server.start()) {
+        return 1;
+    }
+    cout << "Listening on " << options.socket_path << " (" << options.workers << " workers, queue "
+         << options.queue_capacity << ")" << endl;
+
+    thread([&server, signals]() {
+        int signal = 0;
+        sigwait(&signals, &signal);
+        server.handle("shutdown");
+    }).detach();
+
+    server.wait();
+    cout << "Shutting down, finishing queued jobs" << endl;
+    server.stop();
+    cout << server.handle("stats") << endl;
+
+    if (!trace_path.empty()) {
+        Tracer::instance().printSummary(cout);
+        Tracer::instance().writeChromeTrace(trace_path);
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+#include "stage_cache.hpp"
+#include "mapped_file.hpp"
+#include "segment_file.hpp"
+#include "trace.hpp"
+#include <opencv2/imgcodecs.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::__fs::filesystem;
+
+namespace mosaic_gen {
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'O', 'S', 'C', 'A', 'C', 'H', 'E'};
+
+struct EntryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t png_bytes;
+};
+
+size_t alignUp(size_t offset) {
+    return (offset + 7) & ~size_t(7);
+}
+
+}
+
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+uint64_t hashValues(uint64_t hash, initializer_list<double> values) {
+    for (double value : values) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        hash = hashBytes(&bits, sizeof(bits), hash);
+    }
+    return hash;
+}
+
+
+StageDiskCache::StageDiskCache(const string& directory) : root(directory) {
+    error_code error;
+    fs::create_directories(root, error);
+    if (error) {
+        cerr << "StageDiskCache: could not create " << root << ": " << error.message() << endl;
+    }
+}
+
+
+string StageDiskCache::entryPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.msc", static_cast<unsigned long long>(key));
+    return (fs::path(root) / name).string();
+}
+
+
+uint64_t StageDiskCache::fileHash(const string& path) {
+    error_code error;
+    const uint64_t size = fs::file_size(path, error);
+    if (error) {
+        return 0;
+    }
+    const int64_t mtime = fs::last_write_time(path, error).time_since_epoch().count();
+    if (error) {
+        return 0;
+    }
+
+    {
+        lock_guard<mutex> lock(hash_mutex);
+        auto it = file_hashes.find(path);
+        if (it != file_hashes.end() && it->second.size == size && it->second.mtime == mtime) {
+            return it->second.hash;
+        }
+    }
+
+    MOSAIC_TRACE_SCOPE("StageDiskCache::fileHash");
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return 0;
+    }
+    vector<char> chunk(1 << 20);
+    uint64_t hash = hashValues(14695981039346656037ull, {double(size)});
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        hash = hashBytes(chunk.data(), static_cast<size_t>(file.gcount()), hash);
+    }
+    hash |= 1;   // 0 is reserved for "unreadable"
+
+    lock_guard<mutex> lock(hash_mutex);
+    file_hashes[path] = FileHash{size, mtime, hash};
+    return hash;
+}
+
+
+bool StageDiskCache::load(uint64_t key, cv::Mat& edges, SegmentStore& segments, vector<SegmentStats>& segment_stats,
+                          vector<pair<int, double>>& segment_lengths, int threads) {
+    MappedFile mapped(entryPath(key));
+    if (!mapped.valid()) {
+        miss_count++;
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("StageDiskCache::load");
+    EntryHeader header;
+    bool ok = mapped.size() >= sizeof(header);
+    if (ok) {
+        memcpy(&header, mapped.data(), sizeof(header));
+        ok = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == MOSAIC_CACHE_VERSION
+          && header.key == key && header.png_bytes > 0 && header.png_bytes <= mapped.size() - sizeof(header);
+    }
+
+    cv::Mat loaded_edges;
+    SegmentFileView view;
+    if (ok) {
+        const cv::Mat png(1, static_cast<int>(header.png_bytes), CV_8UC1, const_cast<unsigned char*>(mapped.data() + sizeof(header)));
+        loaded_edges = cv::imdecode(png, cv::IMREAD_GRAYSCALE);
+
+        const size_t segments_at = alignUp(sizeof(header) + header.png_bytes);
+        ok = !loaded_edges.empty() && segments_at < mapped.size()
+          && view.attach(mapped.data() + segments_at, mapped.size() - segments_at)
+          && view.frameSize() == loaded_edges.size() && view.hasRanking();
+    }
+
+    SegmentStore loaded_segments;
+    vector<SegmentStats> loaded_stats;
+    vector<pair<int, double>> loaded_lengths;
+    if (ok) {
+        ok = view.toStore(loaded_segments, threads);
+        loaded_stats.resize(view.size());
+        loaded_lengths.resize(view.size());
+        for (int id = 0; id < view.size(); ++id) {
+            loaded_stats[id] = view.stats(id);
+        }
+        for (int k = 0; ok && k < view.size(); ++k) {
+            const int id = view.rankedId(k);
+            ok = id >= 0 && id < view.size();
+            if (ok) {
+                loaded_lengths[k] = {id, view.record(id).length};
+            }
+        }
+    }
+
+    if (!ok) {
+        cerr << "StageDiskCache: ignoring unreadable entry " << entryPath(key) << endl;
+        miss_count++;
+        return false;
+    }
+
+    edges = loaded_edges;
+    segments = std::move(loaded_segments);
+    segment_stats.swap(loaded_stats);
+    segment_lengths.swap(loaded_lengths);
+    hit_count++;
+    MOSAIC_TRACE_COUNTER("disk_cache_hits", hit_count.load());
+    return true;
+}
+
+
+bool StageDiskCache::store(uint64_t key, const cv::Mat& edges, const SegmentStore& segments,
+                           const vector<SegmentStats>& segment_stats, const vector<pair<int, double>>& segment_lengths) {
+    if (edges.empty() || edges.type() != CV_8UC1 || segments.frameSize() != edges.size()
+        || segment_stats.size() != static_cast<size_t>(segments.size()) || segment_lengths.size() != segment_stats.size()) {
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("StageDiskCache::store");
+    // Canny output is mostly zeros, PNG keeps it a small fraction of the raw size
+    vector<uchar> png;
+    if (!cv::imencode(".png", edges, png, {cv::IMWRITE_PNG_COMPRESSION, 1})) {
+        return false;
+    }
+
+    EntryHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = MOSAIC_CACHE_VERSION;
+    header.key = key;
+    header.png_bytes = png.size();
+
+    vector<int> ranking;
+    ranking.reserve(segment_lengths.size());
+    for (const auto& entry : segment_lengths) {
+        ranking.push_back(entry.first);
+    }
+
+    const string path = entryPath(key);
+    const string temp_path = path + ".tmp" + to_string(::getpid()) + "_" + to_string(temp_counter++);
+    {
+        ofstream out(temp_path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(png.data()), png.size());
+
+        // the segment file starts 8-byte aligned, so load can read it in place
+        static const char padding[8] = {};
+        out.write(padding, alignUp(sizeof(header) + png.size()) - (sizeof(header) + png.size()));
+
+        SegmentFileWriter writer(out, segments.frameSize());
+        for (int id = 0; id < segments.size(); ++id) {
+            writer.add(segments, id, segment_stats[id]);
+        }
+
+        if (!writer.finish(ranking)) {
+            cerr << "StageDiskCache: could not write " << temp_path << endl;
+            out.close();
+            error_code error;
+            fs::remove(temp_path, error);
+            return false;
+        }
+    }
+
+    error_code error;
+    fs::rename(temp_path, path, error);
+    if (error) {
+        cerr << "StageDiskCache: could not store " << path << ": " << error.message() << endl;
+        fs::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+}
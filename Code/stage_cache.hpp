@@ -0,0 +1,84 @@
+#ifndef STAGE_CACHE_HPP
+#define STAGE_CACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+// Bump whenever edges, segments or rankings would come out differently for the
+// same file and parameters, so entries written by older builds stop matching
+constexpr uint32_t MOSAIC_CACHE_VERSION = 3;
+
+// FNV-1a over raw bytes, continuing from hash
+uint64_t hashBytes(const void* data, std::size_t size, uint64_t hash = 14695981039346656037ull);
+
+// FNV-1a over the bit patterns of values, continuing from hash
+uint64_t hashValues(uint64_t hash, std::initializer_list<double> values);
+
+
+// Edges, segments and rankings of earlier runs, one file per key under a
+// directory. Keys are built by the caller from the input file's content hash
+// (fileHash), MOSAIC_CACHE_VERSION and every stage parameter up to rankSegments,
+// so a warm run of the same file and parameters can go straight to placement.
+//
+// An entry is a small header, the edges as PNG and a segment file (segment_file.hpp)
+// carrying the stats and the ranking; load maps it and decodes in place. Stats
+// and lengths come back narrowed to float, the ranking order is kept exactly.
+//
+// Entries are written to a temporary file and renamed into place, so batch
+// workers sharing a directory never read a half written entry. A file that
+// fails to parse counts as a miss and is overwritten by the next store.
+class StageDiskCache {
+
+    public:
+
+        explicit StageDiskCache(const std::string& directory);
+
+        // Content hash of the file, 0 if it can't be read. Remembered per path
+        // while its size and modification time stay the same.
+        uint64_t fileHash(const std::string& path);
+
+        // threads <= 0 uses every core to decode the segments
+        bool load(uint64_t key, cv::Mat& edges, SegmentStore& segments, std::vector<SegmentStats>& segment_stats,
+                  std::vector<std::pair<int, double>>& segment_lengths, int threads = 1);
+        bool store(uint64_t key, const cv::Mat& edges, const SegmentStore& segments,
+                   const std::vector<SegmentStats>& segment_stats, const std::vector<std::pair<int, double>>& segment_lengths);
+
+        std::string entryPath(uint64_t key) const;
+        const std::string& directory() const { return root; }
+
+        std::size_t hits() const { return hit_count; }
+        std::size_t misses() const { return miss_count; }
+
+
+    private:
+
+        struct FileHash {
+            uint64_t size = 0;
+            int64_t mtime = 0;
+            uint64_t hash = 0;
+        };
+
+        std::string root;
+        std::mutex hash_mutex;
+        std::unordered_map<std::string, FileHash> file_hashes;
+
+        std::atomic<std::size_t> hit_count{0};
+        std::atomic<std::size_t> miss_count{0};
+        std::atomic<uint64_t> temp_counter{0};
+
+};
+
+}
+
+#endif
@@ -0,0 +1,433 @@
+#include "strip_processor.hpp"
+#include "angle_breaks.hpp"
+#include "contour_split.hpp"
+#include "image_loader.hpp"
+#include "trace.hpp"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+namespace fs = std::__fs::filesystem;
+
+namespace mosaic_gen {
+
+namespace {
+
+size_t matBytes(const cv::Mat& image) {
+    return image.total() * image.elemSize();
+}
+
+// Next header token of a PNM file, skipping whitespace and # comments
+bool readPnmToken(istream& in, string& token) {
+    token.clear();
+    int c = in.get();
+    while (c != EOF) {
+        if (c == '#') {
+            while (c != EOF && c != '\n') c = in.get();
+        }
+        else if (!isspace(c)) {
+            break;
+        }
+        c = in.get();
+    }
+    while (c != EOF && !isspace(c)) {
+        token.push_back(static_cast<char>(c));
+        c = in.get();
+    }
+    // the single whitespace after the last header field is consumed above
+    return !token.empty();
+}
+
+}
+
+
+bool MatStripSource::readRows(int y0, int y1, cv::Mat& out) {
+    if (image.empty() || y0 < 0 || y1 > image.rows || y0 >= y1) {
+        return false;
+    }
+    out = image.rowRange(y0, y1);
+    return true;
+}
+
+
+PnmStripSource::PnmStripSource(const std::string& path) : file(path, ios::binary) {
+    string magic, w, h, maxval;
+    if (!file || !readPnmToken(file, magic) || !readPnmToken(file, w) ||
+        !readPnmToken(file, h) || !readPnmToken(file, maxval)) {
+        cerr << "PnmStripSource: could not read header of: " << path << endl;
+        return;
+    }
+    if ((magic != "P5" && magic != "P6") || atoi(maxval.c_str()) != 255) {
+        cerr << "PnmStripSource: only 8-bit binary P5 / P6 is supported: " << path << endl;
+        return;
+    }
+
+    channels = magic == "P6" ? 3 : 1;
+    width = atoi(w.c_str());
+    height = atoi(h.c_str());
+    data_offset = file.tellg();
+}
+
+
+bool PnmStripSource::readRows(int y0, int y1, cv::Mat& out) {
+    if (!isOpen() || y0 < 0 || y1 > height || y0 >= y1) {
+        return false;
+    }
+
+    const streamoff row_bytes = static_cast<streamoff>(width) * channels;
+    cv::Mat& target = channels == 3 ? out : gray_rows;
+    target.create(y1 - y0, width, channels == 3 ? CV_8UC3 : CV_8UC1);
+
+    file.clear();
+    file.seekg(data_offset + row_bytes * y0);
+    file.read(reinterpret_cast<char*>(target.data), row_bytes * (y1 - y0));
+    if (!file) {
+        cerr << "PnmStripSource: truncated pixel data" << endl;
+        return false;
+    }
+
+    // P6 stores RGB
+    if (channels == 3) {
+        cv::cvtColor(out, out, cv::COLOR_BGR2RGB);
+    }
+    else {
+        cv::cvtColor(gray_rows, out, cv::COLOR_GRAY2BGR);
+    }
+    return true;
+}
+
+
+std::unique_ptr<StripSource> openStripSource(const std::string& path, double resize_factor, size_t memory_budget_bytes) {
+    string ext = fs::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return tolower(c); });
+
+    if (ext == ".pnm" || ext == ".ppm" || ext == ".pgm") {
+        auto source = make_unique<PnmStripSource>(path);
+        if (!source->isOpen()) {
+            return nullptr;
+        }
+        return source;
+    }
+
+    // leave the other half of the budget to the strips
+    LoadedImage decoded = decodeImage(path, resize_factor, memory_budget_bytes / 2);
+    if (decoded.empty()) {
+        cerr << "openStripSource: could not load image from path: " << path << endl;
+        return nullptr;
+    }
+    return make_unique<MatStripSource>(decoded.image, decoded.resize_factor, decoded.source_size);
+}
+
+
+StripProcessor::StripProcessor(const MosaicParams& params, const StreamingOptions& options)
+    : params(params), options(options) {}
+
+
+// Split the budget left after the source's own memory between the strip
+// buffers (3/4) and the carry band (1/4)
+void StripProcessor::planStrips(const StripSource& source) {
+    const cv::Size source_size = source.size();
+    const double r = scale = params.resize_factor / source.scale();
+    frame_size = cv::Size(cvRound(source_size.width * r), cvRound(source_size.height * r));
+
+    // Smallest working row step whose source offset is a whole row, so bands
+    // starting there resample exactly like the whole frame
+    align_rows = 0;
+    align_source_rows = 0;
+    for (int rows = 1; rows <= 256; ++rows) {
+        const double source_rows = rows / r;
+        if (abs(source_rows - std::round(source_rows)) < 1e-9) {
+            align_rows = rows;
+            align_source_rows = static_cast<int>(std::round(source_rows));
+            break;
+        }
+    }
+
+    int kernel_size = params.blur_kernel_size;
+    if (kernel_size % 2 == 0) {
+        kernel_size += 1;
+    }
+
+    // blur radius, Sobel 3x3, non-maximum suppression, hysteresis, band alignment
+    run_stats = StreamingStats();
+    run_stats.halo_rows = kernel_size / 2 + 2 + max(0, options.hysteresis_halo);
+
+    // per working row: source rows, resized BGR, gray, blurred, edges, and Canny's
+    // own dx / dy / magnitude / map buffers
+    const double width = max(1, frame_size.width);
+    const double strip_row_bytes = width * (3.0 / (r * r) + 3 + 1 + 1 + 1 + 16);
+    const double carry_row_bytes = width * (1 + 4 + 1 + 1);   // pending, labels, complete, carry
+
+    const double budget = max(0.0, static_cast<double>(options.memory_budget_bytes) - source.residentBytes());
+    const int fit_rows = static_cast<int>(budget * 0.75 / strip_row_bytes) - 2 * run_stats.halo_rows - max(0, align_rows - 1);
+
+    run_stats.strip_rows = min(max(fit_rows, max(1, options.min_strip_rows)), max(1, frame_size.height));
+    run_stats.max_carry_rows = max(run_stats.strip_rows, static_cast<int>(budget * 0.25 / carry_row_bytes));
+}
+
+
+// Working rows [h0, h1) from the source, h0 already on an aligned row when align_rows > 0
+bool StripProcessor::resampleRows(StripSource& source, int h0, int h1, cv::Mat& source_rows, cv::Mat& resized) {
+    const cv::Size source_size = source.size();
+    const double r = scale;
+
+    if (align_rows > 0) {
+        // cv::resize of the band maps dst row y to (y - h0 + 0.5) / r - 0.5 + s0, the
+        // whole-frame position, because s0 = h0 / r is a whole row
+        const int s0 = h0 / align_rows * align_source_rows;
+        const int s1 = min(source_size.height, s0 + cvCeil((h1 - h0) / r) + 2);
+        if (!source.readRows(s0, s1, source_rows)) {
+            return false;
+        }
+        cv::resize(source_rows, resized, cv::Size(), r, r, cv::INTER_LINEAR);
+
+        // the last band can come out a row short where rounding differs
+        if (resized.rows < h1 - h0) {
+            cv::copyMakeBorder(resized, resized, 0, h1 - h0 - resized.rows, 0, 0, cv::BORDER_REPLICATE);
+        }
+        resized = resized.rowRange(0, h1 - h0);
+        return true;
+    }
+
+    // Source rows under working rows [h0, h1), with a margin for the bilinear taps
+    const int s0 = max(0, cvFloor((h0 + 0.5) / r - 0.5) - 1);
+    const int s1 = min(source_size.height, cvCeil((h1 - 0.5) / r - 0.5) + 2);
+    if (!source.readRows(s0, s1, source_rows)) {
+        return false;
+    }
+
+    // Same pixel mapping as cv::resize(fx = fy = r): src = (dst + 0.5) / r - 0.5,
+    // with warpAffine's coarser interpolation weights
+    cv::Mat to_source = cv::Mat::zeros(2, 3, CV_64F);
+    to_source.at<double>(0, 0) = 1.0 / r;
+    to_source.at<double>(0, 2) = 0.5 / r - 0.5;
+    to_source.at<double>(1, 1) = 1.0 / r;
+    to_source.at<double>(1, 2) = (h0 + 0.5) / r - 0.5 - s0;
+    cv::warpAffine(source_rows, resized, to_source, cv::Size(frame_size.width, h1 - h0),
+                   cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+    return true;
+}
+
+
+// Trace every component of pending that is finished: all of them on the last strip,
+// otherwise those not touching its bottom row. The rest stays in pending.
+void StripProcessor::traceComplete(bool last_strip, float break_cos2, SegmentStore& segments) {
+    cv::Mat labels, stats, centroids;
+    const int count = cv::connectedComponentsWithStats(pending, labels, stats, centroids, 8, CV_32S);
+
+    vector<uint8_t> carried(count, 0);
+    int carried_count = 0;
+    int carry_top = pending.rows;
+    if (!last_strip) {
+        for (int label = 1; label < count; ++label) {
+            const int top = stats.at<int>(label, cv::CC_STAT_TOP);
+            if (top + stats.at<int>(label, cv::CC_STAT_HEIGHT) == pending.rows) {
+                carried[label] = 1;
+                carried_count++;
+                carry_top = min(carry_top, top);
+            }
+        }
+    }
+
+    // A component taller than the carry limit is cut here instead of growing the band
+    if (carried_count > 0 && pending.rows - carry_top > run_stats.max_carry_rows) {
+        run_stats.forced_cuts += carried_count;
+        fill(carried.begin(), carried.end(), 0);
+        carried_count = 0;
+        carry_top = pending.rows;
+    }
+
+    cv::Mat complete = pending;
+    cv::Mat carry;
+    if (carried_count > 0) {
+        complete = cv::Mat::zeros(pending.size(), CV_8U);
+        carry = cv::Mat::zeros(pending.size(), CV_8U);
+        for (int y = 0; y < pending.rows; ++y) {
+            const int* label_row = labels.ptr<int>(y);
+            uchar* complete_row = complete.ptr<uchar>(y);
+            uchar* carry_row = carry.ptr<uchar>(y);
+            for (int x = 0; x < pending.cols; ++x) {
+                const int label = label_row[x];
+                if (label != 0) {
+                    (carried[label] ? carry_row : complete_row)[x] = 255;
+                }
+            }
+        }
+    }
+
+    run_stats.peak_bytes = max(run_stats.peak_bytes, matBytes(pending) + matBytes(labels) + matBytes(carry) +
+                                                     (carried_count > 0 ? matBytes(complete) : 0));
+
+    // Contours of a component only depend on its own pixels, so tracing finished
+    // components on their own gives the same contours as a whole-frame pass
+    vector<vector<cv::Point>> contours;
+    cv::findContours(complete, contours, cv::RETR_LIST, cv::CHAIN_APPROX_NONE, cv::Point(0, pending_y0));
+
+    const int first = segments.size();
+    ContourScratch scratch;
+    for (const auto& contour : contours) {
+        segmentContour(contour, break_cos2, params.min_segment_length, params.segment_angle_window, scratch, segments);
+    }
+    // Segments only share pixels within a component, so resolving per strip
+    // matches Mosaic::detectContours; labels is done with and serves as scratch
+    segments.resolveOverlaps(first, cv::Rect(0, pending_y0, complete.cols, complete.rows), labels);
+    MOSAIC_TRACE_COUNTER("strip_contours", contours.size());
+
+    if (carried_count > 0) {
+        pending = carry.rowRange(carry_top, carry.rows).clone();
+        pending_y0 += carry_top;
+    }
+    else {
+        pending.release();
+    }
+}
+
+
+bool StripProcessor::run(StripSource& source, SegmentStore& segments, const StripCallback& on_strip) {
+    MOSAIC_TRACE_SCOPE("StripProcessor::run");
+
+    const cv::Size source_size = source.size();
+    if (source_size.area() == 0 || params.resize_factor <= 0.0 || source.scale() <= 0.0) {
+        cerr << "StripProcessor: empty source or invalid resize factor" << endl;
+        return false;
+    }
+
+    planStrips(source);
+    segments.reset(frame_size);
+    pending.release();
+    pending_y0 = 0;
+
+    int kernel_size = params.blur_kernel_size;
+    if (kernel_size % 2 == 0) {
+        kernel_size += 1;
+    }
+
+    const int halo = run_stats.halo_rows;
+    const float break_cos2 = angleBreakCos2(params.max_segment_angle_rad);
+
+    cv::Mat source_rows, resized, gray, blurred, edges;
+
+    for (int y0 = 0; y0 < frame_size.height; y0 += run_stats.strip_rows) {
+        MOSAIC_TRACE_SCOPE("StripProcessor::strip");
+        const int y1 = min(frame_size.height, y0 + run_stats.strip_rows);
+        int h0 = max(0, y0 - halo);
+        const int h1 = min(frame_size.height, y1 + halo);
+        if (align_rows > 0) {
+            h0 -= h0 % align_rows;
+        }
+
+        if (!resampleRows(source, h0, h1, source_rows, resized)) {
+            cerr << "StripProcessor: could not read the source rows of working rows " << h0 << " - " << h1 << endl;
+            return false;
+        }
+
+        cv::cvtColor(resized, gray, cv::COLOR_BGR2GRAY);
+        cv::GaussianBlur(gray, blurred, cv::Size(kernel_size, kernel_size), params.blur_sigma);
+        cv::Canny(blurred, edges, params.canny_threshold_1, params.canny_threshold_2);
+
+        run_stats.peak_bytes = max(run_stats.peak_bytes, source.residentBytes() + matBytes(source_rows) + matBytes(resized) +
+                                                         matBytes(gray) + matBytes(blurred) + matBytes(edges) + matBytes(pending));
+
+        // Keep the core rows, the halo only fed the kernels
+        const cv::Mat core_edges = edges.rowRange(y0 - h0, y1 - h0);
+        if (on_strip) {
+            on_strip(y0, resized.rowRange(y0 - h0, y1 - h0), core_edges);
+        }
+
+        if (pending.empty()) {
+            pending = core_edges.clone();
+            pending_y0 = y0;
+        }
+        else {
+            cv::vconcat(pending, core_edges, pending);
+        }
+
+        traceComplete(y1 == frame_size.height, break_cos2, segments);
+        run_stats.strips++;
+    }
+
+    MOSAIC_TRACE_COUNTER("strips", run_stats.strips);
+    MOSAIC_TRACE_COUNTER("segments", segments.size());
+    MOSAIC_TRACE_MEMORY("strip_buffers", run_stats.peak_bytes);
+    return true;
+}
+
+
+size_t streamingFrameBytes(cv::Size frame, const MosaicParams& params) {
+    size_t per_pixel = 3 + 1 + 3;          // resized, edges, canvas
+    if (params.tile_angle_lookup) {
+        per_pixel += 1 + 1 + 1 + 1 + 2;    // grayscale, blurred, orientation angle / coherence / distance
+    }
+    if (params.tile_mean_color) {
+        // TileColorSampler's upright tables, and the tilted ones for NEAREST_ROTATION
+        per_pixel += TileColorSampler::bytesPerPixel(frame, params.tile_color_accuracy == ColorAccuracy::NEAREST_ROTATION);
+    }
+    return static_cast<size_t>(max(0, frame.width)) * static_cast<size_t>(max(0, frame.height)) * per_pixel;
+}
+
+
+int runStreamingPipeline(Mosaic& mosaic, const std::string& path, const MosaicParams& params,
+                         const StreamingOptions& options, StreamingStats* stats) {
+    MOSAIC_TRACE_SCOPE("runStreamingPipeline");
+    std::unique_ptr<StripSource> source = openStripSource(path, params.resize_factor, options.memory_budget_bytes);
+    if (!source) {
+        return -1;
+    }
+
+    // Placement and rendering read the working-size frame, so it is put together
+    // from the strips and its share of the budget is set aside up front
+    const double r = params.resize_factor / source->scale();
+    const cv::Size frame(cvRound(source->size().width * r), cvRound(source->size().height * r));
+    const size_t frame_bytes = streamingFrameBytes(frame, params);
+    if (options.memory_budget_bytes > 0 && frame_bytes + source->residentBytes() >= options.memory_budget_bytes) {
+        cerr << "runStreamingPipeline: the " << frame.width << "x" << frame.height << " working frame of " << path
+             << " needs " << (frame_bytes >> 20) << " MB, more than the " << (options.memory_budget_bytes >> 20)
+             << " MB budget leaves; lower the resize factor" << endl;
+        return -1;
+    }
+    StreamingOptions strip_options = options;
+    if (options.memory_budget_bytes > 0) {
+        strip_options.memory_budget_bytes -= frame_bytes;
+    }
+
+    StripProcessor processor(params, strip_options);
+    SegmentStore segments;
+    cv::Mat resized, edges;
+    const bool ok = processor.run(*source, segments, [&](int y0, const cv::Mat& resized_rows, const cv::Mat& edge_rows) {
+        if (resized.empty()) {
+            resized.create(processor.frameSize(), CV_8UC3);
+            edges.create(processor.frameSize(), CV_8UC1);
+        }
+        resized_rows.copyTo(resized.rowRange(y0, y0 + resized_rows.rows));
+        edge_rows.copyTo(edges.rowRange(y0, y0 + edge_rows.rows));
+    });
+    if (stats) {
+        *stats = processor.stats();
+        stats->frame_bytes = frame_bytes;
+        stats->peak_bytes += frame_bytes;
+    }
+    const cv::Size file_size = source->fileSize();
+    source.reset();
+    if (!ok) {
+        return -1;
+    }
+
+    mosaic.adoptStages(path, file_size, params.resize_factor, resized, edges, std::move(segments));
+    if (mosaic.segments.empty()) {
+        return -1;
+    }
+
+    // the orientation field reads blurred, which the strips don't keep
+    if (params.tile_angle_lookup) {
+        mosaic.grayImage();
+        mosaic.blurImage(params.blur_kernel_size, params.blur_sigma);
+    }
+    mosaic.rankSegments();
+    return placeAndRender(mosaic, params, cv::Mat());
+}
+
+}
@@ -0,0 +1,199 @@
+#ifndef STRIP_PROCESSOR_HPP
+#define STRIP_PROCESSOR_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+#include "pipeline.hpp"
+#include "segment_store.hpp"
+
+namespace mosaic_gen {
+
+// Source image read a band of rows at a time
+class StripSource {
+
+    public:
+
+        virtual ~StripSource() = default;
+
+        virtual cv::Size size() const = 0;
+
+        // Rows [y0, y1) as CV_8UC3. out may share memory with the source.
+        virtual bool readRows(int y0, int y1, cv::Mat& out) = 0;
+
+        // Scale of size() relative to the file, below 1 when the decoder already reduced it
+        virtual double scale() const { return 1.0; }
+        virtual cv::Size fileSize() const { return size(); }
+
+        // Memory the source holds for the whole run, counted against the budget
+        virtual std::size_t residentBytes() const { return 0; }
+
+};
+
+
+// Image already in memory (decoded, or a view onto a mapped raw buffer)
+class MatStripSource : public StripSource {
+
+    public:
+
+        explicit MatStripSource(const cv::Mat& image) : image(image), file_size(image.size()) {}
+
+        // image is the file_size file decoded at scale (decodeImage)
+        MatStripSource(const cv::Mat& image, double scale, cv::Size file_size)
+            : image(image), image_scale(scale), file_size(file_size) {}
+
+        cv::Size size() const override { return image.size(); }
+        bool readRows(int y0, int y1, cv::Mat& out) override;
+
+        double scale() const override { return image_scale; }
+        cv::Size fileSize() const override { return file_size; }
+        std::size_t residentBytes() const override { return image.total() * image.elemSize(); }
+
+
+    private:
+
+        cv::Mat image;
+        double image_scale = 1.0;
+        cv::Size file_size;
+
+};
+
+
+// Binary PPM (P6) or PGM (P5) with 8-bit samples, read straight from disk
+// so only the requested rows are ever in memory
+class PnmStripSource : public StripSource {
+
+    public:
+
+        explicit PnmStripSource(const std::string& path);
+
+        bool isOpen() const { return width > 0 && height > 0; }
+        cv::Size size() const override { return cv::Size(width, height); }
+        bool readRows(int y0, int y1, cv::Mat& out) override;
+
+
+    private:
+
+        std::ifstream file;
+        std::streamoff data_offset = 0;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        cv::Mat gray_rows;
+
+};
+
+
+// PNM files stream from disk. Other formats can only be decoded whole: JPEGs at
+// the largest DCT reduction that stays at or above resize_factor, the rest at
+// full size. Those are refused (nullptr) when the decoded image would take more
+// than half of memory_budget_bytes (0 = no limit), or when the header has no
+// size to check; convert such scans to PNM to stream them.
+std::unique_ptr<StripSource> openStripSource(const std::string& path, double resize_factor = 1.0,
+                                             std::size_t memory_budget_bytes = 0);
+
+
+// memory_budget_bytes bounds the source side: the decoded source (non-PNM
+// files), the strip buffers and the carry band. runStreamingPipeline also
+// needs the working-size frame (resized, edges and the canvas, plus what
+// tile_angle_lookup / tile_mean_color add, see streamingFrameBytes) for
+// placement and rendering. It takes that from the same budget and refuses
+// the file when the frame doesn't fit, so lower resize_factor for scans whose
+// working frame is larger than the budget.
+struct StreamingOptions {
+    std::size_t memory_budget_bytes = std::size_t(256) << 20;
+    int min_strip_rows = 32;
+
+    // Extra halo rows for Canny hysteresis, which follows weak edges across any
+    // distance. Weak chains that leave the halo before reaching a strong pixel
+    // can differ from a whole-frame run near a seam.
+    int hysteresis_halo = 16;
+};
+
+
+struct StreamingStats {
+    int strips = 0;
+    int strip_rows = 0;
+    int halo_rows = 0;
+    int max_carry_rows = 0;
+    int forced_cuts = 0;           // components split because the carry band hit its limit
+    std::size_t peak_bytes = 0;    // largest sum of buffers held by the processor at once,
+                                   // plus frame_bytes when filled by runStreamingPipeline
+    std::size_t frame_bytes = 0;   // working-size images placement and rendering need
+};
+
+
+// Runs resize -> gray -> blur -> canny -> contours -> segments over horizontal
+// strips, so working memory follows memory_budget_bytes instead of the frame size.
+//
+// Each strip is padded by a halo covering the blur and Canny kernels and resampled
+// with cv::resize from a band of source rows starting where the whole-frame
+// mapping lands on a whole source row (every 4th working row at 0.8), so the band
+// gets the same taps and weights as a whole-frame resize. Measured on 6x upscaled
+// sample photos: identical at 0.25, 0.5, 0.8 and 1.0; at factors whose inverse is
+// inexact in binary (0.3, 0.37) about 1-2% of samples are off by one level.
+// Factors with no alignment within 256 rows fall back to warpAffine, whose
+// coarser interpolation weights put ~11% of samples one level off.
+//
+// Edge components touching the bottom of a strip are carried into the next one
+// and only traced once complete, so contours crossing a seam come out in one
+// piece. With the default halo, Canny hysteresis still changed 0.01-1% of the
+// edge pixels near seams in the same measurements (hysteresis_halo = 64: 0-0.2%).
+class StripProcessor {
+
+    public:
+
+        // y0 is the first working-frame row of the band
+        using StripCallback = std::function<void(int y0, const cv::Mat& resized_rows, const cv::Mat& edge_rows)>;
+
+        explicit StripProcessor(const MosaicParams& params, const StreamingOptions& options = StreamingOptions());
+
+        // Fill segments (reset to the working frame size). on_strip sees every band
+        // of resized / edge rows exactly once, top to bottom.
+        bool run(StripSource& source, SegmentStore& segments, const StripCallback& on_strip = nullptr);
+
+        cv::Size frameSize() const { return frame_size; }
+        const StreamingStats& stats() const { return run_stats; }
+
+
+    private:
+
+        void planStrips(const StripSource& source);
+        bool resampleRows(StripSource& source, int h0, int h1, cv::Mat& source_rows, cv::Mat& resized);
+        void traceComplete(bool last_strip, float break_cos2, SegmentStore& segments);
+
+        MosaicParams params;
+        StreamingOptions options;
+        StreamingStats run_stats;
+        cv::Size frame_size;
+        double scale = 1.0;          // source pixels to working pixels
+        int align_rows = 0;          // working rows per aligned band start, 0 = no exact alignment
+        int align_source_rows = 0;   // source rows per align_rows
+
+        // edges of components still open at the bottom of the last strip
+        cv::Mat pending;
+        int pending_y0 = 0;
+
+};
+
+
+// Working-size images runStreamingPipeline keeps besides the strips for a
+// frame of this size: resized, edges, canvas and the optional stage outputs
+std::size_t streamingFrameBytes(cv::Size frame, const MosaicParams& params);
+
+// Streaming counterpart of runPipeline for scans too large to decode whole:
+// StripProcessor detects the segments within what options.memory_budget_bytes
+// leaves after streamingFrameBytes, the working-size resized / edges are
+// assembled from its strips, then ranking, placement and rendering run as in
+// runPipeline. The working size can differ by a pixel from runPipeline's when a
+// JPEG was decoded reduced. Returns the number of placed tiles, or -1 when the
+// file or its working frame doesn't fit the budget, or has no segments.
+int runStreamingPipeline(Mosaic& mosaic, const std::string& path, const MosaicParams& params,
+                         const StreamingOptions& options, StreamingStats* stats = nullptr);
+
+}
+
+#endif
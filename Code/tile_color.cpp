@@ -0,0 +1,358 @@
+#include "tile_color.hpp"
+#include "graphics.hpp"
+#include "parallel.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace mosaic_gen {
+
+namespace {
+
+    // floor(a / 2) for negative a as well
+    inline int floorHalf(int a) {
+        return a >= 0 ? a / 2 : -((1 - a) / 2);
+    }
+
+    // 255 * pixels must fit in cv::integral's CV_32S sums
+    bool fitsIntSums(cv::Size frame) {
+        return 255.0 * frame.width * frame.height <= std::numeric_limits<int32_t>::max();
+    }
+
+}
+
+
+TileColorSampler::TiltedMoments& TileColorSampler::TiltedMoments::operator+=(const TiltedMoments& other) {
+    for (int c = 0; c < 3; ++c) {
+        sum[c] += other.sum[c];
+        sqsum[c] += other.sqsum[c];
+    }
+    count += other.count;
+    return *this;
+}
+
+
+TileColorSampler::TiltedMoments& TileColorSampler::TiltedMoments::operator-=(const TiltedMoments& other) {
+    for (int c = 0; c < 3; ++c) {
+        sum[c] -= other.sum[c];
+        sqsum[c] -= other.sqsum[c];
+    }
+    count -= other.count;
+    return *this;
+}
+
+
+TileColorSampler::Moments TileColorSampler::TiltedMoments::moments() const {
+    Moments m;
+    for (int c = 0; c < 3; ++c) {
+        m[c] = sum[c];
+        m[c + 3] = static_cast<double>(sqsum[c]);
+    }
+    m[6] = count;
+    return m;
+}
+
+
+void TileColorSampler::clear() {
+    rows = 0;
+    cols = 0;
+    sum.release();
+    sqsum.release();
+    cone.clear();
+    diagonal.clear();
+    anti.clear();
+    diff.clear();
+    total = TiltedMoments();
+}
+
+
+std::size_t TileColorSampler::memoryBytes() const {
+    return sum.total() * sum.elemSize() + sqsum.total() * sqsum.elemSize() +
+           (cone.size() + diagonal.size() + anti.size() + diff.size()) * sizeof(TiltedMoments);
+}
+
+
+std::size_t TileColorSampler::bytesPerPixel(cv::Size frame, bool tilted) {
+    const std::size_t upright = fitsIntSums(frame) ? 3 * sizeof(int32_t) + 3 * sizeof(double) : 6 * sizeof(double);
+    // cone and diagonal per pixel; anti and diff only grow with rows + cols
+    return upright + (tilted ? 2 * sizeof(TiltedMoments) : 0);
+}
+
+
+void TileColorSampler::build(const cv::Mat& image, bool tilted) {
+    clear();
+    if (image.empty() || image.type() != CV_8UC3) {
+        std::cerr << "TileColorSampler needs a CV_8UC3 image" << std::endl;
+        return;
+    }
+
+    MOSAIC_TRACE_SCOPE("TileColorSampler::build");
+    rows = image.rows;
+    cols = image.cols;
+    cv::integral(image, sum, sqsum, fitsIntSums(image.size()) ? CV_32S : CV_64F, CV_64F);
+
+    if (!tilted) {
+        MOSAIC_TRACE_MEMORY("tile_color_tables", memoryBytes());
+        return;
+    }
+
+    // Each row needs the two above it, so the tilted tables are built in one pass
+    cone.assign(static_cast<size_t>(rows) * cols, TiltedMoments());
+    diagonal.assign(static_cast<size_t>(rows) * cols, TiltedMoments());
+    anti.assign(rows + cols - 1, TiltedMoments());
+    diff.assign(rows + cols - 1, TiltedMoments());
+
+    std::vector<TiltedMoments> pixel_row(cols), previous_row(cols);
+    for (int y = 0; y < rows; ++y) {
+        const cv::Vec3b* src = image.ptr<cv::Vec3b>(y);
+        for (int x = 0; x < cols; ++x) {
+            TiltedMoments& m = pixel_row[x];
+            for (int c = 0; c < 3; ++c) {
+                const uint32_t v = src[x][c];
+                m.sum[c] = v;
+                m.sqsum[c] = v * v;
+            }
+            m.count = 1;
+            anti[x + y] += m;
+            diff[x - y + rows - 1] += m;
+            total += m;
+        }
+
+        TiltedMoments* cone_row = &cone[static_cast<size_t>(y) * cols];
+        TiltedMoments* diagonal_row = &diagonal[static_cast<size_t>(y) * cols];
+        for (int x = 0; x < cols; ++x) {
+            // C(x, y) = C(x-1, y-1) + C(x+1, y-1) - C(x, y-2) + I(x, y) + I(x, y-1)
+            TiltedMoments m = pixel_row[x];
+            if (y > 0) {
+                m += coneAt(x - 1, y - 1) + coneAt(x + 1, y - 1) - coneAt(x, y - 2) + previous_row[x];
+            }
+            cone_row[x] = m;
+            diagonal_row[x] = pixel_row[x] + (x > 0 && y > 0 ? diagonal[static_cast<size_t>(y - 1) * cols + x - 1] : TiltedMoments());
+        }
+        std::swap(pixel_row, previous_row);
+    }
+
+    for (size_t s = 1; s < anti.size(); ++s) anti[s] += anti[s - 1];
+    for (size_t d = diff.size() - 1; d-- > 0;) diff[d] += diff[d + 1];
+
+    MOSAIC_TRACE_MEMORY("tile_color_tables", memoryBytes());
+}
+
+
+TileColorSampler::Moments TileColorSampler::box(int x0, int y0, int x1, int y1) const {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, cols);
+    y1 = std::min(y1, rows);
+    if (x0 >= x1 || y0 >= y1) {
+        return Moments();
+    }
+
+    const cv::Vec3d* sq_top = sqsum.ptr<cv::Vec3d>(y0);
+    const cv::Vec3d* sq_bottom = sqsum.ptr<cv::Vec3d>(y1);
+    Moments m;
+    if (sum.depth() == CV_32S) {
+        const cv::Vec3i* sum_top = sum.ptr<cv::Vec3i>(y0);
+        const cv::Vec3i* sum_bottom = sum.ptr<cv::Vec3i>(y1);
+        for (int c = 0; c < 3; ++c) {
+            m[c] = static_cast<double>(int64_t(sum_bottom[x1][c]) - sum_top[x1][c] - sum_bottom[x0][c] + sum_top[x0][c]);
+        }
+    }
+    else {
+        const cv::Vec3d* sum_top = sum.ptr<cv::Vec3d>(y0);
+        const cv::Vec3d* sum_bottom = sum.ptr<cv::Vec3d>(y1);
+        for (int c = 0; c < 3; ++c) {
+            m[c] = sum_bottom[x1][c] - sum_top[x1][c] - sum_bottom[x0][c] + sum_top[x0][c];
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        m[c + 3] = sq_bottom[x1][c] - sq_top[x1][c] - sq_bottom[x0][c] + sq_top[x0][c];
+    }
+    m[6] = static_cast<double>(x1 - x0) * (y1 - y0);
+    return m;
+}
+
+
+TileColorSampler::Moments TileColorSampler::rowSpan(int y, int x0, int x1) const {
+    return box(x0, y, x1, y + 1);
+}
+
+
+TileColorSampler::TiltedMoments TileColorSampler::antiPrefix(int s_max) const {
+    if (s_max < 0) return TiltedMoments();
+    if (s_max >= static_cast<int>(anti.size())) return total;
+    return anti[s_max];
+}
+
+
+TileColorSampler::TiltedMoments TileColorSampler::diffSuffix(int d_min) const {
+    const int index = d_min + rows - 1;
+    if (index >= static_cast<int>(diff.size())) return TiltedMoments();
+    if (index < 0) return total;
+    return diff[index];
+}
+
+
+// Cone sums for apexes outside the frame reduce to one inside it: cutting the
+// cone at the left edge leaves the cone of (0, y + x), at the right edge the
+// cone of (cols - 1, y - (x - cols + 1)). Below the last row the cone is
+// wider than the frame is tall and its two diagonal sides never meet inside
+// it, so it is the two half planes minus everything.
+TileColorSampler::TiltedMoments TileColorSampler::coneAt(int x, int y) const {
+    while (true) {
+        if (y < 0) {
+            return TiltedMoments();
+        }
+        if (y >= rows) {
+            return antiPrefix(x + y) + diffSuffix(x - y) - total;
+        }
+        if (x < 0) {
+            y += x;
+            x = 0;
+        }
+        else if (x >= cols) {
+            y -= x - (cols - 1);
+            x = cols - 1;
+        }
+        else {
+            return cone[static_cast<size_t>(y) * cols + x];
+        }
+    }
+}
+
+
+// Pixels on the diagonal x - y = d with x + y <= s_max
+TileColorSampler::TiltedMoments TileColorSampler::diagonalAt(int d, int s_max) const {
+    int x = floorHalf(s_max + d);
+    int y = x - d;
+    const int back = std::max({0, x - (cols - 1), y - (rows - 1)});
+    x -= back;
+    y -= back;
+    if (x < 0 || y < 0) {
+        return TiltedMoments();
+    }
+    return diagonal[static_cast<size_t>(y) * cols + x];
+}
+
+
+TileColorSampler::TiltedMoments TileColorSampler::diagonalQuadrant(int s_max, int d_min) const {
+    // a cone apex (x, y) has x + y and x - y of the same parity, the odd
+    // quadrants are the next cone plus the diagonal that separates them
+    if (((s_max - d_min) & 1) != 0) {
+        return diagonalQuadrant(s_max, d_min + 1) + diagonalAt(d_min, s_max);
+    }
+    return coneAt((s_max + d_min) / 2, (s_max - d_min) / 2);
+}
+
+
+// Pixels whose centers satisfy |dx| + |dy| <= radius: a rectangle in
+// (s, d) = (x + y, x - y), taken as four diagonal quadrants
+TileColorSampler::Moments TileColorSampler::diamond(float cx, float cy, float radius) const {
+    // pixel (x, y) has center (x + 0.5, y + 0.5), so s + 1 is compared to cx + cy
+    const int s0 = static_cast<int>(std::ceil(cx + cy - 1.0f - radius));
+    const int s1 = static_cast<int>(std::floor(cx + cy - 1.0f + radius));
+    const int d0 = static_cast<int>(std::ceil(cx - cy - radius));
+    const int d1 = static_cast<int>(std::floor(cx - cy + radius));
+    if (s0 > s1 || d0 > d1) {
+        return Moments();
+    }
+    return (diagonalQuadrant(s1, d0) - diagonalQuadrant(s0 - 1, d0) - diagonalQuadrant(s1, d1 + 1) + diagonalQuadrant(s0 - 1, d1 + 1)).moments();
+}
+
+
+TileColor TileColorSampler::sample(const cv::Point2f& center, float size, float angle_deg, ColorAccuracy accuracy) const {
+    TileColor color;
+    if (empty()) {
+        return color;
+    }
+
+    const float half = std::max(0.0f, size / 2.0f);
+    const float theta = static_cast<float>(angle_deg * M_PI / 180.0);
+    const float cos_t = std::cos(theta);
+    const float sin_t = std::sin(theta);
+    const float spread = std::fabs(cos_t) + std::fabs(sin_t);
+
+    // pixel x is in an upright box of half side e when x + 0.5 is within e of cx
+    auto upright = [&](float extent) {
+        return box(static_cast<int>(std::ceil(center.x - extent - 0.5f)),
+                   static_cast<int>(std::ceil(center.y - extent - 0.5f)),
+                   static_cast<int>(std::floor(center.x + extent - 0.5f)) + 1,
+                   static_cast<int>(std::floor(center.y + extent - 0.5f)) + 1);
+    };
+
+    Moments sum;
+    switch (accuracy) {
+        case ColorAccuracy::BOUNDING_BOX:
+            sum = upright(half * spread);
+            break;
+
+        case ColorAccuracy::INSCRIBED:
+            sum = upright(half / spread);
+            break;
+
+        case ColorAccuracy::NEAREST_ROTATION: {
+            const float folded = std::fmod(std::fabs(angle_deg), 90.0f);
+            if (!hasTilted() || folded < 22.5f || folded > 67.5f) {
+                sum = upright(half);
+            }
+            else {
+                // a diamond of radius half * sqrt(2) has the square's area
+                sum = diamond(center.x, center.y, half * static_cast<float>(M_SQRT2));
+            }
+            break;
+        }
+
+        case ColorAccuracy::EXACT: {
+            const float reach = half * spread;
+            const int y0 = std::max(0, static_cast<int>(std::ceil(center.y - reach - 0.5f)));
+            const int y1 = std::min(rows - 1, static_cast<int>(std::floor(center.y + reach - 0.5f)));
+            for (int y = y0; y <= y1; ++y) {
+                int x0, x1;
+                Graphics::squareRowSpan(center, cos_t, sin_t, half, y + 0.5f, x0, x1);
+                x0 = std::max(x0, 0);
+                x1 = std::min(x1, cols);
+                if (x0 < x1) {
+                    sum += rowSpan(y, x0, x1);
+                }
+            }
+            break;
+        }
+    }
+
+    if (sum[6] < 0.5) {
+        // smaller than a pixel or off the frame: the pixel under the clamped center
+        const int x = std::min(std::max(static_cast<int>(std::floor(center.x)), 0), cols - 1);
+        const int y = std::min(std::max(static_cast<int>(std::floor(center.y)), 0), rows - 1);
+        sum = box(x, y, x + 1, y + 1);
+    }
+
+    const double pixels = sum[6];
+    color.pixels = static_cast<int>(std::lround(pixels));
+    for (int c = 0; c < 3; ++c) {
+        const double mean = sum[c] / pixels;
+        color.mean[c] = static_cast<float>(mean);
+        color.variance[c] = static_cast<float>(std::max(0.0, sum[c + 3] / pixels - mean * mean));
+    }
+    return color;
+}
+
+
+std::vector<TileColor> TileColorSampler::sample(const std::vector<TilePlacement>& tiles, ColorAccuracy accuracy, int threads) const {
+    MOSAIC_TRACE_SCOPE("TileColorSampler::sample");
+    std::vector<TileColor> colors(tiles.size());
+
+    const size_t chunk = 2048;
+    parallelFor((tiles.size() + chunk - 1) / chunk, threads, [&](size_t task) {
+        const size_t end = std::min(tiles.size(), (task + 1) * chunk);
+        for (size_t i = task * chunk; i < end; ++i) {
+            const TilePlacement& tile = tiles[i];
+            colors[i] = sample(cv::Point2f(tile.center.x, tile.center.y), static_cast<float>(tile.size),
+                               static_cast<float>(tile.squareAngleDeg()), accuracy);
+        }
+    });
+    return colors;
+}
+
+}
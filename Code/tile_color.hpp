@@ -0,0 +1,107 @@
+#ifndef TILE_COLOR_HPP
+#define TILE_COLOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "tile_placer.hpp"
+
+namespace mosaic_gen {
+
+// How closely a query follows the oriented square. All but EXACT are O(1).
+enum class ColorAccuracy {
+    BOUNDING_BOX,       // axis-aligned box around the rotated square, bleeds into neighbours
+    INSCRIBED,          // largest axis-aligned box inside the square, misses its corners
+    NEAREST_ROTATION,   // same-area square at the closest of 0 / 45 degrees (needs tilted tables, else upright)
+    EXACT               // every pixel whose center is inside, one table lookup per row: O(side)
+};
+
+
+struct TileColor {
+    cv::Vec3f mean;       // BGR
+    cv::Vec3f variance;   // per channel
+    int pixels = 0;       // pixels averaged
+};
+
+
+// Mean and variance of the BGR pixels under oriented squares, from summed-area
+// tables of the pixel values and their squares built once per image: cv::integral
+// with CV_64F square sums and CV_32S sums, 36 bytes per pixel. Above 8.4 MP the
+// frame's sum no longer fits in an int, so the sums are CV_64F too, 48 bytes
+// per pixel. Upright pixel counts follow from the box size.
+//
+// The tilted tables are the 45 degree counterpart (Lienhart's rotated SAT): a
+// cone sum per pixel plus a diagonal prefix and two 1D tables for cones that
+// leave the frame. Their entries carry a pixel count, as clipped diamonds have
+// no closed-form area, and add 80 bytes per pixel, so they are only built on request.
+// Coverage follows the rasterizer: a pixel counts when its center is inside,
+// so EXACT averages exactly the pixels Graphics::drawTiles would fill.
+class TileColorSampler {
+
+    public:
+
+        // image CV_8UC3
+        void build(const cv::Mat& image, bool tilted = false);
+        void clear();
+        bool empty() const { return rows == 0; }
+        bool hasTilted() const { return !cone.empty(); }
+        std::size_t memoryBytes() const;
+
+        // What build() allocates per pixel of a frame this size
+        static std::size_t bytesPerPixel(cv::Size frame, bool tilted);
+
+        // Same center / size / angle convention as Graphics::drawSquare
+        TileColor sample(const cv::Point2f& center, float size, float angle_deg, ColorAccuracy accuracy) const;
+
+        // One TileColor per placement, in order, split over threads
+        std::vector<TileColor> sample(const std::vector<TilePlacement>& tiles, ColorAccuracy accuracy, int threads = 1) const;
+
+
+    private:
+
+        // b, g, r sums, b^2, g^2, r^2 sums and the pixel count, accumulated per query
+        typedef cv::Vec<double, 7> Moments;
+
+        // Tilted table entry. Like the upright sums these wrap around; only the
+        // final diamond is converted, and its sums fit.
+        struct TiltedMoments {
+            uint32_t sum[3] = {0, 0, 0};
+            uint32_t count = 0;
+            uint64_t sqsum[3] = {0, 0, 0};
+
+            TiltedMoments& operator+=(const TiltedMoments& other);
+            TiltedMoments& operator-=(const TiltedMoments& other);
+            TiltedMoments operator+(const TiltedMoments& other) const { TiltedMoments m = *this; return m += other; }
+            TiltedMoments operator-(const TiltedMoments& other) const { TiltedMoments m = *this; return m -= other; }
+            Moments moments() const;
+        };
+
+        Moments box(int x0, int y0, int x1, int y1) const;   // [x0, x1) x [y0, y1), clipped
+        Moments rowSpan(int y, int x0, int x1) const;
+        Moments diamond(float cx, float cy, float radius) const;
+
+        // Tilted lookups: pixels with x + y <= s_max and x - y >= d_min
+        TiltedMoments diagonalQuadrant(int s_max, int d_min) const;
+        TiltedMoments coneAt(int x, int y) const;
+        TiltedMoments diagonalAt(int d, int s_max) const;
+        TiltedMoments antiPrefix(int s_max) const;
+        TiltedMoments diffSuffix(int d_min) const;
+
+        int rows = 0;
+        int cols = 0;
+
+        cv::Mat sum;      // CV_32SC3 or CV_64FC3 (rows + 1) x (cols + 1), zero first row and column
+        cv::Mat sqsum;    // CV_64FC3, same layout
+
+        std::vector<TiltedMoments> cone;       // rows x cols: y' <= y and |x' - x| <= y - y'
+        std::vector<TiltedMoments> diagonal;   // rows x cols: x' - y' = x - y and y' <= y
+        std::vector<TiltedMoments> anti;       // by s = x + y: pixels with x' + y' <= s
+        std::vector<TiltedMoments> diff;       // by d = x - y + rows - 1: pixels with x' - y' >= d
+        TiltedMoments total;
+
+};
+
+}
+
+#endif
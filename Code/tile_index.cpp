@@ -0,0 +1,146 @@
+#include "tile_index.hpp"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace mosaic_gen {
+
+void OrientedSquare::corners(cv::Point2d out[4]) const {
+    const double half = size / 2.0;
+    const double theta = angle_deg * M_PI / 180.0;
+    const double c = std::cos(theta);
+    const double s = std::sin(theta);
+
+    const double px[4] = {-half, half, half, -half};
+    const double py[4] = {-half, -half, half, half};
+    for (int i = 0; i < 4; ++i) {
+        out[i] = cv::Point2d(center.x + px[i] * c - py[i] * s, center.y + px[i] * s + py[i] * c);
+    }
+}
+
+
+TileIndex::TileIndex(cv::Size frame_size, double cell_size, double min_gap)
+    : frame_size(frame_size), cell_size(std::max(1.0, cell_size)), min_gap(std::max(0.0, min_gap)) {
+    grid_cols = std::max(1, static_cast<int>(std::ceil(frame_size.width / this->cell_size)));
+    grid_rows = std::max(1, static_cast<int>(std::ceil(frame_size.height / this->cell_size)));
+    cells.resize(static_cast<std::size_t>(grid_cols) * grid_rows);
+}
+
+
+TileIndex::Footprint TileIndex::footprint(const OrientedSquare& square) const {
+    const double theta = square.angle_deg * M_PI / 180.0;
+    return Footprint{
+        square.center.x, square.center.y,
+        std::cos(theta), std::sin(theta),
+        square.size / 2.0 + min_gap / 2.0
+    };
+}
+
+
+bool TileIndex::separated(const Footprint& a, const Footprint& b) {
+    const double dx = b.x - a.x;
+    const double dy = b.y - a.y;
+
+    // Four candidate axes: the side directions of both squares. A square with
+    // half size h and axes (u, v) projects onto unit axis n with radius
+    // h * (|u.n| + |v.n|).
+    const double axes[4][2] = {
+        {a.ux, a.uy}, {-a.uy, a.ux},
+        {b.ux, b.uy}, {-b.uy, b.ux}
+    };
+
+    for (const auto& n : axes) {
+        const double dist = std::abs(dx * n[0] + dy * n[1]);
+        const double ra = a.half * (std::abs(a.ux * n[0] + a.uy * n[1]) + std::abs(-a.uy * n[0] + a.ux * n[1]));
+        const double rb = b.half * (std::abs(b.ux * n[0] + b.uy * n[1]) + std::abs(-b.uy * n[0] + b.ux * n[1]));
+        if (dist >= ra + rb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+cv::Rect TileIndex::cellRange(const Footprint& f) const {
+    // axis-aligned half extent of the rotated (inflated) square
+    const double extent = f.half * (std::abs(f.ux) + std::abs(f.uy));
+
+    auto to_cell = [&](double v, int count) {
+        return std::clamp(static_cast<int>(std::floor(v / cell_size)), 0, count - 1);
+    };
+
+    const int x0 = to_cell(f.x - extent, grid_cols);
+    const int x1 = to_cell(f.x + extent, grid_cols);
+    const int y0 = to_cell(f.y - extent, grid_rows);
+    const int y1 = to_cell(f.y + extent, grid_rows);
+    return cv::Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+
+bool TileIndex::overlaps(const OrientedSquare& square) const {
+    const Footprint f = footprint(square);
+    const cv::Rect range = cellRange(f);
+
+    for (int cy = range.y; cy < range.y + range.height; ++cy) {
+        for (int cx = range.x; cx < range.x + range.width; ++cx) {
+            for (int id : cells[static_cast<std::size_t>(cy) * grid_cols + cx]) {
+                // both footprints carry min_gap / 2, so together they keep min_gap apart
+                if (!separated(f, footprints[id])) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+
+void TileIndex::insert(const OrientedSquare& square) {
+    const int id = static_cast<int>(tiles.size());
+    const Footprint f = footprint(square);
+    tiles.push_back(square);
+    footprints.push_back(f);
+
+    const cv::Rect range = cellRange(f);
+    for (int cy = range.y; cy < range.y + range.height; ++cy) {
+        for (int cx = range.x; cx < range.x + range.width; ++cx) {
+            cells[static_cast<std::size_t>(cy) * grid_cols + cx].push_back(id);
+        }
+    }
+}
+
+
+bool TileIndex::tryInsert(const OrientedSquare& square) {
+    if (overlaps(square)) {
+        return false;
+    }
+    insert(square);
+    return true;
+}
+
+
+void TileIndex::clear() {
+    tiles.clear();
+    footprints.clear();
+    for (auto& cell : cells) {
+        cell.clear();
+    }
+}
+
+
+void TileIndex::renderMask(cv::Mat& mask) const {
+    mask.create(frame_size, CV_8UC1);
+    mask.setTo(cv::Scalar(0));
+
+    cv::Point2d corners[4];
+    cv::Point polygon[4];
+    for (const auto& tile : tiles) {
+        tile.corners(corners);
+        for (int i = 0; i < 4; ++i) {
+            polygon[i] = cv::Point(cvRound(corners[i].x), cvRound(corners[i].y));
+        }
+        cv::fillConvexPoly(mask, polygon, 4, cv::Scalar(255));
+    }
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef TILE_INDEX_HPP
+#define TILE_INDEX_HPP
+
+#include <cstddef>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+// Square tile with the same center / size / angle convention as Graphics::drawSquare
+struct OrientedSquare {
+    cv::Point2d center;
+    double size = 0.0;
+    double angle_deg = 0.0;
+
+    OrientedSquare() = default;
+    OrientedSquare(const cv::Point2d& center, double size, double angle_deg)
+        : center(center), size(size), angle_deg(angle_deg) {}
+
+    void corners(cv::Point2d out[4]) const;
+};
+
+
+// Occupancy index for placed tiles, replacing the raster mask checks of the
+// notebook's is_valid_square. Tiles are bucketed in a uniform grid by their
+// bounding box and candidates are tested with an exact separating-axis test,
+// so a check touches a handful of tiles no matter how large they are.
+//
+// min_gap keeps tiles apart by inflating every square by min_gap / 2 per side,
+// i.e. the gap is measured along the separating axis.
+class TileIndex {
+
+    public:
+
+        // cell_size around the typical tile size + min_gap keeps buckets small
+        TileIndex(cv::Size frame_size, double cell_size, double min_gap = 0.0);
+
+        bool overlaps(const OrientedSquare& square) const;
+        void insert(const OrientedSquare& square);
+
+        // insert only if the square is free, returns whether it was placed
+        bool tryInsert(const OrientedSquare& square);
+
+        void clear();
+        std::size_t size() const { return tiles.size(); }
+        const std::vector<OrientedSquare>& placed() const { return tiles; }
+        double minGap() const { return min_gap; }
+
+        // Filled CV_8UC1 mask of every placed tile (255 = occupied), for debugging or
+        // code that still wants the raster view
+        void renderMask(cv::Mat& mask) const;
+
+
+    private:
+
+        // Precomputed axis and inflated half size for the SAT test
+        struct Footprint {
+            double x, y;
+            double ux, uy;   // first side direction, the other is (-uy, ux)
+            double half;
+        };
+
+        Footprint footprint(const OrientedSquare& square) const;
+        static bool separated(const Footprint& a, const Footprint& b);
+        cv::Rect cellRange(const Footprint& f) const;
+
+        cv::Size frame_size;
+        double cell_size;
+        double min_gap;
+        int grid_cols;
+        int grid_rows;
+
+        std::vector<OrientedSquare> tiles;
+        std::vector<Footprint> footprints;
+        std::vector<std::vector<int>> cells;   // tile ids per grid cell, row major
+
+};
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include "tile_placer.hpp"
+#include <opencv2/imgproc.hpp>
+#include <cmath>
+
+namespace mosaic_gen {
+
+TilePlacer::TilePlacer(double decay_rate, int band_half_width)
+    : decay_rate(decay_rate), band_half_width(std::max(0, band_half_width)) {}
+
+
+void TilePlacer::setGuide(const cv::Mat& image) {
+    if (image.channels() == 1) {
+        guide = image;
+    }
+    else {
+        cv::cvtColor(image, guide, cv::COLOR_BGR2GRAY);
+    }
+
+    // linear offsets depend on the row step of the guide
+    for (auto& [key, t] : tables) {
+        for (std::size_t i = 0; i < t.linear.size(); ++i) {
+            t.linear[i] = t.dy[i] * static_cast<int>(guide.step1()) + t.dx[i];
+        }
+    }
+}
+
+
+const TilePlacer::SampleTable& TilePlacer::table(int size, int theta_deg) {
+    const int64_t key = (static_cast<int64_t>(size) << 32) | static_cast<uint32_t>(theta_deg);
+    auto it = tables.find(key);
+    if (it != tables.end()) {
+        return it->second;
+    }
+
+    SampleTable& t = tables[key];
+
+    const double angle_rad = theta_deg * M_PI / 180.0;
+    const double c = std::cos(angle_rad);
+    const double s = std::sin(angle_rad);
+    const double half = size / 2.0;
+
+    // Python's -size // 2 rounds toward negative infinity
+    const int dx_min = -((size + 1) / 2);
+    const int dx_max = size / 2;
+
+    std::vector<float> band_weights(band_half_width + 1, 1.0f);
+    for (int offset = 1; offset <= band_half_width; ++offset) {
+        band_weights[offset] = static_cast<float>(std::exp(-decay_rate * (offset / half) * (offset / half)));
+    }
+
+    auto add_sample = [&](int dy, int dx, float weight) {
+        // rotate (dy, dx) about the center, same convention as the notebook
+        const int y = cvRound(dy * c - dx * s);
+        const int x = cvRound(dy * s + dx * c);
+        t.dx.push_back(static_cast<int16_t>(x));
+        t.dy.push_back(static_cast<int16_t>(y));
+        t.weight.push_back(weight);
+        t.linear.push_back(y * static_cast<int>(guide.step1()) + x);
+        t.radius = std::max(t.radius, std::max(std::abs(x), std::abs(y)));
+    };
+
+    const std::size_t group = 1 + 2 * band_half_width;
+    t.dx.reserve((dx_max - dx_min + 1) * group);
+    t.dy.reserve((dx_max - dx_min + 1) * group);
+    t.weight.reserve((dx_max - dx_min + 1) * group);
+    t.linear.reserve((dx_max - dx_min + 1) * group);
+
+    for (int dx = dx_min; dx <= dx_max; ++dx) {
+        add_sample(0, dx, 1.0f);
+        for (int offset = 1; offset <= band_half_width; ++offset) {
+            add_sample(offset, dx, band_weights[offset]);
+            add_sample(-offset, dx, band_weights[offset]);
+        }
+    }
+
+    return t;
+}
+
+
+double TilePlacer::gather(const SampleTable& t, const cv::Point& center) const {
+    const std::size_t count = t.weight.size();
+    double reward = 0.0;
+
+    // Whole tile inside the guide: integer gathers with no bounds checks
+    if (center.x - t.radius >= 0 && center.x + t.radius < guide.cols &&
+        center.y - t.radius >= 0 && center.y + t.radius < guide.rows) {
+        const uchar* base = guide.ptr<uchar>(center.y) + center.x;
+        for (std::size_t i = 0; i < count; ++i) {
+            reward += t.weight[i] * base[t.linear[i]];
+        }
+        return reward;
+    }
+
+    // Near the border: off-line samples only count when their centerline pixel is inside
+    const std::size_t group = 1 + 2 * band_half_width;
+    for (std::size_t g = 0; g < count; g += group) {
+        const int cx = center.x + t.dx[g];
+        const int cy = center.y + t.dy[g];
+        if (cx < 0 || cx >= guide.cols || cy < 0 || cy >= guide.rows) {
+            continue;
+        }
+        reward += guide.at<uchar>(cy, cx);
+
+        for (std::size_t i = g + 1; i < g + group; ++i) {
+            const int x = center.x + t.dx[i];
+            const int y = center.y + t.dy[i];
+            if (x >= 0 && x < guide.cols && y >= 0 && y < guide.rows) {
+                reward += t.weight[i] * guide.at<uchar>(y, x);
+            }
+        }
+    }
+    return reward;
+}
+
+
+double TilePlacer::reward(const cv::Point& center, int size, int theta_deg) {
+    if (guide.empty()) {
+        return 0.0;
+    }
+    return gather(table(size, theta_deg), center);
+}
+
+
+TilePlacement TilePlacer::findBestTheta(const cv::Point& center, int size, int theta_min, int theta_max, int coarse_step) {
+    return findBestTheta(center, size, theta_min, theta_max, coarse_step,
+                         [](const cv::Point&, int, int) { return true; });
+}
+
+}
@@ -0,0 +1,157 @@
+#ifndef TILE_PLACER_HPP
+#define TILE_PLACER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+struct TilePlacement {
+    cv::Point center;
+    int size = 0;
+    int theta_deg = 0;    // notebook convention, the centerline runs along (cos, -sin)
+    double reward = -std::numeric_limits<double>::infinity();
+    int evaluations = 0;   // rewards computed during the search
+    bool valid = false;    // false when no angle in range was allowed
+
+    // Angle to pass to Graphics::drawSquare so the tile sides follow the centerline
+    double squareAngleDeg() const { return -theta_deg; }
+};
+
+
+// Finds the tile angle whose centerline best follows the bright pixels of a
+// guide image (selected_segment or edges). Port of the notebook's
+// reward_function / find_best_theta.
+//
+// Sample offsets and Gaussian falloff weights are built once per (size, theta)
+// and cached, so scoring an angle is a plain gather over the guide. The cache
+// is not shared between threads; use one TilePlacer per worker.
+class TilePlacer {
+
+    public:
+
+        // decay_rate and band_half_width shape the falloff across the centerline
+        TilePlacer(double decay_rate = 2.0, int band_half_width = 5);
+
+        // CV_8UC1 guide, color guides are converted to gray
+        void setGuide(const cv::Mat& guide);
+
+        double reward(const cv::Point& center, int size, int theta_deg);
+
+        // Coarse-to-fine search over [theta_min, theta_max]: every coarse_step
+        // degrees first, then halving steps around the best coarse candidates.
+        // coarse_step <= 1 evaluates every degree like the notebook.
+        TilePlacement findBestTheta(const cv::Point& center, int size, int theta_min = -45, int theta_max = 45, int coarse_step = 8);
+
+        // Same search, skipping angles where is_allowed(center, size, theta_deg) is false
+        template <typename IsAllowed>
+        TilePlacement findBestTheta(const cv::Point& center, int size, int theta_min, int theta_max, int coarse_step, IsAllowed&& is_allowed);
+
+        std::size_t cachedTables() const { return tables.size(); }
+
+
+    private:
+
+        // Samples are stored in groups of 1 + 2 * band_half_width: the centerline
+        // pixel first, then the off-line pixels that only count when it is inside.
+        struct SampleTable {
+            std::vector<int16_t> dx;
+            std::vector<int16_t> dy;
+            std::vector<float> weight;
+            std::vector<int> linear;   // dy * guide step + dx
+            int radius = 0;            // max |dx|, |dy|
+        };
+
+        const SampleTable& table(int size, int theta_deg);
+        double gather(const SampleTable& t, const cv::Point& center) const;
+
+        double decay_rate;
+        int band_half_width;
+
+        cv::Mat guide;
+        std::unordered_map<int64_t, SampleTable> tables;
+
+        std::vector<double> scores;   // memo for one search, indexed by theta - theta_min
+
+};
+
+
+template <typename IsAllowed>
+TilePlacement TilePlacer::findBestTheta(const cv::Point& center, int size, int theta_min, int theta_max, int coarse_step, IsAllowed&& is_allowed) {
+    TilePlacement best;
+    best.center = center;
+    best.size = size;
+
+    if (guide.empty() || theta_max < theta_min || size <= 0) {
+        return best;
+    }
+
+    const double not_allowed = -std::numeric_limits<double>::infinity();
+    const double not_scored = std::numeric_limits<double>::quiet_NaN();
+    scores.assign(theta_max - theta_min + 1, not_scored);
+
+    auto score = [&](int theta) -> double {
+        double& s = scores[theta - theta_min];
+        if (s != s) {
+            s = is_allowed(center, size, theta) ? reward(center, size, theta) : not_allowed;
+            if (s != not_allowed) best.evaluations++;
+        }
+        return s;
+    };
+
+    // Ties keep the smaller angle, like the notebook's strict > scan
+    auto consider = [&](int theta, double s) {
+        if (s == not_allowed) return;
+        if (!best.valid || s > best.reward || (s == best.reward && theta < best.theta_deg)) {
+            best.valid = true;
+            best.reward = s;
+            best.theta_deg = theta;
+        }
+    };
+
+    const int step = std::max(1, coarse_step);
+
+    // Coarse pass, always including both ends of the range
+    int first = std::numeric_limits<int>::min();
+    int second = first;
+    double first_score = not_allowed, second_score = not_allowed;
+    for (int theta = theta_min; ; theta = std::min(theta + step, theta_max)) {
+        double s = score(theta);
+        consider(theta, s);
+        if (s > first_score) {
+            second = first; second_score = first_score;
+            first = theta; first_score = s;
+        }
+        else if (s > second_score) {
+            second = theta; second_score = s;
+        }
+        if (theta == theta_max) break;
+    }
+
+    // Refine the two best coarse angles by hill climbing with halving steps
+    for (int candidate : {first, second}) {
+        if (candidate < theta_min || step == 1) continue;
+
+        int current = candidate;
+        for (int s = step / 2; s >= 1; s /= 2) {
+            int best_local = current;
+            for (int theta : {current - s, current + s}) {
+                if (theta < theta_min || theta > theta_max) continue;
+                double value = score(theta);
+                consider(theta, value);
+                if (value > scores[best_local - theta_min]) best_local = theta;
+            }
+            current = best_local;
+        }
+    }
+
+    return best;
+}
+
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace mosaic_gen {
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+
+namespace {
+
+// About 12 MB of events, minutes of a busy server
+constexpr size_t kDefaultEventCapacity = size_t(1) << 18;
+
+}
+
+
+Tracer::Tracer() : epoch(chrono::steady_clock::now()), event_capacity(kDefaultEventCapacity) {}
+
+
+void Tracer::clear() {
+    lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    next_event = 0;
+    dropped = 0;
+    span_totals.clear();
+    counter_values.clear();
+    memory.clear();
+    memory_total = 0;
+    memory_peak = 0;
+    epoch = chrono::steady_clock::now();
+}
+
+
+void Tracer::setEventCapacity(size_t capacity) {
+    lock_guard<std::mutex> lock(mutex);
+    capacity = max<size_t>(1, capacity);
+
+    // keep the newest events that still fit, oldest first
+    vector<Event> kept;
+    kept.reserve(min(capacity, events.size()));
+    const size_t skip = events.size() > capacity ? events.size() - capacity : 0;
+    size_t index = 0;
+    forEachEvent([&](const Event& e) {
+        if (index++ >= skip) kept.push_back(e);
+    });
+    dropped += skip;
+    events.swap(kept);
+    next_event = 0;
+    event_capacity = capacity;
+}
+
+
+size_t Tracer::eventCapacity() const {
+    lock_guard<std::mutex> lock(mutex);
+    return event_capacity;
+}
+
+
+size_t Tracer::droppedEvents() const {
+    lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+
+double Tracer::sinceEpoch(chrono::steady_clock::time_point t) const {
+    return chrono::duration<double, micro>(t - epoch).count();
+}
+
+
+int Tracer::threadIndex() {
+    static atomic<int> next_index{0};
+    thread_local int index = next_index++;
+    return index;
+}
+
+
+void Tracer::push(const Event& event) {
+    if (events.size() < event_capacity) {
+        events.push_back(event);
+        return;
+    }
+    events[next_event] = event;
+    next_event = (next_event + 1) % events.size();
+    dropped++;
+}
+
+
+void Tracer::addSpan(const char* name, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end) {
+    const int tid = threadIndex();
+    const double dur_us = chrono::duration<double, micro>(end - start).count();
+    lock_guard<std::mutex> lock(mutex);
+    const double ts_us = sinceEpoch(start);
+    push(Event{name, 'X', ts_us, dur_us, 0.0, tid});
+
+    SpanTotals& totals = span_totals[name];
+    if (totals.calls == 0) totals.first_ts = ts_us;
+    totals.calls++;
+    totals.total_us += dur_us;
+    totals.max_us = max(totals.max_us, dur_us);
+}
+
+
+void Tracer::addCounter(const char* name, double value) {
+    const int tid = threadIndex();
+    const auto now = chrono::steady_clock::now();
+    lock_guard<std::mutex> lock(mutex);
+    push(Event{name, 'C', sinceEpoch(now), 0.0, value, tid});
+    counter_values[name] = value;
+}
+
+
+void Tracer::setMemory(const char* name, size_t bytes) {
+    const int tid = threadIndex();
+    const auto now = chrono::steady_clock::now();
+    lock_guard<std::mutex> lock(mutex);
+
+    MemoryGauge& gauge = memory[{tid, name}];
+    memory_total = memory_total - gauge.current + bytes;
+    gauge.current = bytes;
+    gauge.peak = max(gauge.peak, bytes);
+    memory_peak = max(memory_peak, memory_total);
+
+    push(Event{"memory_bytes", 'C', sinceEpoch(now), 0.0, static_cast<double>(memory_total), 0});
+}
+
+
+void Tracer::writeChromeTrace(ostream& out) const {
+    lock_guard<std::mutex> lock(mutex);
+
+    out << "{\"traceEvents\": [\n";
+    size_t i = 0;
+    forEachEvent([&](const Event& e) {
+        out << "  {\"name\": \"" << e.name << "\", \"cat\": \"mosaic\", \"ph\": \"" << e.phase
+            << "\", \"ts\": " << fixed << setprecision(3) << e.ts_us
+            << ", \"pid\": 1, \"tid\": " << e.tid;
+        if (e.phase == 'X') {
+            out << ", \"dur\": " << e.dur_us;
+        }
+        else {
+            out << ", \"args\": {\"value\": " << setprecision(0) << e.value << "}";
+        }
+        out << "}" << (++i < events.size() ? "," : "") << "\n";
+    });
+    out << "], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+    out.unsetf(ios::floatfield);
+}
+
+
+bool Tracer::writeChromeTrace(const string& path) const {
+    ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    writeChromeTrace(file);
+    return true;
+}
+
+
+void Tracer::printSummary(ostream& out) const {
+    lock_guard<std::mutex> lock(mutex);
+
+    // the same name can come from literals at different addresses
+    map<string, SpanTotals> spans;
+    for (const auto& [name, t] : span_totals) {
+        SpanTotals& s = spans[name];
+        s.first_ts = s.calls == 0 ? t.first_ts : std::min(s.first_ts, t.first_ts);
+        s.calls += t.calls;
+        s.total_us += t.total_us;
+        s.max_us = std::max(s.max_us, t.max_us);
+    }
+    map<string, double> counters;
+    for (const auto& [name, value] : counter_values) {
+        counters[name] = value;
+    }
+
+    // stages in the order they first ran
+    vector<pair<string, SpanTotals>> ordered(spans.begin(), spans.end());
+    sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) { return a.second.first_ts < b.second.first_ts; });
+
+    // the caller's formatting is put back at the end
+    const ios::fmtflags flags = out.flags();
+    const streamsize precision = out.precision();
+    out << fixed << setprecision(3);
+    out << left << setw(28) << "stage" << right << setw(8) << "calls" << setw(14) << "total ms"
+        << setw(12) << "mean ms" << setw(12) << "max ms" << "\n";
+    for (const auto& [name, s] : ordered) {
+        out << left << setw(28) << name << right << setw(8) << s.calls << setw(14) << s.total_us / 1e3
+            << setw(12) << s.total_us / s.calls / 1e3 << setw(12) << s.max_us / 1e3 << "\n";
+    }
+
+    if (!counters.empty()) {
+        out << "counters:\n";
+        for (const auto& [name, value] : counters) {
+            out << "  " << left << setw(26) << name << right << setprecision(0) << value << "\n";
+        }
+    }
+
+    if (!memory.empty()) {
+        // per name, the largest any one thread (one Mosaic) held
+        map<string, size_t> peaks;
+        for (const auto& [key, gauge] : memory) {
+            size_t& peak = peaks[key.second];
+            peak = std::max(peak, gauge.peak);
+        }
+        out << setprecision(2) << "memory peaks (MB, per thread):\n";
+        for (const auto& [name, peak] : peaks) {
+            out << "  " << left << setw(26) << name << right << peak / 1e6 << "\n";
+        }
+        out << "  " << left << setw(26) << "total (estimate)" << right << memory_peak / 1e6 << "\n";
+    }
+
+    if (dropped > 0) {
+        out << dropped << " trace events dropped (ring of " << event_capacity << "), totals above include them\n";
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}
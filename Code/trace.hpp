@@ -0,0 +1,172 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Lightweight stage tracing. Build with MOSAIC_TRACING=1 (CMake option
+// MOSAIC_TRACING, on by default) and call Tracer::instance().enable() to
+// record; with MOSAIC_TRACING=0 every macro below expands to nothing.
+//
+//   MOSAIC_TRACE_SCOPE("cannyFilter");                  // timed span until end of scope
+//   MOSAIC_TRACE_COUNTER("edge_pixels", countNonZero(edges)); // value only evaluated when enabled
+//   MOSAIC_TRACE_MEMORY("edges", edges.total());        // bytes held by a stage output
+//
+// Events go to a ring of eventCapacity() entries, so a tracer left on in a
+// long-running process keeps the most recent window; the summary table counts
+// every span and counter, including the ones the ring dropped.
+
+#ifndef MOSAIC_TRACING
+#define MOSAIC_TRACING 1
+#endif
+
+namespace mosaic_gen {
+
+class Tracer {
+
+    public:
+
+        static Tracer& instance();
+
+        void enable() { active.store(true, std::memory_order_relaxed); }
+        void disable() { active.store(false, std::memory_order_relaxed); }
+        bool enabled() const { return active.load(std::memory_order_relaxed); }
+        void clear();
+
+        // Events kept for writeChromeTrace, older ones are overwritten first
+        void setEventCapacity(std::size_t capacity);
+        std::size_t eventCapacity() const;
+        std::size_t droppedEvents() const;
+
+        void addSpan(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+        void addCounter(const char* name, double value);
+
+        // Bytes currently held under name by the calling thread. Gauges are kept
+        // per thread, so concurrent Mosaics (one per batch or server worker) add
+        // up in the total instead of overwriting each other's stage buffers.
+        void setMemory(const char* name, std::size_t bytes);
+
+        // Chrome / Perfetto trace event JSON (load in chrome://tracing or ui.perfetto.dev)
+        void writeChromeTrace(std::ostream& out) const;
+        bool writeChromeTrace(const std::string& path) const;
+
+        // Per-stage timing table, last counter values and memory peaks
+        void printSummary(std::ostream& out) const;
+
+
+    private:
+
+        Tracer();
+
+        struct Event {
+            const char* name;
+            char phase;          // 'X' span, 'C' counter
+            double ts_us;
+            double dur_us;
+            double value;
+            int tid;
+        };
+
+        struct MemoryGauge {
+            std::size_t current = 0;
+            std::size_t peak = 0;
+        };
+
+        struct SpanTotals {
+            std::size_t calls = 0;
+            double total_us = 0.0;
+            double max_us = 0.0;
+            double first_ts = 0.0;
+        };
+
+        double sinceEpoch(std::chrono::steady_clock::time_point t) const;
+        static int threadIndex();
+        void push(const Event& event);
+
+        template <typename Fn>
+        void forEachEvent(Fn fn) const {
+            for (std::size_t i = 0; i < events.size(); ++i) {
+                fn(events[(next_event + i) % events.size()]);
+            }
+        }
+
+        std::atomic<bool> active{false};
+        std::chrono::steady_clock::time_point epoch;
+
+        mutable std::mutex mutex;
+        std::vector<Event> events;      // ring once full, next_event is the oldest
+        std::size_t event_capacity;
+        std::size_t next_event = 0;
+        std::size_t dropped = 0;
+
+        // summary totals, keyed by the name literal's address and merged by text when printed
+        std::unordered_map<const char*, SpanTotals> span_totals;
+        std::unordered_map<const char*, double> counter_values;
+
+        std::map<std::pair<int, std::string>, MemoryGauge> memory;   // (thread, name)
+        std::size_t memory_total = 0;
+        std::size_t memory_peak = 0;
+
+};
+
+
+class TraceScope {
+
+    public:
+
+        explicit TraceScope(const char* name)
+            : name(name), active(Tracer::instance().enabled()) {
+            if (active) start = std::chrono::steady_clock::now();
+        }
+
+        ~TraceScope() {
+            if (active) Tracer::instance().addSpan(name, start, std::chrono::steady_clock::now());
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+
+    private:
+
+        const char* name;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+
+};
+
+}
+
+
+#if MOSAIC_TRACING
+
+#define MOSAIC_TRACE_CONCAT_INNER(a, b) a##b
+#define MOSAIC_TRACE_CONCAT(a, b) MOSAIC_TRACE_CONCAT_INNER(a, b)
+
+#define MOSAIC_TRACE_SCOPE(name) \
+    ::mosaic_gen::TraceScope MOSAIC_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#define MOSAIC_TRACE_COUNTER(name, value) \
+    do { if (::mosaic_gen::Tracer::instance().enabled()) ::mosaic_gen::Tracer::instance().addCounter(name, static_cast<double>(value)); } while (0)
+
+#define MOSAIC_TRACE_MEMORY(name, bytes) \
+    do { if (::mosaic_gen::Tracer::instance().enabled()) ::mosaic_gen::Tracer::instance().setMemory(name, static_cast<std::size_t>(bytes)); } while (0)
+
+#else
+
+#define MOSAIC_TRACE_SCOPE(name) do { } while (0)
+#define MOSAIC_TRACE_COUNTER(name, value) do { } while (0)
+#define MOSAIC_TRACE_MEMORY(name, bytes) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,380 @@
+#include "vector_export.hpp"
+#include "trace.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if MOSAIC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace mosaic_gen {
+
+#if MOSAIC_HAVE_ZLIB
+
+struct VectorExporter::Deflater {
+    z_stream stream{};
+    std::vector<char> out = std::vector<char>(1 << 16);
+
+    // gzip wraps the whole SVG, PDF wants a plain zlib stream
+    bool init(int level, bool gzip) {
+        return deflateInit2(&stream, level, Z_DEFLATED, gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~Deflater() { deflateEnd(&stream); }
+};
+
+#else
+
+struct VectorExporter::Deflater {};
+
+#endif
+
+
+namespace {
+
+    // Corners of a drawSquare-style square, in drawing order
+    void squareCorners(const Graphics::TileRecord& tile, double xs[4], double ys[4]) {
+        static const double unit[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+        const double half = tile.size / 2.0;
+        const double theta = tile.angle_deg * M_PI / 180.0;
+        const double c = std::cos(theta);
+        const double s = std::sin(theta);
+        for (int i = 0; i < 4; ++i) {
+            const double x = unit[i][0] * half;
+            const double y = unit[i][1] * half;
+            xs[i] = tile.center.x + x * c - y * s;
+            ys[i] = tile.center.y + x * s + y * c;
+        }
+    }
+
+}
+
+
+VectorExporter::VectorExporter() = default;
+
+
+VectorExporter::~VectorExporter() {
+    if (isOpen()) {
+        close();
+    }
+}
+
+
+bool VectorExporter::open(const std::string& path, cv::Size frame, const VectorExportOptions& options) {
+    if (isOpen()) {
+        close();
+    }
+
+    this->options = options;
+    this->frame = frame;
+    body.clear();
+    body.reserve(options.chunk_bytes + 256);
+    deflater.reset();
+    tile_count = 0;
+    file_bytes = 0;
+    failed = false;
+    pdf_fill_set = false;
+    pdf_stroke_set = false;
+    pdf_line_width = -1;
+
+    // before the file is created, so a name picked for compressed output
+    // never ends up holding plain text
+    if (options.compress) {
+#if MOSAIC_HAVE_ZLIB
+        deflater = std::make_unique<Deflater>();
+        if (!deflater->init(options.compression_level, options.format == VectorFormat::SVG)) {
+            std::cerr << "zlib init failed for: " << path << std::endl;
+            deflater.reset();
+            return false;
+        }
+#else
+        std::cerr << "Built without zlib, writing " << path << " uncompressed" << std::endl;
+#endif
+    }
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Could not open vector output: " << path << std::endl;
+        deflater.reset();
+        return false;
+    }
+
+    if (options.format == VectorFormat::SVG) {
+        beginSvg();
+    }
+    else {
+        beginPdf();
+    }
+    return !failed;
+}
+
+
+void VectorExporter::writeRaw(const char* data, std::size_t size) {
+    if (size == 0) {
+        return;
+    }
+    file.write(data, size);
+    file_bytes += size;
+    failed = failed || !file;
+}
+
+
+void VectorExporter::flushBody(bool finish) {
+#if MOSAIC_HAVE_ZLIB
+    if (deflater) {
+        z_stream& z = deflater->stream;
+        z.next_in = reinterpret_cast<Bytef*>(body.empty() ? nullptr : &body[0]);
+        z.avail_in = static_cast<uInt>(body.size());
+        const int mode = finish ? Z_FINISH : Z_NO_FLUSH;
+        int status;
+        do {
+            z.next_out = reinterpret_cast<Bytef*>(deflater->out.data());
+            z.avail_out = static_cast<uInt>(deflater->out.size());
+            status = deflate(&z, mode);
+            writeRaw(deflater->out.data(), deflater->out.size() - z.avail_out);
+        } while (z.avail_out == 0 || (finish && status != Z_STREAM_END && status != Z_STREAM_ERROR));
+        body.clear();
+        return;
+    }
+#endif
+    (void)finish;
+    writeRaw(body);
+    body.clear();
+}
+
+
+void VectorExporter::append(const char* text) {
+    body.append(text);
+}
+
+
+// Two decimals without printf: this runs ten times per tile
+void VectorExporter::appendNumber(double value) {
+    int64_t hundredths = std::llround(value * 100.0);
+    if (hundredths < 0) {
+        body.push_back('-');
+        hundredths = -hundredths;
+    }
+
+    char digits[24];
+    int n = 0;
+    int64_t whole = hundredths / 100;
+    do {
+        digits[n++] = static_cast<char>('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    while (n > 0) body.push_back(digits[--n]);
+
+    const int frac = static_cast<int>(hundredths % 100);
+    if (frac != 0) {
+        body.push_back('.');
+        body.push_back(static_cast<char>('0' + frac / 10));
+        if (frac % 10 != 0) body.push_back(static_cast<char>('0' + frac % 10));
+    }
+}
+
+
+void VectorExporter::appendColor(const cv::Vec3b& bgr) {
+    static const char hex[] = "0123456789abcdef";
+    body.push_back('#');
+    for (int c = 2; c >= 0; --c) {
+        body.push_back(hex[bgr[c] >> 4]);
+        body.push_back(hex[bgr[c] & 15]);
+    }
+}
+
+
+void VectorExporter::add(const Graphics::TileRecord* tiles, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) add(tiles[i]);
+}
+
+
+void VectorExporter::add(const Graphics::TileRecord& tile) {
+    if (!isOpen() || tile.size <= 0 || (!tile.filled && tile.border_width <= 0)) {
+        return;
+    }
+
+    double xs[4], ys[4];
+    squareCorners(tile, xs, ys);
+
+    if (options.format == VectorFormat::SVG) {
+        append("<polygon points=\"");
+        for (int i = 0; i < 4; ++i) {
+            if (i > 0) body.push_back(' ');
+            appendNumber(xs[i]);
+            body.push_back(',');
+            appendNumber(ys[i]);
+        }
+        append("\" fill=\"");
+        if (tile.filled) appendColor(tile.fill_color);
+        else append("none");
+        body.push_back('"');
+        if (tile.border_width > 0) {
+            append(" stroke=\"");
+            appendColor(tile.border_color);
+            append("\" stroke-width=\"");
+            appendNumber(tile.border_width);
+            body.push_back('"');
+        }
+        append("/>\n");
+    }
+    else {
+        auto set_color = [&](const cv::Vec3b& bgr, const char* op) {
+            for (int c = 2; c >= 0; --c) {
+                appendNumber(bgr[c] / 255.0);
+                body.push_back(' ');
+            }
+            append(op);
+        };
+
+        if (tile.filled && (!pdf_fill_set || pdf_fill != tile.fill_color)) {
+            set_color(tile.fill_color, "rg\n");
+            pdf_fill = tile.fill_color;
+            pdf_fill_set = true;
+        }
+        if (tile.border_width > 0) {
+            if (!pdf_stroke_set || pdf_stroke != tile.border_color) {
+                set_color(tile.border_color, "RG\n");
+                pdf_stroke = tile.border_color;
+                pdf_stroke_set = true;
+            }
+            if (pdf_line_width != tile.border_width) {
+                appendNumber(tile.border_width);
+                append(" w\n");
+                pdf_line_width = tile.border_width;
+            }
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            appendNumber(xs[i]);
+            body.push_back(' ');
+            appendNumber(ys[i]);
+            append(i == 0 ? " m " : " l ");
+        }
+        append(tile.filled ? (tile.border_width > 0 ? "b\n" : "h f\n") : "s\n");
+    }
+
+    ++tile_count;
+    if (body.size() >= options.chunk_bytes) {
+        flushBody(false);
+    }
+}
+
+
+void VectorExporter::beginSvg() {
+    append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+    appendNumber(frame.width * options.scale);
+    append("\" height=\"");
+    appendNumber(frame.height * options.scale);
+    append("\" viewBox=\"0 0 ");
+    appendNumber(frame.width);
+    body.push_back(' ');
+    appendNumber(frame.height);
+    append("\" stroke-linejoin=\"miter\">\n");
+    if (options.background) {
+        append("<rect width=\"100%\" height=\"100%\" fill=\"");
+        appendColor(options.background_color);
+        append("\"/>\n");
+    }
+}
+
+
+void VectorExporter::endSvg() {
+    append("</svg>\n");
+    flushBody(true);
+}
+
+
+// One page whose content stream (object 4) holds every tile. Its length is
+// only known at the end, so /Length points at object 5, written afterwards.
+void VectorExporter::beginPdf() {
+    const double width = frame.width * options.scale;
+    const double height = frame.height * options.scale;
+
+    writeRaw("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+
+    object_offsets[1] = file_bytes;
+    writeRaw("1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+    object_offsets[2] = file_bytes;
+    writeRaw("2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+
+    object_offsets[3] = file_bytes;
+    writeRaw("3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 ");
+    appendNumber(width);
+    body.push_back(' ');
+    appendNumber(height);
+    append("] /Contents 4 0 R /Resources << >> >>\nendobj\n");
+    writeRaw(body);
+    body.clear();
+
+    object_offsets[4] = file_bytes;
+    writeRaw(deflater ? "4 0 obj\n<< /Length 5 0 R /Filter /FlateDecode >>\nstream\n"
+                      : "4 0 obj\n<< /Length 5 0 R >>\nstream\n");
+    stream_start = file_bytes;
+
+    // canvas pixels, y down
+    appendNumber(options.scale);
+    append(" 0 0 ");
+    appendNumber(-options.scale);
+    append(" 0 ");
+    appendNumber(height);
+    append(" cm\n0 j\n");
+    if (options.background) {
+        for (int c = 2; c >= 0; --c) {
+            appendNumber(options.background_color[c] / 255.0);
+            body.push_back(' ');
+        }
+        append("rg\n0 0 ");
+        appendNumber(frame.width);
+        body.push_back(' ');
+        appendNumber(frame.height);
+        append(" re f\n");
+    }
+}
+
+
+void VectorExporter::endPdf() {
+    flushBody(true);
+    const std::size_t stream_length = file_bytes - stream_start;
+    writeRaw("\nendstream\nendobj\n");
+
+    char line[64];
+    object_offsets[5] = file_bytes;
+    std::snprintf(line, sizeof(line), "5 0 obj\n%zu\nendobj\n", stream_length);
+    writeRaw(line, std::strlen(line));
+
+    const std::size_t xref = file_bytes;
+    writeRaw("xref\n0 6\n0000000000 65535 f \n");
+    for (int i = 1; i <= 5; ++i) {
+        std::snprintf(line, sizeof(line), "%010zu 00000 n \n", object_offsets[i]);
+        writeRaw(line, std::strlen(line));
+    }
+    std::snprintf(line, sizeof(line), "trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n%zu\n%%%%EOF\n", xref);
+    writeRaw(line, std::strlen(line));
+}
+
+
+bool VectorExporter::close() {
+    if (!isOpen()) {
+        return false;
+    }
+
+    MOSAIC_TRACE_SCOPE("VectorExporter::close");
+    if (options.format == VectorFormat::SVG) {
+        endSvg();
+    }
+    else {
+        endPdf();
+    }
+    deflater.reset();
+    file.close();
+    failed = failed || file.fail();
+    MOSAIC_TRACE_COUNTER("vector_tiles", tile_count);
+    return !failed;
+}
+
+}
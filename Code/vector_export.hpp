@@ -0,0 +1,109 @@
+#ifndef VECTOR_EXPORT_HPP
+#define VECTOR_EXPORT_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+#include "graphics.hpp"
+
+// Compressed output needs zlib (CMake links it when found); without it the
+// compress option is ignored with a warning. Check compressionAvailable()
+// before naming a file .svgz.
+#ifndef MOSAIC_HAVE_ZLIB
+#define MOSAIC_HAVE_ZLIB 0
+#endif
+
+namespace mosaic_gen {
+
+enum class VectorFormat { SVG, PDF };
+
+
+struct VectorExportOptions {
+    VectorFormat format = VectorFormat::SVG;
+    double scale = 1.0;              // output units (SVG px, PDF points) per canvas pixel
+    bool compress = false;           // SVG: whole file gzipped (.svgz), PDF: FlateDecode content stream
+    int compression_level = 1;       // zlib level; 1 is ~3x faster than 6 for ~15% more bytes
+    bool background = true;          // paint the frame first, like the black canvas Mat
+    cv::Vec3b background_color;      // BGR
+    std::size_t chunk_bytes = 1 << 20;   // text buffered before it goes through zlib and to disk
+};
+
+
+// Streams Graphics::TileRecord squares to a single page SVG or PDF. Tiles are
+// formatted into a fixed size buffer and flushed chunk by chunk, so memory
+// does not grow with the tile count. Outlines are centered on the square's
+// edge, the same geometry Graphics::drawTiles rasterizes.
+//
+//   VectorExporter exporter;
+//   exporter.open("mosaic.pdf", canvas.size(), options);
+//   for (...) exporter.add(record);
+//   exporter.close();
+class VectorExporter {
+
+    public:
+
+        VectorExporter();
+        ~VectorExporter();
+
+        VectorExporter(const VectorExporter&) = delete;
+        VectorExporter& operator=(const VectorExporter&) = delete;
+
+        // frame is the canvas size in pixels, tile coordinates are in the same space
+        bool open(const std::string& path, cv::Size frame, const VectorExportOptions& options);
+        void add(const Graphics::TileRecord& tile);
+        void add(const Graphics::TileRecord* tiles, std::size_t count);
+
+        // Writes the trailer; false if any write failed
+        bool close();
+
+        bool isOpen() const { return file.is_open(); }
+        bool compressed() const { return deflater != nullptr; }
+        static bool compressionAvailable() { return MOSAIC_HAVE_ZLIB != 0; }
+        std::size_t tilesWritten() const { return tile_count; }
+        std::size_t bytesWritten() const { return file_bytes; }
+
+
+    private:
+
+        struct Deflater;
+
+        void writeRaw(const char* data, std::size_t size);
+        void writeRaw(const std::string& text) { writeRaw(text.data(), text.size()); }
+        void flushBody(bool finish);
+
+        void append(const char* text);
+        void appendNumber(double value);
+        void appendColor(const cv::Vec3b& bgr);
+
+        void beginSvg();
+        void beginPdf();
+        void endSvg();
+        void endPdf();
+
+        std::ofstream file;
+        VectorExportOptions options;
+        cv::Size frame;
+
+        std::string body;                // formatted text waiting for flushBody
+        std::unique_ptr<Deflater> deflater;
+
+        std::size_t tile_count = 0;
+        std::size_t file_bytes = 0;
+        bool failed = false;
+
+        // PDF bookkeeping: byte offsets of objects 1-5, start of the content
+        // stream and the colors / width currently set in the graphics state
+        std::size_t object_offsets[6] = {};
+        std::size_t stream_start = 0;
+        cv::Vec3b pdf_fill, pdf_stroke;
+        bool pdf_fill_set = false;
+        bool pdf_stroke_set = false;
+        int pdf_line_width = -1;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "frame_sequence.hpp"
+
+using namespace std;
+using mosaic_gen::FrameSequenceOptions;
+using mosaic_gen::FrameStats;
+using mosaic_gen::MosaicParams;
+
+
+void printUsage() {
+    cerr << "usage: mosaic_video <video | frames/%04d.png> <output.mp4 | out/%04d.jpg>\n"
+         << "         [--cell N] [--edge-change F] [--blur-change F] [--refresh F] [--threads N] [--tile-segments N]" << endl;
+}
+
+
+int main(int argc, char** argv) {
+
+    if (argc < 3) {
+        printUsage();
+        return 1;
+    }
+
+    string input = argv[1];
+    string output = argv[2];
+    FrameSequenceOptions options;
+    MosaicParams params;
+
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--cell" && has_value) options.cell_size = atoi(argv[++i]);
+        else if (arg == "--edge-change" && has_value) options.edge_change = atof(argv[++i]);
+        else if (arg == "--blur-change" && has_value) options.blur_change = atof(argv[++i]);
+        else if (arg == "--refresh" && has_value) options.full_refresh_fraction = atof(argv[++i]);
+        else if (arg == "--threads" && has_value) options.threads = atoi(argv[++i]);
+        else if (arg == "--tile-segments" && has_value) params.tile_segments = atoi(argv[++i]);
+        else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    vector<FrameStats> frames;
+    int written = mosaic_gen::runFrameSequence(input, output, params, options, &frames);
+    if (written < 0) {
+        return 1;
+    }
+
+    double total_seconds = 0.0;
+    double refresh_seconds = 0.0;
+    int refreshes = 0;
+    for (const auto& frame : frames) {
+        total_seconds += frame.seconds;
+        if (frame.full_refresh) {
+            refresh_seconds += frame.seconds;
+            refreshes++;
+        }
+    }
+
+    cout << fixed << setprecision(2);
+    cout << "Frames: " << written << ", full refreshes: " << refreshes;
+    if (!frames.empty()) {
+        cout << ", " << 1000.0 * total_seconds / frames.size() << " ms/frame ("
+             << frames.size() / max(total_seconds, 1e-9) << " fps)";
+    }
+    cout << endl;
+    if (refreshes > 0 && refreshes < static_cast<int>(frames.size())) {
+        const int partial = static_cast<int>(frames.size()) - refreshes;
+        cout << "Full refresh " << 1000.0 * refresh_seconds / refreshes << " ms/frame, partial "
+             << 1000.0 * (total_seconds - refresh_seconds) / partial << " ms/frame" << endl;
+    }
+
+    return written > 0 ? 0 : 2;
+}
@@ -0,0 +1,53 @@
+#include "workspace.hpp"
+
+namespace mosaic_gen {
+
+cv::Mat& MosaicWorkspace::reuseOrCreate(cv::Mat& image, cv::Size size, int type) {
+    const bool shared = image.u && image.u->refcount > 1;
+    const std::size_t bytes = static_cast<std::size_t>(size.area()) * CV_ELEM_SIZE(type);
+
+    if (!image.empty() && !shared && image.size() == size && image.type() == type) {
+        counters.reused++;
+        counters.bytes_reused += bytes;
+        return image;
+    }
+
+    image.release();
+    image.create(size, type);
+    counters.allocated++;
+    counters.bytes_allocated += bytes;
+    return image;
+}
+
+
+cv::Mat& MosaicWorkspace::prepare(const std::string& slot, cv::Mat& image, cv::Size size, int type) {
+    if (image.empty()) {
+        auto it = parked.find(slot);
+        if (it != parked.end()) {
+            image = it->second;
+            parked.erase(it);
+        }
+    }
+    return reuseOrCreate(image, size, type);
+}
+
+
+cv::Mat& MosaicWorkspace::scratch(const std::string& slot, cv::Size size, int type) {
+    return reuseOrCreate(scratch_buffers[slot], size, type);
+}
+
+
+void MosaicWorkspace::park(const std::string& slot, cv::Mat& image) {
+    if (!image.empty()) {
+        parked[slot] = image;
+    }
+    image.release();
+}
+
+
+void MosaicWorkspace::clear() {
+    parked.clear();
+    scratch_buffers.clear();
+}
+
+}
@@ -0,0 +1,59 @@
+#ifndef WORKSPACE_HPP
+#define WORKSPACE_HPP
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <opencv2/core.hpp>
+
+namespace mosaic_gen {
+
+struct WorkspaceStats {
+    std::size_t reused = 0;            // buffers handed out without allocating
+    std::size_t allocated = 0;
+    std::size_t bytes_reused = 0;
+    std::size_t bytes_allocated = 0;
+};
+
+
+// Stage buffers that outlive one image. A Mosaic asks for each output with
+// prepare(); when the stage's previous buffer (or the one parked for that slot
+// by the last image) has the same size and type and nobody else holds it, it is
+// reused as is, otherwise a new one is allocated.
+//
+// A buffer still referenced elsewhere (queued in an ImageWriter, handed to an
+// encoder) is never reused, the same rule as before writing a stage in place.
+class MosaicWorkspace {
+
+    public:
+
+        // Make image a size x type buffer for slot
+        cv::Mat& prepare(const std::string& slot, cv::Mat& image, cv::Size size, int type);
+
+        // Buffer owned by the workspace itself, for temporaries between stages
+        cv::Mat& scratch(const std::string& slot, cv::Size size, int type);
+
+        // Take image's buffer for later reuse and leave image empty
+        void park(const std::string& slot, cv::Mat& image);
+
+        // Drop every parked and scratch buffer
+        void clear();
+
+        const WorkspaceStats& stats() const { return counters; }
+        std::size_t allocationsAvoided() const { return counters.reused; }
+        void resetStats() { counters = WorkspaceStats(); }
+
+
+    private:
+
+        cv::Mat& reuseOrCreate(cv::Mat& image, cv::Size size, int type);
+
+        std::unordered_map<std::string, cv::Mat> parked;
+        std::unordered_map<std::string, cv::Mat> scratch_buffers;
+        WorkspaceStats counters;
+
+};
+
+}
+
+#endif